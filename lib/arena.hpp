@@ -0,0 +1,300 @@
+#ifndef LIB_ARENA_HPP
+#define LIB_ARENA_HPP
+
+#include "arrayview.hpp"
+
+#include <new>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ * Mutable, NUL-terminated string living in an Arena (or in any other buffer
+ * that outlives it). It does not own its memory, copies refer to the same
+ * characters. The editing functions never grow the string, they work in
+ * place.
+ */
+struct ArenaString {
+  char*  s;
+  size_t len;
+
+  ArenaString() noexcept : s(empty_string()), len(0) {}
+  ArenaString(char* s_, size_t len_) noexcept : s(s_), len(len_) {}
+
+  inline const char* c_str()            const noexcept { return s;        }
+  inline char*       data()                   noexcept { return s;        }
+  inline size_t      size()             const noexcept { return len;      }
+  inline size_t      length()           const noexcept { return len;      }
+  inline bool        empty()            const noexcept { return !len;     }
+  inline char        operator[](size_t i) const noexcept { return s[i];   }
+  inline char        back()             const noexcept { return s[len-1]; }
+  inline const char* begin()            const noexcept { return s;        }
+  inline const char* end()              const noexcept { return s + len;  }
+
+  inline bool operator==(const char* rhs) const noexcept { return ! std::strcmp(s, rhs); }
+  inline bool operator!=(const char* rhs) const noexcept { return   std::strcmp(s, rhs); }
+
+  size_t find(const char* needle, size_t pos = 0) const noexcept {
+    const char* found = std::strstr(s + pos, needle);
+    return found ? size_t(found - s) : std::string::npos;
+  }
+
+  size_t find(char c, size_t pos = 0) const noexcept {
+    const char* found = static_cast<const char*>(std::memchr(s + pos, c, len - pos));
+    return found ? size_t(found - s) : std::string::npos;
+  }
+
+  /* Cuts the string at `n` */
+  void truncate(size_t n) noexcept {
+    if (n < len) {
+      len = n;
+      s[n] = '\0';
+    }
+  }
+
+  /* Drops the first `n` characters */
+  void remove_prefix(size_t n) noexcept {
+    s   += n;
+    len -= n;
+  }
+
+  void erase(size_t pos, size_t n) noexcept {
+    std::memmove(s + pos, s + pos + n, len - pos - n + 1);
+    len -= n;
+  }
+
+  /* Replaces all occurrences of `needle` by `c` */
+  ArenaString& replace_all(const char* needle, char c) noexcept {
+    const size_t needle_len = std::strlen(needle);
+    for (size_t pos = 0; (pos = find(needle, pos)) != std::string::npos; ++pos) {
+      s[pos] = c;
+      erase(pos + 1, needle_len - 1);
+    }
+    return *this;
+  }
+
+  ArenaString& erase_all(const char* needle) noexcept {
+    const size_t needle_len = std::strlen(needle);
+    for (size_t pos = 0; (pos = find(needle, pos)) != std::string::npos;)
+      erase(pos, needle_len);
+    return *this;
+  }
+
+  ArenaString& trim(const char* chars = " \n\t\f\v") noexcept {
+    while (len && std::strchr(chars, s[len - 1]))
+      --len;
+    const size_t count = std::strspn(s, chars);
+    remove_prefix(count < len ? count : len);
+    if (s[len])
+      s[len] = '\0';
+    return *this;
+  }
+
+private:
+  // Writes to the empty string are avoided by the editing functions
+  static char* empty_string() noexcept {
+    static char empty[1];
+    return empty;
+  }
+};
+
+/**
+ * Splits a NUL-terminated string at `separator` without copying it.
+ *
+ * Each separator is overwritten by a NUL when the iterator reaches it, so
+ * the parts are ArenaStrings referring to the characters of the original
+ * buffer. An empty part after a trailing separator is not returned.
+ *
+ *   for (ArenaString url : SplitInPlace(urls, len, ','))
+ */
+class SplitInPlace {
+public:
+  SplitInPlace(char* s, size_t len, char separator) noexcept
+  : _s(s), _end(s + len), _separator(separator) {}
+
+  SplitInPlace(ArenaString s, char separator) noexcept
+  : SplitInPlace(s.data(), s.size(), separator) {}
+
+  class iterator {
+  public:
+    ArenaString operator*() const noexcept { return ArenaString(_s, _len); }
+    bool operator!=(const iterator& rhs) const noexcept { return _s != rhs._s; }
+
+    iterator& operator++() noexcept {
+      _s = (_s + _len < _end ? _s + _len + 1 : _end);
+      find_separator();
+      return *this;
+    }
+
+  private:
+    friend class SplitInPlace;
+    char* _s;
+    char* _end;
+    size_t _len;
+    char _separator;
+
+    iterator(char* s, char* end, char separator) noexcept
+    : _s(s), _end(end), _len(0), _separator(separator) { find_separator(); }
+
+    void find_separator() noexcept {
+      char* sep = static_cast<char*>(std::memchr(_s, _separator, size_t(_end - _s)));
+      if (sep)
+        *sep = '\0';
+      _len = size_t((sep ? sep : _end) - _s);
+    }
+  };
+
+  iterator begin() const noexcept { return iterator(_s, _end, _separator);   }
+  iterator end()   const noexcept { return iterator(_end, _end, _separator); }
+
+private:
+  char* _s;
+  char* _end;
+  char _separator;
+};
+
+/**
+ * Bump allocator for objects that die together, e.g. the parse results of
+ * a page.
+ *
+ * Memory is taken from blocks of at least `block_size` bytes. Objects are
+ * never destructed, so only trivially destructible types can be stored.
+ * reset() makes all memory available again but keeps the largest block, so
+ * a reused arena stops allocating once it is big enough.
+ */
+class Arena {
+public:
+  enum { BLOCK_SIZE = 16 * 1024 };
+
+  Arena(size_t block_size = BLOCK_SIZE) noexcept
+  : _blocks(NULL)
+  , _pos(NULL)
+  , _end(NULL)
+  , _block_size(block_size)
+  , _bytes_used(0)
+  {}
+
+ ~Arena() {
+    free_blocks(_blocks);
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    uintptr_t pos = (reinterpret_cast<uintptr_t>(_pos) + align - 1) & ~uintptr_t(align - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(_end);
+    if (! _pos || pos > end || size > size_t(end - pos)) { // Aligning may pass the end
+      add_block(size + align);
+      pos = (reinterpret_cast<uintptr_t>(_pos) + align - 1) & ~uintptr_t(align - 1);
+    }
+
+    _pos = reinterpret_cast<char*>(pos + size);
+    _bytes_used += size;
+    return reinterpret_cast<void*>(pos);
+  }
+
+  template<typename T>
+  ArrayView<T> allocate_array(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value, "T is never destructed");
+    T* array = static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    for (size_t i = 0; i < n; ++i)
+      new (array + i) T();
+    return ArrayView<T>(array, n);
+  }
+
+  template<typename T>
+  ArrayView<T> copy(const T* data, size_t n) {
+    static_assert(std::is_trivially_copyable<T>::value, "T is copied with memcpy()");
+    ArrayView<T> array(static_cast<T*>(allocate(n * sizeof(T), alignof(T))), n);
+    if (n)
+      std::memcpy(array.data(), data, n * sizeof(T));
+    return array;
+  }
+
+  /* Returns an uninitialized string of `len` characters */
+  ArenaString allocate_string(size_t len) {
+    char* s = static_cast<char*>(allocate(len + 1, 1));
+    s[len] = '\0';
+    return ArenaString(s, len);
+  }
+
+  ArenaString copy(const char* s, size_t len) {
+    ArenaString result = allocate_string(len);
+    std::memcpy(result.data(), s, len);
+    return result;
+  }
+
+  ArenaString copy(const char* s)        { return copy(s, std::strlen(s));  }
+  ArenaString copy(const std::string& s) { return copy(s.data(), s.size()); }
+
+  /* Frees everything but the largest block */
+  void reset() noexcept {
+    Block* largest = _blocks;
+    for (Block* b = _blocks; b; b = b->next)
+      if (b->size > largest->size)
+        largest = b;
+
+    Block* rest = NULL;
+    for (Block* b = _blocks, *next; b; b = next) {
+      next = b->next;
+      if (b != largest) {
+        b->next = rest;
+        rest = b;
+      }
+    }
+    free_blocks(rest);
+
+    _blocks = largest;
+    _pos = _end = NULL;
+    if (largest) {
+      largest->next = NULL;
+      _pos = largest->data();
+      _end = _pos + largest->size;
+    }
+    _bytes_used = 0;
+  }
+
+  size_t bytes_used() const noexcept { return _bytes_used; }
+
+  size_t bytes_allocated() const noexcept {
+    size_t size = 0;
+    for (Block* b = _blocks; b; b = b->next)
+      size += b->size;
+    return size;
+  }
+
+private:
+  struct Block {
+    Block* next;
+    size_t size;
+    char*  data() noexcept { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  Block* _blocks;
+  char*  _pos;
+  char*  _end;
+  size_t _block_size;
+  size_t _bytes_used;
+
+  void add_block(size_t min_size) {
+    const size_t size = (min_size > _block_size ? min_size : _block_size);
+    Block* block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+    block->next = _blocks;
+    block->size = size;
+    _blocks = block;
+    _pos = block->data();
+    _end = _pos + size;
+  }
+
+  static void free_blocks(Block* b) noexcept {
+    for (Block* next; b; b = next) {
+      next = b->next;
+      ::operator delete(b);
+    }
+  }
+};
+
+#endif
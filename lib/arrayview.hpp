@@ -28,11 +28,8 @@ struct ArrayView {
     , _size(N)
   {}
 
-  inline ArrayView& operator=(const ArrayView& rhs) noexcept {
-    _data = rhs._data;
-    _size = rhs._size;
-    return *this;
-  }
+  inline constexpr ArrayView(const ArrayView&) noexcept = default;
+  inline ArrayView& operator=(const ArrayView&) noexcept = default;
 
   template<size_t N>
   inline ArrayView& operator=(T (&array)[N]) noexcept {
@@ -1,5 +1,10 @@
 #include "base64.hpp"
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86 1
+#include <immintrin.h>
+#endif
+
 // Originally taken from:
 // https://stackoverflow.com/questions/342409/how-do-i-base64-encode-decode-in-c/41094722#41094722
 
@@ -28,33 +33,185 @@ static inline unsigned B64index(unsigned char i) {
   return B64index_[i];
 }
 
-std::string decode(const char* data, const size_t len)
+// Decodes `groups` groups of 4 characters into 3 bytes each
+static inline void decode_groups(const unsigned char* p, size_t groups, char* out) {
+  for (; groups--; p += 4, out += 3) {
+    unsigned n = B64index(p[0]) << 18 | B64index(p[1]) << 12 | B64index(p[2]) << 6 | B64index(p[3]);
+    out[0] = char(n >> 16);
+    out[1] = char(n >> 8 & 0xFF);
+    out[2] = char(n & 0xFF);
+  }
+}
+
+size_t decode_scalar(const char* data, const size_t len, char* out)
 {
   const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
   const size_t pad = len > 0 && (len % 4 || p[len - 1] == '=');
   const size_t L = ((len + 3) / 4 - pad) * 4;
-  std::string str(L / 4 * 3 + pad, '\0');
+  size_t j = L / 4 * 3;
 
-  for (size_t i = 0, j = 0; i < L; i += 4)
-  {
-    unsigned n = B64index(p[i]) << 18 | B64index(p[i + 1]) << 12 | B64index(p[i + 2]) << 6 | B64index(p[i + 3]);
-    str[j++] = n >> 16;
-    str[j++] = n >> 8 & 0xFF;
-    str[j++] = n & 0xFF;
-  }
+  decode_groups(p, L / 4, out);
 
   if (pad)
   {
     unsigned n = B64index(p[L]) << 18 | B64index(p[L + 1]) << 12;
-    str[str.size() - 1] = n >> 16;
+    out[j++] = char(n >> 16);
 
     if (len > L + 2 && p[L + 2] != '=')
     {
       n |= B64index(p[L + 2]) << 6;
-      str.push_back(n >> 8 & 0xFF);
+      out[j++] = char(n >> 8 & 0xFF);
     }
   }
 
+  return j;
+}
+
+/* ============================================================================
+ * Vectorized decoding of whole blocks
+ * ============================================================================
+ *
+ * A block decoder decodes blocks of 16 (SSSE3) or 32 (AVX2) characters and
+ * returns the number of characters consumed, the rest is left to
+ * decode_scalar(). Only the standard alphabet (A-Z a-z 0-9 + /) is
+ * translated in vector registers, a block containing anything else (padding,
+ * the URL-safe '-' and '_', garbage) is decoded by the lookup table, so the
+ * output is always the same as that of decode_scalar().
+ *
+ * The stores are wider than the decoded bytes of a block. A block is only
+ * taken if enough characters follow so that the surplus bytes still lie in
+ * the decoded_size() of the input and get overwritten by the next block.
+ *
+ * The build doesn't set any -m flags, so the functions are compiled with
+ * target attributes and picked once at runtime by the CPU features.
+ */
+
+typedef size_t (*BlockDecoder)(const unsigned char*, size_t, char*);
+
+static size_t decode_blocks_none(const unsigned char*, size_t, char*) {
+  return 0;
+}
+
+#ifdef BASE64_X86
+
+// Maps the characters of the standard alphabet to their 6 bit values.
+// Returns false if `v` contains any other character.
+__attribute__((target("ssse3")))
+static inline bool translate(__m128i& v) {
+#define IN_RANGE(LO, HI) \
+  _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(LO - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(HI + 1)))
+  const __m128i upper = IN_RANGE('A', 'Z');
+  const __m128i lower = IN_RANGE('a', 'z');
+  const __m128i digit = IN_RANGE('0', '9');
+  const __m128i plus  = _mm_cmpeq_epi8(v, _mm_set1_epi8('+'));
+  const __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+#undef IN_RANGE
+
+  const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+  if (_mm_movemask_epi8(valid) != 0xFFFF)
+    return false;
+
+  const __m128i offset = _mm_or_si128(
+    _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), _mm_and_si128(lower, _mm_set1_epi8(-71))),
+    _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(4)),
+      _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(19)), _mm_and_si128(slash, _mm_set1_epi8(16)))));
+  v = _mm_add_epi8(v, offset);
+  return true;
+}
+
+// Packs the 6 bit values of each 32 bit lane into 3 bytes, which are placed
+// in the low 12 bytes of the result
+__attribute__((target("ssse3")))
+static inline __m128i pack(__m128i v) {
+  v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140)); // 00aaaaaa 00bbbbbb -> 0000aaaa aabbbbbb
+  v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));    // 0000aaaaaabbbbbb 0000ccccccdddddd -> 00000000 aaaaaabb bbbbcccc ccdddddd
+  return _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static size_t decode_blocks_ssse3(const unsigned char* p, size_t len, char* out) {
+  size_t i = 0;
+  for (; i + 16 + 8 <= len; i += 16, out += 12) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    if (translate(v))
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pack(v));
+    else
+      decode_groups(p + i, 4, out);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static inline bool translate(__m256i& v) {
+#define IN_RANGE(LO, HI) \
+  _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(LO - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(HI + 1), v))
+  const __m256i upper = IN_RANGE('A', 'Z');
+  const __m256i lower = IN_RANGE('a', 'z');
+  const __m256i digit = IN_RANGE('0', '9');
+  const __m256i plus  = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+'));
+  const __m256i slash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+#undef IN_RANGE
+
+  const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+  if (_mm256_movemask_epi8(valid) != -1)
+    return false;
+
+  const __m256i offset = _mm256_or_si256(
+    _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-65)), _mm256_and_si256(lower, _mm256_set1_epi8(-71))),
+    _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(4)),
+      _mm256_or_si256(_mm256_and_si256(plus, _mm256_set1_epi8(19)), _mm256_and_si256(slash, _mm256_set1_epi8(16)))));
+  v = _mm256_add_epi8(v, offset);
+  return true;
+}
+
+// Like pack() above, the 24 bytes are moved together across the two lanes
+__attribute__((target("avx2")))
+static inline __m256i pack(__m256i v) {
+  v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+  v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+  v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+}
+
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2(const unsigned char* p, size_t len, char* out) {
+  size_t i = 0;
+  for (; i + 32 + 16 <= len; i += 32, out += 24) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    if (translate(v))
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pack(v));
+    else
+      decode_groups(p + i, 8, out);
+  }
+  return i + decode_blocks_ssse3(p + i, len - i, out);
+}
+
+#endif
+
+static BlockDecoder select_block_decoder() {
+#ifdef BASE64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return decode_blocks_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return decode_blocks_ssse3;
+#endif
+  return decode_blocks_none;
+}
+
+size_t decode(const char* data, const size_t len, char* out)
+{
+  static const BlockDecoder decode_blocks = select_block_decoder();
+  const size_t i = decode_blocks(reinterpret_cast<const unsigned char*>(data), len, out);
+  return i / 4 * 3 + decode_scalar(data + i, len - i, out + i / 4 * 3);
+}
+
+std::string decode(const char* data, const size_t len)
+{
+  std::string str(decoded_size(len), '\0');
+  str.resize(decode(data, len, &str[0]));
   return str;
 }
 
@@ -7,6 +7,15 @@ namespace base64 {
 
 std::string decode(const char*, size_t);
 
+/* Decodes into `out`, which must hold decoded_size() bytes.
+ * Returns the number of bytes written. Uses SSSE3/AVX2 if the CPU has it. */
+size_t decode(const char*, size_t, char* out);
+
+/* Same as above, but only uses the lookup table */
+size_t decode_scalar(const char*, size_t, char* out);
+
+inline size_t decoded_size(size_t len) { return len / 4 * 3 + 3; }
+
 template<class T>
 std::string decode(const T& s) { return decode(s.c_str(), s.size()); }
 
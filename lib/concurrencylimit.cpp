@@ -0,0 +1,58 @@
+#include "concurrencylimit.hpp"
+
+#include <chrono>
+#include <algorithm>
+
+ConcurrencyLimit::Options :: Options() noexcept
+: min(1)
+, max(16)
+, initial(2)
+, decrease(0.5)
+, latency_decrease(0.9)
+, latency_tolerance(3)
+, latency_slack(100000)
+, backoff_base(500)
+, backoff_max(60000)
+{
+}
+
+ConcurrencyLimit :: ConcurrencyLimit(const Options& options) noexcept
+: _options(options)
+, _limit(options.initial)
+, _base_latency(0)
+, _ignore(0)
+, _random(std::minstd_rand::result_type(std::chrono::steady_clock::now().time_since_epoch().count()))
+{
+}
+
+void ConcurrencyLimit :: success(uint64_t latency) noexcept {
+  if (! _base_latency || latency < _base_latency)
+    _base_latency = latency;
+
+  if (_ignore > 0)
+    --_ignore;
+  else if (double(latency) > _options.latency_tolerance * double(_base_latency) + double(_options.latency_slack))
+    decrease(_options.latency_decrease);
+  else
+    _limit = std::min(_options.max, _limit + 1 / _limit);
+}
+
+void ConcurrencyLimit :: congestion() noexcept {
+  if (_ignore > 0)
+    --_ignore;
+  else
+    decrease(_options.decrease);
+}
+
+// The other requests in flight were sent with the old limit
+void ConcurrencyLimit :: decrease(double factor) noexcept {
+  _ignore = int(_limit) - 1;
+  _limit = std::max(_options.min, _limit * factor);
+}
+
+/* Half of the delay is fixed, the other half is random ("equal jitter") */
+unsigned ConcurrencyLimit :: backoff(int attempt) noexcept {
+  const int shift = std::min(std::max(attempt, 0), 20);
+  const uint64_t delay = std::min(uint64_t(_options.backoff_max), uint64_t(_options.backoff_base) << shift);
+  return unsigned(delay / 2 + _random() % (delay / 2 + 1));
+}
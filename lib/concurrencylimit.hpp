@@ -0,0 +1,63 @@
+#ifndef LIB_CONCURRENCYLIMIT_HPP
+#define LIB_CONCURRENCYLIMIT_HPP
+
+#include <random>
+#include <cstdint>
+
+/**
+ * AIMD (additive increase, multiplicative decrease) limit for the number of
+ * requests in flight.
+ *
+ * Every response that is not much slower than the fastest one seen so far
+ * raises the limit by 1/limit, which makes it grow by about one per round
+ * of requests. Slow responses cut it by `latency_decrease`, errors and
+ * overload responses like 429 or 503 (congestion()) by `decrease`. After a
+ * cut the signals of the requests still in flight are ignored, so a burst of
+ * failures only counts once.
+ *
+ * backoff() returns the delay before retrying a request. It grows
+ * exponentially with the number of attempts and half of it is random, so
+ * retries of different requests do not arrive at the same time.
+ */
+class ConcurrencyLimit {
+public:
+  struct Options {
+    double   min;
+    double   max;
+    double   initial;
+    double   decrease;          // Factor applied by congestion()
+    double   latency_decrease;  // Factor applied for a slow response
+    double   latency_tolerance; // Slow means: latency > tolerance * base_latency() + slack
+    uint64_t latency_slack;     // Microseconds
+    unsigned backoff_base;      // Milliseconds
+    unsigned backoff_max;       // Milliseconds
+
+    Options() noexcept;
+  };
+
+  ConcurrencyLimit(const Options& = Options()) noexcept;
+
+  int            limit()        const noexcept { return int(_limit);     }
+  uint64_t       base_latency() const noexcept { return _base_latency;   }
+  const Options& options()      const noexcept { return _options;        }
+
+  /* A successful response, `latency` is in microseconds */
+  void success(uint64_t latency) noexcept;
+
+  /* A failed or rejected request */
+  void congestion() noexcept;
+
+  /* Milliseconds to wait before retry number `attempt` (starting at 0) */
+  unsigned backoff(int attempt) noexcept;
+
+private:
+  Options _options;
+  double _limit;
+  uint64_t _base_latency; // Lowest latency seen, 0 if none
+  int _ignore;            // Number of signals to ignore after a cut
+  std::minstd_rand _random;
+
+  void decrease(double factor) noexcept;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "directoryindex.hpp"
+
+#include <cstring>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define DIRECTORYINDEX_EVENTS (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+
+/* d_type is not filled in by every filesystem */
+static bool entry_is_directory(const std::string& parent, const dirent* entry) {
+  if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK)
+    return entry->d_type == DT_DIR;
+
+  struct stat st;
+  return 0 == ::stat((parent + '/' + entry->d_name).c_str(), &st) && S_ISDIR(st.st_mode);
+}
+
+static bool is_dot_or_dotdot(const char* name) {
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+DirectoryIndex :: DirectoryIndex(KeyFunction key) noexcept
+: _key(key)
+, _fd(-1)
+, _root_wd(-1)
+{
+}
+
+DirectoryIndex :: ~DirectoryIndex() {
+  close();
+}
+
+void DirectoryIndex :: close() noexcept {
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+  _root_wd = -1;
+  _directories.clear();
+  _watches.clear();
+}
+
+bool DirectoryIndex :: open(const std::string& directory) {
+  close();
+  _directory = directory;
+  _fd = ::inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  return rebuild();
+}
+
+bool DirectoryIndex :: rebuild() {
+  if (_fd >= 0) {
+    for (const auto& watch : _watches)
+      ::inotify_rm_watch(_fd, watch.first);
+    if (_root_wd >= 0)
+      ::inotify_rm_watch(_fd, _root_wd);
+  }
+  _watches.clear();
+  _directories.clear();
+
+  // Watch before reading, so nothing is missed in between
+  _root_wd = (_fd >= 0 ? ::inotify_add_watch(_fd, _directory.c_str(), DIRECTORYINDEX_EVENTS) : -1);
+
+  DIR* dir = ::opendir(_directory.c_str());
+  if (! dir)
+    return false;
+
+  for (dirent* entry; (entry = ::readdir(dir));)
+    if (! is_dot_or_dotdot(entry->d_name) && entry_is_directory(_directory, entry))
+      add_directory(entry->d_name);
+
+  ::closedir(dir);
+  return true;
+}
+
+void DirectoryIndex :: add_directory(const std::string& name) {
+  const std::string path = _directory + '/' + name;
+  Directory& dir = _directories[name];
+  dir.wd = (_fd >= 0 ? ::inotify_add_watch(_fd, path.c_str(), DIRECTORYINDEX_EVENTS) : -1);
+  if (dir.wd >= 0)
+    _watches[dir.wd] = name;
+  read_directory(dir, name);
+}
+
+void DirectoryIndex :: remove_directory(const std::string& name) {
+  auto it = _directories.find(name);
+  if (it == _directories.end())
+    return;
+
+  if (it->second.wd >= 0) {
+    ::inotify_rm_watch(_fd, it->second.wd); // Fails if it is already gone
+    _watches.erase(it->second.wd);
+  }
+  _directories.erase(it);
+}
+
+void DirectoryIndex :: read_directory(Directory& directory, const std::string& name) {
+  directory.files.clear();
+
+  const std::string path = _directory + '/' + name;
+  DIR* dir = ::opendir(path.c_str());
+  if (! dir)
+    return;
+
+  for (dirent* entry; (entry = ::readdir(dir));)
+    if (! is_dot_or_dotdot(entry->d_name) && ! entry_is_directory(path, entry))
+      directory.files.emplace(_key(entry->d_name), entry->d_name);
+
+  ::closedir(dir);
+}
+
+void DirectoryIndex :: handle_event(int wd, uint32_t mask, const char* name) {
+  if (mask & IN_Q_OVERFLOW) { // Events were lost
+    rebuild();
+    return;
+  }
+
+  if (wd == _root_wd) {
+    if (mask & IN_IGNORED) // The directory itself is gone
+      _root_wd = -1;
+    else if (! (mask & IN_ISDIR))
+      return;
+    else if (mask & (IN_CREATE|IN_MOVED_TO))
+      add_directory(name);
+    else if (mask & (IN_DELETE|IN_MOVED_FROM))
+      remove_directory(name);
+    return;
+  }
+
+  auto watch = _watches.find(wd);
+  if (watch == _watches.end())
+    return;
+
+  auto it = _directories.find(watch->second);
+  if (it == _directories.end())
+    return;
+
+  Directory& dir = it->second;
+  if (mask & IN_IGNORED) { // Deleted, the root will tell us
+    dir.wd = -1;
+    _watches.erase(watch);
+    return;
+  }
+
+  if (mask & IN_ISDIR)
+    return;
+
+  if (mask & (IN_CREATE|IN_MOVED_TO))
+    dir.files.emplace(_key(name), name);
+  else if (mask & (IN_DELETE|IN_MOVED_FROM)) {
+    auto file = dir.files.find(_key(name));
+    if (file != dir.files.end() && file->second == name)
+      read_directory(dir, it->first); // Another file may have the same key
+  }
+}
+
+bool DirectoryIndex :: work() {
+  if (_fd < 0)
+    return false;
+
+  bool changed = false;
+  alignas(struct inotify_event) char buffer[8192];
+  for (ssize_t len; (len = ::read(_fd, buffer, sizeof(buffer))) > 0;) {
+    for (const char* p = buffer; p < buffer + len;) {
+      const auto* event = reinterpret_cast<const struct inotify_event*>(p);
+      handle_event(event->wd, event->mask, event->len ? event->name : "");
+      p += sizeof(struct inotify_event) + event->len;
+    }
+    changed = true;
+  }
+
+  return changed;
+}
+
+const std::string* DirectoryIndex :: find(const std::string& subdirectory, int key) {
+  work();
+
+  auto it = _directories.find(subdirectory);
+  if (_root_wd < 0) {
+    // The list of subdirectories can't be trusted, read the subdirectory anyway
+    if (it == _directories.end())
+      it = _directories.emplace(subdirectory, Directory{-1, {}}).first;
+    read_directory(it->second, subdirectory);
+  }
+  else if (it == _directories.end())
+    return NULL;
+  else if (it->second.wd < 0)
+    read_directory(it->second, subdirectory);
+
+  auto file = it->second.files.find(key);
+  return (file != it->second.files.end() ? &file->second : NULL);
+}
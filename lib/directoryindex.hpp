@@ -0,0 +1,61 @@
+#ifndef LIB_DIRECTORYINDEX_HPP
+#define LIB_DIRECTORYINDEX_HPP
+
+#include <string>
+#include <unordered_map>
+
+/**
+ * In-memory index of the subdirectories of a directory and of the files
+ * inside of them, for example `<album_dir>/<album>/<file>`.
+ *
+ * Files are looked up by their subdirectory and a number computed from
+ * their name by `key` (e.g. the track number from "01 - Title.mp3"). If
+ * several files share a key, one of them is returned.
+ *
+ * open() reads the directories once. Afterwards the index is kept up to
+ * date through inotify. The pending events are applied by work(), which
+ * find() calls before looking up a file. Directories that could not be
+ * watched (e.g. because fs.inotify.max_user_watches is exhausted) are read
+ * again on each lookup.
+ */
+class DirectoryIndex {
+public:
+  typedef int (*KeyFunction)(const char* name);
+
+  DirectoryIndex(KeyFunction key) noexcept;
+ ~DirectoryIndex();
+
+  bool open(const std::string& directory);
+  void close() noexcept;
+
+  /* Applies the pending changes, returns false if nothing has changed */
+  bool work();
+
+  /* Returns the name of the file or NULL */
+  const std::string* find(const std::string& subdirectory, int key);
+
+  int fd()              const noexcept { return _fd;                 }
+  size_t directories()  const noexcept { return _directories.size(); }
+  const std::string& directory() const noexcept { return _directory; }
+
+private:
+  struct Directory {
+    int wd; // -1 if not watched
+    std::unordered_map<int, std::string> files;
+  };
+
+  std::string _directory;
+  KeyFunction _key;
+  int _fd;
+  int _root_wd;
+  std::unordered_map<std::string, Directory> _directories;
+  std::unordered_map<int, std::string> _watches; // wd -> subdirectory
+
+  bool rebuild();
+  void add_directory(const std::string& name);
+  void remove_directory(const std::string& name);
+  void read_directory(Directory&, const std::string& name);
+  void handle_event(int wd, uint32_t mask, const char* name);
+};
+
+#endif
@@ -1,13 +1,24 @@
 #include "downloads.hpp"
+#include "sscan.hpp"
+
 #include <climits>
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
 #include <stdexcept>
 
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
 /* ============================================================================
  * Download
  * ==========================================================================*/
 
-Download :: Download(const std::string &url_) {
+Download :: Download(const std::string &url_)
+: headers(NULL)
+{
   if ((curl_easy = curl_easy_init())) {
     url(url_.c_str());
     return;
@@ -22,6 +33,15 @@ Download :: ~Download() {
   if (curl_easy)
 #endif
   curl_easy_cleanup(curl_easy);
+  curl_slist_free_all(headers);
+}
+
+bool Download :: add_header(const char* header) noexcept {
+  curl_slist *list = curl_slist_append(headers, header);
+  if (! list)
+    return false;
+  headers = list;
+  return CURLE_OK == setopt(CURLOPT_HTTPHEADER, headers);
 }
 
 int Download :: http_code() const noexcept {
@@ -53,17 +73,123 @@ BufferDownload :: BufferDownload(const std::string &url)
   setopt(CURLOPT_WRITEDATA, &_buffer);
 }
 
+/* ============================================================================
+ * StreamDownload
+ * ==========================================================================*/
+
+size_t StreamDownload :: write_cb(char *data, size_t size, size_t nmemb, void *self_) {
+  auto self = static_cast<StreamDownload*>(self_);
+  size *= nmemb;
+  self->_bytes_received += size;
+  if (self->_on_data && ! self->_on_data(*self, data, size))
+    return 0;
+  return size;
+}
+
+StreamDownload :: StreamDownload(const std::string &url, onData_t on_data)
+: Download(url)
+, _on_data(std::move(on_data))
+, _bytes_received(0)
+{
+  setopt(CURLOPT_WRITEFUNCTION, write_cb);
+  setopt(CURLOPT_WRITEDATA, this);
+}
+
+/* ============================================================================
+ * Header lines and metadata files
+ * ==========================================================================*/
+
+bool match_header(const char* data, const char* end, const char* name, std::string& value) {
+  const size_t name_len = std::strlen(name);
+  if (size_t(end - data) <= name_len || strncasecmp(data, name, name_len))
+    return false;
+  const char* s = data + name_len;
+  while (s != end && (*s == ' ' || *s == '\t'))
+    ++s;
+  value.assign(s, size_t(end - s));
+  return true;
+}
+
+bool read_line(std::FILE* fh, std::string& line) {
+  line.clear();
+  for (int c; (c = std::getc(fh)) != EOF;) {
+    if (c == '\n')
+      return true;
+    line.push_back(char(c));
+  }
+  return false;
+}
+
 /* ============================================================================
  * FileDownload
  * ==========================================================================*/
 
-FileDownload :: FileDownload(const std::string &url, std::string file)
+/* Layout of the sidecar:
+ *
+ *   FILEDOWNLOAD 1\n
+ *   <url>\n
+ *   <validator>\n
+ *   <total size, 0 if unknown>\n
+ */
+#define FILEDOWNLOAD_MAGIC "FILEDOWNLOAD 1\n"
+
+static bool read_sidecar(const std::string& file, std::string& url, std::string& validator, long long& total) {
+  std::FILE* fh = std::fopen(file.c_str(), "rb");
+  if (! fh)
+    return false;
+
+  std::string line;
+  bool ok = read_line(fh, line) && line + '\n' == FILEDOWNLOAD_MAGIC
+         && read_line(fh, url)
+         && read_line(fh, validator) && ! validator.empty()
+         && read_line(fh, line) && SScan(line).read_int(total);
+  std::fclose(fh);
+  return ok;
+}
+
+FileDownload :: FileDownload(const std::string &url, std::string file, bool resume)
 : Download(url)
+, _url(url)
 , _filename(std::move(file))
-, _fh(std::fopen(_filename.c_str(), "w"))
+, _fh(NULL)
+, _offset(0)
+, _position(0)
+, _resumable(false)
+, _started(false)
+, _status(0)
+, _content_length(-1)
+, _range_start(-1)
+, _range_total(-1)
 {
-  if (_fh)
-    setopt(CURLOPT_WRITEDATA, _fh);
+  std::string sidecar_url;
+  long long total = 0;
+  if (resume && read_sidecar(sidecar(), sidecar_url, _validator, total) && sidecar_url == url
+      && (_fh = std::fopen(_filename.c_str(), "r+b"))) {
+    // A complete file that didn't get renamed is downloaded again
+    const long size = (std::fseek(_fh, 0, SEEK_END) ? 0 : std::ftell(_fh));
+    if (size > 0 && (total <= 0 || size < total)) {
+      _offset = size_t(size);
+      _resumable = true;
+      setopt(CURLOPT_RANGE, (std::to_string(_offset) + '-').c_str());
+      add_header(("If-Range: " + _validator).c_str());
+    }
+  }
+
+  if (! _resumable) {
+    if (_fh)
+      std::fclose(_fh);
+    ::unlink(sidecar().c_str());
+    _validator.clear();
+    _fh = std::fopen(_filename.c_str(), "wb");
+  }
+
+  if (_fh) {
+    _position = _offset;
+    setopt(CURLOPT_WRITEFUNCTION, write_cb);
+    setopt(CURLOPT_WRITEDATA, this);
+    setopt(CURLOPT_HEADERFUNCTION, header_cb);
+    setopt(CURLOPT_HEADERDATA, this);
+  }
 #ifdef __cpp_exceptions
   else
     throw std::runtime_error(std::strerror(errno));
@@ -75,27 +201,208 @@ FileDownload :: ~FileDownload() {
     std::fclose(_fh);
 }
 
+bool FileDownload :: can_resume(const std::string& file) noexcept {
+  std::string url, validator;
+  long long total;
+  return read_sidecar(file + FILEDOWNLOAD_RESUME_SUFFIX, url, validator, total);
+}
+
+size_t FileDownload :: header_cb(char *data, size_t size, size_t nmemb, void *self_) {
+  auto self = static_cast<FileDownload*>(self_);
+  const size_t len = size * nmemb;
+  const char* end = data + len;
+
+  while (end != data && (end[-1] == '\n' || end[-1] == '\r'))
+    --end;
+
+  std::string value;
+  if (len >= 5 && ! std::strncmp(data, "HTTP/", 5)) {
+    self->_status = 0;
+    self->_content_length = self->_range_start = self->_range_total = -1;
+    self->_etag.clear();
+    self->_last_modified.clear();
+    SScan(data, size_t(end - data)).skip_until(" ").read_int(self->_status);
+  }
+  else if (match_header(data, end, "Content-Length:", value))
+    SScan(value).read_int(self->_content_length);
+  else if (match_header(data, end, "Content-Range:", value)) {
+    // "bytes 100-199/200", the total may be "*"
+    long long last;
+    SScan scanner(value);
+    if (scanner.read("bytes").read_int(self->_range_start).read('-').read_int(last))
+      scanner.read('/').read_int(self->_range_total);
+  }
+  else if (! match_header(data, end, "ETag:", self->_etag))
+    match_header(data, end, "Last-Modified:", self->_last_modified);
+
+  return len;
+}
+
+/* Decides what happens to the file when the first bytes of the body arrive.
+ * Returns false if the body doesn't belong to the file. */
+bool FileDownload :: start_body() noexcept {
+  _started = true;
+
+  if (_status == 206) {
+    // Only appended if it continues exactly the content that we have
+    const std::string& validator = (_validator[0] == '"' ? _etag : _last_modified);
+    if (! _offset || _range_start != static_cast<long long>(_offset) || validator != _validator) {
+      _resumable = false;
+      return false;
+    }
+    return true;
+  }
+
+  // 200: A new file
+  if (_offset) {
+    if (::ftruncate(fileno(_fh), 0))
+      return false;
+    std::rewind(_fh);
+    _offset = _position = 0;
+  }
+
+  // Weak ETags are not allowed in If-Range
+  _validator = (! _etag.empty() && _etag[0] == '"' ? _etag : _last_modified);
+  _resumable = false;
+
+  if (! _validator.empty()) {
+    std::FILE* fh = std::fopen(sidecar().c_str(), "wb");
+    if (fh) {
+      const int n = std::fprintf(fh, FILEDOWNLOAD_MAGIC "%s\n%s\n%lld\n",
+          _url.c_str(), _validator.c_str(), _content_length > 0 ? _content_length : 0);
+      _resumable = (0 == std::fclose(fh)) && n > 0;
+    }
+  }
+
+  if (! _resumable)
+    ::unlink(sidecar().c_str());
+  return true;
+}
+
+size_t FileDownload :: write_cb(char *data, size_t size, size_t nmemb, void *self_) {
+  auto self = static_cast<FileDownload*>(self_);
+  size *= nmemb;
+
+  if (self->_status != 200 && self->_status != 206)
+    return size; // Error page
+
+  if (! self->_started && ! self->start_body())
+    return 0;
+
+  const size_t written = std::fwrite(data, 1, size, self->_fh);
+  if (self->_on_write && written) {
+    std::fflush(self->_fh);
+    self->_on_write(self->_position, data, written);
+  }
+  self->_position += written;
+  return written;
+}
+
+bool FileDownload :: finish(CURLcode e) noexcept {
+  std::fflush(_fh);
+
+  if (e == CURLE_OK && (_status == 200 || _status == 206) && (_started || start_body())) {
+    ::unlink(sidecar().c_str());
+    _resumable = false;
+    return true;
+  }
+
+  // Client errors (404, 416) make the partial file useless
+  if (! _resumable || (_status >= 400 && _status < 500)) {
+    ::unlink(_filename.c_str());
+    ::unlink(sidecar().c_str());
+    _resumable = false;
+  }
+
+  return false;
+}
+
 /* ============================================================================
  * Downloads
  * ==========================================================================*/
 
 Downloads :: Downloads()
-  : _running_handles(0)
+  : _curl_multi(NULL)
+  , _epoll_fd(::epoll_create1(EPOLL_CLOEXEC))
+  , _timer_fd(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC))
+  , _classes()
+  , _refilled(std::chrono::steady_clock::now())
+  , _running_handles(0)
   , _queued_handles(0)
   , _parallel(INT_MAX)
 {
+  // The track that is about to be played comes first, everything else has
+  // to wait. The updater limits its pages on its own.
+  _classes[Playback].options = Options(INT_MAX, 0, true);
+  _classes[Prefetch].options = Options(1);
+  _classes[Cover].options    = Options(4);
+  _classes[Archive].options  = Options(1);
+
   curl_global_init(CURL_GLOBAL_ALL);
-  if ((_curl_multi = curl_multi_init()))
+
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = _timer_fd;
+
+  if (_epoll_fd >= 0 && _timer_fd >= 0 && ! ::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _timer_fd, &ev)
+      && (_curl_multi = curl_multi_init())) {
+    curl_multi_setopt(_curl_multi, CURLMOPT_SOCKETFUNCTION, socket_cb);
+    curl_multi_setopt(_curl_multi, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(_curl_multi, CURLMOPT_TIMERFUNCTION, timer_cb);
+    curl_multi_setopt(_curl_multi, CURLMOPT_TIMERDATA, this);
     return;
+  }
 
 #ifdef __cpp_exceptions
-  throw std::runtime_error("curl_multi_init()");
+  throw std::runtime_error("Downloads::Downloads()");
 #endif
 }
 
 Downloads :: ~Downloads() {
+  for (const auto& dl : _downloads)
+    if (dl->state == DL::Loading)
+      curl_multi_remove_handle(_curl_multi, dl->download->curl_easy);
   curl_multi_cleanup(_curl_multi);
   curl_global_cleanup();
+  ::close(_timer_fd);
+  ::close(_epoll_fd);
+}
+
+/* Called by curl to tell which events it wants for socket `s` */
+int Downloads :: socket_cb(CURL*, curl_socket_t s, int what, void* self_, void*) {
+  auto self = static_cast<Downloads*>(self_);
+
+  if (what == CURL_POLL_REMOVE) {
+    ::epoll_ctl(self->_epoll_fd, EPOLL_CTL_DEL, s, NULL);
+    return 0;
+  }
+
+  epoll_event ev = {};
+  ev.data.fd = s;
+  if (what & CURL_POLL_IN)
+    ev.events |= EPOLLIN;
+  if (what & CURL_POLL_OUT)
+    ev.events |= EPOLLOUT;
+
+  if (::epoll_ctl(self->_epoll_fd, EPOLL_CTL_MOD, s, &ev) && errno == ENOENT)
+    ::epoll_ctl(self->_epoll_fd, EPOLL_CTL_ADD, s, &ev);
+  return 0;
+}
+
+/* Called by curl to (re)arm or disarm its single timeout */
+int Downloads :: timer_cb(CURLM*, long timeout_ms, void* self_) {
+  auto self = static_cast<Downloads*>(self_);
+
+  itimerspec its = {};
+  if (timeout_ms > 0) {
+    its.it_value.tv_sec  = timeout_ms / 1000;
+    its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+  }
+  else if (timeout_ms == 0)
+    its.it_value.tv_nsec = 1; // As soon as possible, zero would disarm
+
+  ::timerfd_settime(self->_timer_fd, 0, &its, NULL);
+  return 0;
 }
 
 void Downloads :: parallel(int parallel) noexcept {
@@ -103,26 +410,156 @@ void Downloads :: parallel(int parallel) noexcept {
   curl_multi_setopt(_curl_multi, CURLMOPT_MAXCONNECTS, long(parallel));
 }
 
-void Downloads :: add_download(Download* dl, onFinished_t cb) {
-  _downloads.push_back(DL{std::unique_ptr<Download>(dl), cb, DL::State::Waiting});
+void Downloads :: options(Priority priority, const Options& options) noexcept {
+  Class& c = _classes[priority];
+  c.options = options;
+  if (c.tokens > double(options.max_rate))
+    c.tokens = double(options.max_rate);
+}
+
+void Downloads :: add_download(Download* download, onFinished_t cb, Priority priority) {
+  std::unique_ptr<DL> dl(new DL{std::unique_ptr<Download>(download), std::move(cb),
+                                DL::Waiting, priority, false, _downloads.size(), 0});
+  download->setopt(CURLOPT_PRIVATE, dl.get());
+  _classes[priority].queue.push_back(dl.get());
+  _downloads.push_back(std::move(dl));
+  _classes[priority].queued++;
   _queued_handles++;
 }
 
+void Downloads :: priority(Download* download, Priority priority) noexcept {
+  char *private_ = NULL;
+  download->getinfo(CURLINFO_PRIVATE, private_);
+  DL* dl = reinterpret_cast<DL*>(private_);
+  if (! dl || dl->priority == priority)
+    return;
+
+  Class& from = _classes[dl->priority];
+  Class& to   = _classes[priority];
+  switch (dl->state) {
+  case DL::Waiting:
+    from.queue.erase(std::find(from.queue.begin(), from.queue.end(), dl));
+    to.queue.push_back(dl);
+    --from.queued;
+    ++to.queued;
+    break;
+  case DL::Loading:
+    take_tokens(dl); // The bytes so far are charged to the old class
+    --from.running;
+    ++to.running;
+    break;
+  case DL::Finished:
+    break;
+  }
+
+  dl->priority = priority;
+  start_queued();
+  throttle(); // Pauses or continues it according to its new class
+}
+
+void Downloads :: start_queued() noexcept {
+  for (Class& c : _classes)
+    while (! c.queue.empty() && c.running < c.options.max_running
+           && (_running_handles < _parallel || c.options.preempts)) {
+      DL* dl = c.queue.front();
+      if (CURLM_OK != curl_multi_add_handle(_curl_multi, dl->download->curl_easy))
+        return;
+
+      c.queue.pop_front();
+      dl->state = DL::Loading;
+      ++c.running;
+      --c.queued;
+      ++_running_handles;
+      --_queued_handles;
+    }
+}
+
+/* Takes the bytes received since the last call from the bucket */
+void Downloads :: take_tokens(DL* dl) noexcept {
+  Class& c = _classes[dl->priority];
+  curl_off_t bytes = 0;
+  if (c.options.max_rate && CURLE_OK == dl->download->getinfo(CURLINFO_SIZE_DOWNLOAD_T, bytes)) {
+    c.tokens -= double(uint64_t(bytes) - dl->bytes);
+    dl->bytes = uint64_t(bytes);
+  }
+}
+
+/* Pauses or continues the running downloads, see the class comment */
+void Downloads :: throttle() noexcept {
+  const auto now = std::chrono::steady_clock::now();
+  const double seconds = std::chrono::duration<double>(now - _refilled).count();
+  _refilled = now;
+
+  for (Class& c : _classes)
+    if (c.options.max_rate) {
+      c.tokens += seconds * double(c.options.max_rate);
+      if (c.tokens > double(c.options.max_rate))
+        c.tokens = double(c.options.max_rate);
+    }
+
+  for (const auto& dl : _downloads)
+    if (dl->state == DL::Loading)
+      take_tokens(dl.get());
+
+  bool paused[PRIORITIES];
+  bool preempted = false;
+  for (int p = 0; p < PRIORITIES; ++p) {
+    const Class& c = _classes[p];
+    paused[p] = preempted || (c.options.max_rate && c.tokens < 0);
+    preempted = preempted || (c.options.preempts && c.running);
+  }
+
+  for (const auto& dl : _downloads)
+    if (dl->state == DL::Loading && dl->paused != paused[dl->priority]
+        && CURLE_OK == curl_easy_pause(dl->download->curl_easy, paused[dl->priority] ? CURLPAUSE_RECV : CURLPAUSE_CONT))
+      dl->paused = paused[dl->priority];
+}
+
+int Downloads :: wait_time() const noexcept {
+  int ms = -1;
+  for (const Class& c : _classes)
+    if (c.options.max_rate && c.tokens < 0 && c.running) {
+      const int t = int(-c.tokens * 1000 / double(c.options.max_rate)) + 1;
+      if (ms < 0 || t < ms)
+        ms = t;
+    }
+  return ms;
+}
+
+// Swap with the last element, so removal is O(1)
+void Downloads :: remove(DL* dl) noexcept {
+  const size_t i = dl->index;
+  if (i + 1 != _downloads.size()) {
+    std::swap(_downloads[i], _downloads.back());
+    _downloads[i]->index = i;
+  }
+  _downloads.pop_back();
+}
+
+/* Returns the number of events that have been processed */
 int Downloads :: work() noexcept {
-  curl_multi_perform(_curl_multi, &_running_handles);
-
-  // Add queued downlaods
-  for (auto& dl : _downloads) {
-    if (_queued_handles && _running_handles < _parallel) {
-      if (dl.state == DL::State::Waiting) {
-        if (CURLM_OK == curl_multi_add_handle(_curl_multi, dl.download->curl_easy)) {
-          dl.state = DL::State::Loading;
-          ++_running_handles;
-          --_queued_handles;
-        }
-      }
+  start_queued();
+
+  epoll_event events[16];
+  const int n = ::epoll_wait(_epoll_fd, events, 16, 0);
+  int running;
+
+  for (int i = 0; i < n; ++i) {
+    if (events[i].data.fd == _timer_fd) {
+      uint64_t expirations;
+      if (::read(_timer_fd, &expirations, sizeof(expirations)) > 0)
+        curl_multi_socket_action(_curl_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+    else {
+      int flags = 0;
+      if (events[i].events & EPOLLIN)
+        flags |= CURL_CSELECT_IN;
+      if (events[i].events & EPOLLOUT)
+        flags |= CURL_CSELECT_OUT;
+      if (events[i].events & (EPOLLERR|EPOLLHUP))
+        flags |= CURL_CSELECT_ERR;
+      curl_multi_socket_action(_curl_multi, events[i].data.fd, flags, &running);
     }
-    else break;
   }
 
   // Process finished downloads
@@ -131,26 +568,28 @@ int Downloads :: work() noexcept {
   while ((msg = curl_multi_info_read(_curl_multi, &msgs_left))) {
     if (msg->msg == CURLMSG_DONE) {
       CURL *curl_easy = msg->easy_handle;
+      const CURLcode result = msg->data.result; // `msg` does not survive the removal
       curl_multi_remove_handle(_curl_multi, curl_easy);
 
-      for (auto it = _downloads.begin(), end = _downloads.end(); it != end; ++it) {
-        if (curl_easy == it->download->curl_easy) {
-          it->state = DL::Finished;
-          Action action = Action::Remove;
-
-          if (it->onFinished)
-            action = it->onFinished(*(it->download), msg->data.result);
+      char *private_ = NULL;
+      curl_easy_getinfo(curl_easy, CURLINFO_PRIVATE, &private_);
+      DL* dl = reinterpret_cast<DL*>(private_);
+      take_tokens(dl);
+      dl->state = DL::Finished;
+      --_classes[dl->priority].running;
+      --_running_handles;
 
-          if (action == Action::Remove)
-            _downloads.erase(it);
+      // The callback may add new downloads, `dl` stays valid though
+      Action action = Action::Remove;
+      if (dl->onFinished)
+        action = dl->onFinished(*(dl->download), result);
 
-          break;
-        }
-      }
+      if (action == Action::Remove)
+        remove(dl);
     }
   }
 
-  int ready_filedescriptors;
-  curl_multi_wait(_curl_multi, NULL, 0, 0, &ready_filedescriptors);
-  return ready_filedescriptors;
+  start_queued();
+  throttle();
+  return n > 0 ? n : 0;
 }
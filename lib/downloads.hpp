@@ -4,8 +4,12 @@
 #include <curl/curl.h>
 
 #include <string>
+#include <deque>
 #include <vector>
+#include <chrono>
 #include <cstdio>
+#include <climits>
+#include <cstdint>
 #include <functional>
 #include <memory>
 
@@ -45,11 +49,22 @@ public:
     return curl_easy_getinfo(curl_easy, info, &value);
   }
 
+  /* Adds a request header ("Name: value") */
+  bool add_header(const char*) noexcept;
+
 protected:
   friend class Downloads;
   CURL *curl_easy;
+  curl_slist *headers;
 };
 
+/* Matches a header line (without the line break) by `name` ("ETag:") and
+ * stores its value */
+bool match_header(const char* data, const char* end, const char* name, std::string& value);
+
+/* Reads a line of a metadata file (sidecar, cache entry) without the '\n' */
+bool read_line(std::FILE*, std::string& line);
+
 /* ============================================================================
  * Download to string buffer
  * ==========================================================================*/
@@ -64,31 +79,138 @@ protected:
   std::string _buffer;
 };
 
+/* ============================================================================
+ * Download to callback
+ * ==========================================================================*/
+
+class StreamDownload : public Download {
+public:
+  /* Called for every chunk of data as soon as it arrives.
+   * Returning false aborts the transfer with CURLE_WRITE_ERROR. */
+  using onData_t = std::function<bool(StreamDownload&, const char*, size_t)>;
+
+  StreamDownload(const std::string&, onData_t);
+
+  size_t bytes_received() const noexcept { return _bytes_received; }
+
+protected:
+  onData_t _on_data;
+  size_t _bytes_received;
+
+  static size_t write_cb(char*, size_t, size_t, void*);
+};
+
 /* ============================================================================
  * Download to file
  * ==========================================================================*/
 
+/* Sidecar of a partial file, see FileDownload */
+#define FILEDOWNLOAD_RESUME_SUFFIX ".resume"
+
+/**
+ * Downloads to a file, optionally continuing a partial file.
+ *
+ * As soon as the response arrives its URL, validator (a strong ETag or
+ * Last-Modified) and total size are written to a sidecar file
+ * (filename + FILEDOWNLOAD_RESUME_SUFFIX). If `resume` is set and a sidecar
+ * for the same URL exists, the transfer asks only for the missing bytes
+ * (Range + If-Range). The bytes are appended if the server answers with
+ * 206 and the same validator, a 200 means the resource changed and the
+ * file is started over.
+ *
+ * A response without a validator can't be resumed, so no sidecar is
+ * written for it.
+ */
 class FileDownload : public Download {
 public:
-  FileDownload(const std::string&, std::string);
+  FileDownload(const std::string&, std::string, bool resume = false);
  ~FileDownload();
 
   const std::string& filename() const noexcept { return _filename; }
 
+  /* Number of bytes that were already in the file */
+  size_t resumed_from() const noexcept { return _offset; }
+
+  /* To be called when the transfer is done. Returns true if the file is
+   * complete. Otherwise the partial file is removed, unless it can be
+   * resumed. */
+  bool finish(CURLcode) noexcept;
+
+  /* If `file` is a partial file with a sidecar */
+  static bool can_resume(const std::string& file) noexcept;
+
+  /* Called with every chunk written to the file and its offset in the file.
+   * The file is flushed before, so the chunk can be read back from it. */
+  using onWrite_t = std::function<void(size_t offset, const char*, size_t)>;
+  void on_write(onWrite_t f) { _on_write = std::move(f); }
+
 protected:
+  std::string _url;
   std::string _filename;
   std::FILE* _fh;
+  std::string _validator; // Of the file's content
+  size_t _offset;
+  size_t _position;       // End of the file's content
+  bool _resumable;        // Sidecar is written
+  bool _started;          // Got the first bytes of the body
+
+  // Of the current response, reset on each status line (redirects)
+  int _status;
+  long long _content_length;
+  long long _range_start;
+  long long _range_total;
+  std::string _etag;
+  std::string _last_modified;
+  onWrite_t _on_write;
+
+  std::string sidecar() const { return _filename + FILEDOWNLOAD_RESUME_SUFFIX; }
+  bool start_body() noexcept;
+  static size_t write_cb(char*, size_t, size_t, void*);
+  static size_t header_cb(char*, size_t, size_t, void*);
 };
 
 /* ============================================================================
  * Download mangager - handle multiple Downloads
  * ==========================================================================*/
 
+/**
+ * Runs the downloads using curl's socket interface.
+ *
+ * The sockets curl wants to watch and a timerfd for curl's timeouts are
+ * registered with an epoll instance. fd() returns that epoll descriptor: it
+ * becomes readable when work() has something to do, so the main loop can
+ * sleep on it.
+ *
+ * Every download belongs to a priority class. Queued downloads are started
+ * highest class first, as long as neither the class' `max_running` nor
+ * parallel() is reached. parallel() doesn't hold back classes that preempt.
+ *
+ * Running downloads are paused (curl_easy_pause()) instead of being
+ * cancelled:
+ *  - While a download of a class with `preempts` is running, all downloads
+ *    of the lower classes are paused.
+ *  - A class with a `max_rate` gets a token bucket holding up to one second
+ *    worth of bytes. Its downloads are paused while the bucket is empty,
+ *    wait_time() tells when it has refilled.
+ *
+ * priority() moves a download to another class, e.g. a prefetched track
+ * that is wanted for playback now.
+ */
 class Downloads {
 public:
   enum Action { Keep, Remove };
+  enum Priority : unsigned char { Playback, Prefetch, Cover, Catalog, Archive, PRIORITIES };
   using onFinished_t = std::function<Action(Download&, CURLcode)>;
 
+  struct Options {
+    int      max_running;
+    uint64_t max_rate;  // Bytes per second, 0 for unlimited
+    bool     preempts;  // Pauses the lower classes
+
+    Options(int max_running_ = INT_MAX, uint64_t max_rate_ = 0, bool preempts_ = false) noexcept
+    : max_running(max_running_), max_rate(max_rate_), preempts(preempts_) {}
+  };
+
 private:
   struct DL {
     enum State : char { Waiting, Loading, Finished };
@@ -96,26 +218,56 @@ private:
     std::unique_ptr<Download> download;
     onFinished_t onFinished;
     State state;
+    Priority priority;
+    bool paused;
+    size_t index;    // Position in `_downloads`
+    uint64_t bytes;  // Received bytes already taken from the bucket
+  };
+
+  struct Class {
+    Options options;
+    int running;
+    int queued;
+    double tokens;   // Bytes, negative if the class is over its rate
+    std::deque<DL*> queue;
   };
 
 public:
   Downloads();
  ~Downloads();
 
-  void add_download(Download*, onFinished_t);
+  void add_download(Download*, onFinished_t, Priority = Catalog);
+  void priority(Download*, Priority) noexcept; // Moves a queued or running download to another class
   int  work()                        noexcept;
+  int  fd()                    const noexcept { return _epoll_fd;        }
+  int  wait_time()             const noexcept; // Milliseconds until a paused class may continue, -1 for none
   void parallel(int)                 noexcept;
   int  parallel()              const noexcept { return _parallel;        }
   int  running_downloads()     const noexcept { return _running_handles; }
   int  queued_downloads()      const noexcept { return _queued_handles;  }
-  std::vector<DL>& downloads()       noexcept { return _downloads;       }
+  int  running_downloads(Priority p) const noexcept { return _classes[p].running; }
+  int  queued_downloads(Priority p)  const noexcept { return _classes[p].queued;  }
+  void options(Priority, const Options&) noexcept;
+  const Options& options(Priority p) const noexcept { return _classes[p].options; }
+  const std::vector<std::unique_ptr<DL>>& downloads() const noexcept { return _downloads; }
 
 private:
   CURLM* _curl_multi;
-  std::vector<DL> _downloads;
+  int _epoll_fd;
+  int _timer_fd;
+  std::vector<std::unique_ptr<DL>> _downloads;
+  Class _classes[PRIORITIES];
+  std::chrono::steady_clock::time_point _refilled;
   int _running_handles;
   int _queued_handles;
   int _parallel;
+
+  void start_queued()                noexcept;
+  void take_tokens(DL*)              noexcept;
+  void throttle()                    noexcept;
+  void remove(DL*)                   noexcept;
+  static int socket_cb(CURL*, curl_socket_t, int, void*, void*);
+  static int timer_cb(CURLM*, long, void*);
 };
 
 #endif
@@ -0,0 +1,118 @@
+#include "fifostream.hpp"
+
+#include <cerrno>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+FifoStream :: FifoStream() noexcept
+: _fd(-1)
+, _file_fd(-1)
+, _size(0)
+, _delivered(0)
+, _finished(false)
+{
+}
+
+FifoStream :: ~FifoStream() {
+  close();
+}
+
+bool FifoStream :: open(const std::string& path, const std::string& file) {
+  close();
+
+  ::unlink(path.c_str()); // Left over by a crash
+  if (::mkfifo(path.c_str(), 0600))
+    return false;
+  _path = path;
+
+  // Opening for reading too doesn't block until there is a reader
+  struct stat st;
+  _fd = ::open(_path.c_str(), O_RDWR|O_NONBLOCK|O_CLOEXEC);
+  _file_fd = ::open(file.c_str(), O_RDONLY|O_CLOEXEC);
+  if (_fd < 0 || _file_fd < 0 || ::fstat(_file_fd, &st)) {
+    close();
+    return false;
+  }
+
+#ifdef F_SETPIPE_SZ
+  ::fcntl(_fd, F_SETPIPE_SZ, 1 << 20); // Fewer wakeups, may exceed the limit
+#endif
+
+  _size = uint64_t(st.st_size);
+  work();
+  return true;
+}
+
+void FifoStream :: close() noexcept {
+  // Unlinked first, so the reader fails instead of waiting for a writer
+  if (! _path.empty())
+    ::unlink(_path.c_str());
+  if (_fd >= 0)
+    ::close(_fd);
+  if (_file_fd >= 0)
+    ::close(_file_fd);
+
+  _path.clear();
+  _fd = _file_fd = -1;
+  _size = _delivered = 0;
+  _finished = false;
+}
+
+void FifoStream :: write(uint64_t offset, const char* data, size_t len) noexcept {
+  if (_fd < 0)
+    return;
+
+  // The file was started over, the reader already got the old content
+  if (offset < _delivered) {
+    close();
+    return;
+  }
+
+  _size = offset + len;
+  if (offset == _delivered) {
+    const ssize_t n = ::write(_fd, data, len);
+    if (n > 0)
+      _delivered += uint64_t(n);
+  }
+
+  work();
+}
+
+void FifoStream :: finish() noexcept {
+  _finished = true;
+  work();
+}
+
+void FifoStream :: work() noexcept {
+  if (_fd < 0)
+    return;
+
+  char buffer[32 * 1024];
+  while (_delivered < _size) {
+    const size_t want = size_t(std::min<uint64_t>(sizeof(buffer), _size - _delivered));
+    const ssize_t got = ::pread(_file_fd, buffer, want, off_t(_delivered));
+    if (got <= 0) { // The file is shorter than reported
+      close();
+      return;
+    }
+
+    const ssize_t n = ::write(_fd, buffer, size_t(got));
+    if (n > 0)
+      _delivered += uint64_t(n);
+    if (n < got) // Full (EAGAIN)
+      return;
+  }
+
+  // Closing our end discards what is left in the FIFO
+  int unread = 0;
+  if (_finished && 0 == ::ioctl(_fd, FIONREAD, &unread) && unread == 0)
+    close();
+}
+
+int FifoStream :: wait_time() const noexcept {
+  return (_finished && _fd >= 0 && _delivered >= _size ? DRAIN_INTERVAL : -1);
+}
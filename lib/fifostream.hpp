@@ -0,0 +1,57 @@
+#ifndef LIB_FIFOSTREAM_HPP
+#define LIB_FIFOSTREAM_HPP
+
+#include <string>
+#include <cstdint>
+
+/**
+ * Feeds a file that is still being written (a download) into a FIFO, so a
+ * reader can consume the file while it grows. The reader never gets ahead
+ * of the writer and never sees a premature end of file.
+ *
+ * The writer reports every chunk that went into the file with write(). If
+ * the FIFO has caught up, the chunk is written to it directly. Otherwise
+ * work() reads the rest back from the file once the FIFO has room again,
+ * so nothing is buffered in memory. Poll fd() for POLLOUT while pending().
+ *
+ * After finish() the FIFO is closed as soon as the reader has consumed
+ * everything. The reader then gets its end of file. Until then,
+ * wait_time() asks to be called again.
+ */
+class FifoStream {
+public:
+  enum { DRAIN_INTERVAL = 50 }; // Milliseconds
+
+  FifoStream() noexcept;
+ ~FifoStream();
+
+  /* Creates the FIFO `path` for `file`. The bytes in `file` are the start of the stream */
+  bool open(const std::string& path, const std::string& file);
+  void close() noexcept;
+
+  /* `len` bytes were written to the file at `offset` */
+  void write(uint64_t offset, const char* data, size_t len) noexcept;
+
+  /* No more bytes will be written */
+  void finish() noexcept;
+
+  void work() noexcept;
+  int  wait_time() const noexcept; // Milliseconds until work() is due, -1 for none
+
+  bool is_open()   const noexcept { return _fd >= 0; }
+  bool pending()   const noexcept { return _fd >= 0 && _delivered < _size; }
+  int  fd()        const noexcept { return _fd;        }
+  uint64_t size()      const noexcept { return _size;      }
+  uint64_t delivered() const noexcept { return _delivered; }
+  const std::string& path() const noexcept { return _path; }
+
+private:
+  std::string _path;
+  int _fd;              // Our end of the FIFO, opened for reading and writing
+  int _file_fd;
+  uint64_t _size;       // Bytes in the file
+  uint64_t _delivered;  // Bytes written to the FIFO
+  bool _finished;
+};
+
+#endif
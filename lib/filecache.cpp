@@ -0,0 +1,335 @@
+#include "filecache.hpp"
+#include "sscan.hpp"
+
+#include <ctime>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+/* The access log lives in the cache directory. Each line is
+ *
+ *   <seconds since the epoch> <hits> <name>\n
+ *
+ * Lines of files that don't exist anymore are ignored. */
+#define FILECACHE_LOG ".access.log"
+
+FileCache :: FileCache() noexcept
+: _budget(0)
+, _size(0)
+, _policy(LRU)
+, _sequence(0)
+, _log_lines(0)
+, _log(NULL)
+, _fd(-1)
+{
+}
+
+FileCache :: ~FileCache() {
+  close();
+}
+
+void FileCache :: close() noexcept {
+  if (_log)
+    std::fclose(_log);
+  _log = NULL;
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+  _files.clear();
+  _victims.clear();
+  _size = 0;
+}
+
+bool FileCache :: open(const std::string& directory, const char* suffix, uint64_t budget, Policy policy) {
+  close();
+  _directory = directory;
+  _suffix = suffix;
+  _budget = budget;
+  _policy = policy;
+
+  // Watch before reading, so nothing is missed in between
+  _fd = ::inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if (_fd >= 0 && ::inotify_add_watch(_fd, _directory.c_str(),
+        IN_CLOSE_WRITE|IN_MOVED_TO|IN_DELETE|IN_MOVED_FROM|IN_ONLYDIR) < 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+
+  if (! index())
+    return false;
+
+  replay_log();
+  compact_log();
+  return true;
+}
+
+bool FileCache :: index() {
+  DIR* dir = ::opendir(_directory.c_str());
+  if (! dir)
+    return false;
+
+  struct stat st;
+  for (dirent* entry; (entry = ::readdir(dir));) {
+    const size_t len = std::strlen(entry->d_name);
+    if (len <= _suffix.size() || std::strcmp(entry->d_name + len - _suffix.size(), _suffix.c_str()))
+      continue;
+    if (::stat(path(entry->d_name).c_str(), &st) || ! S_ISREG(st.st_mode))
+      continue;
+
+    // Files without a log entry count as used when they were written
+    _files[entry->d_name] = File{uint64_t(st.st_size), int64_t(st.st_mtime), 0, 0};
+    _size += uint64_t(st.st_size);
+  }
+
+  ::closedir(dir);
+  return true;
+}
+
+void FileCache :: replay_log() {
+  std::FILE* fh = std::fopen(path(FILECACHE_LOG).c_str(), "rb");
+  if (! fh)
+    return;
+
+  char* line = NULL;
+  size_t capacity = 0;
+  for (ssize_t len; (len = ::getline(&line, &capacity, fh)) > 0;) {
+    if (line[len - 1] == '\n')
+      line[--len] = '\0';
+
+    int64_t time;
+    uint64_t hits;
+    SScan scanner(line, size_t(len));
+    if (! scanner.read_int(time).read_int(hits).read(' '))
+      continue;
+
+    auto it = _files.find(std::string(scanner.buffer(), scanner.length()));
+    if (it == _files.end())
+      continue;
+
+    File& file = it->second;
+    file.hits += hits;
+    if (time >= file.last_access) {
+      file.last_access = time;
+      file.sequence = ++_sequence;
+    }
+  }
+
+  std::free(line);
+  std::fclose(fh);
+}
+
+/* Rewrites the log with one line per file, in the order of their last
+ * access, so replaying it restores the order */
+void FileCache :: compact_log() {
+  if (_log)
+    std::fclose(_log);
+  _log = NULL;
+
+  std::vector<const std::pair<const std::string, File>*> files;
+  files.reserve(_files.size());
+  for (const auto& file : _files)
+    files.push_back(&file);
+  std::sort(files.begin(), files.end(), [](const std::pair<const std::string, File>* a,
+                                           const std::pair<const std::string, File>* b) {
+    if (a->second.last_access != b->second.last_access)
+      return a->second.last_access < b->second.last_access;
+    return a->second.sequence < b->second.sequence;
+  });
+
+  const std::string log = path(FILECACHE_LOG);
+  const std::string temp = log + ".tmp";
+  std::FILE* fh = std::fopen(temp.c_str(), "wb");
+  if (! fh)
+    return;
+
+  bool ok = true;
+  for (const auto* file : files)
+    ok = ok && 0 < std::fprintf(fh, "%lld %llu %s\n",
+        static_cast<long long>(file->second.last_access),
+        static_cast<unsigned long long>(file->second.hits), file->first.c_str());
+  ok = (0 == std::fclose(fh)) && ok;
+
+  if (ok && 0 == std::rename(temp.c_str(), log.c_str()))
+    _log_lines = files.size();
+  else
+    ::unlink(temp.c_str());
+
+  _log = std::fopen(log.c_str(), "ab");
+}
+
+void FileCache :: record(const std::string& name, const File& file, uint64_t hits) {
+  if (! _log)
+    return;
+
+  std::fprintf(_log, "%lld %llu %s\n", static_cast<long long>(file.last_access),
+      static_cast<unsigned long long>(hits), name.c_str());
+  std::fflush(_log);
+
+  if (++_log_lines > 2 * _files.size() + LOG_COMPACT_MIN)
+    compact_log();
+}
+
+void FileCache :: access(const std::string& name) {
+  auto it = _files.find(name);
+  if (it == _files.end()) {
+    add(name);
+    return;
+  }
+
+  File& file = it->second;
+  file.hits++;
+  file.last_access = int64_t(std::time(NULL));
+  file.sequence = ++_sequence;
+  record(name, file, 1);
+}
+
+void FileCache :: add(const std::string& name) {
+  struct stat st;
+  if (::stat(path(name).c_str(), &st))
+    return;
+
+  File& file = _files[name];
+  _size -= file.size;
+  _size += uint64_t(st.st_size);
+  file.size = uint64_t(st.st_size);
+  file.hits++;
+  file.last_access = int64_t(std::time(NULL));
+  file.sequence = ++_sequence;
+  record(name, file, 1);
+}
+
+void FileCache :: remove(const std::string& name) {
+  ::unlink(path(name).c_str());
+
+  auto it = _files.find(name);
+  if (it != _files.end()) {
+    _victims.clear(); // They point to the names
+    _size -= it->second.size;
+    _files.erase(it);
+  }
+}
+
+void FileCache :: pin(const std::string& name) {
+  _pinned.push_back(name);
+}
+
+void FileCache :: unpin(const std::string& name) noexcept {
+  auto it = std::find(_pinned.begin(), _pinned.end(), name);
+  if (it != _pinned.end())
+    _pinned.erase(it);
+}
+
+bool FileCache :: pinned(const std::string& name) const noexcept {
+  return std::find(_pinned.begin(), _pinned.end(), name) != _pinned.end();
+}
+
+/* Orders the unpinned files so that the next one to evict is at the back */
+void FileCache :: select_victims() {
+  _victims.clear();
+  for (const auto& file : _files)
+    if (! pinned(file.first))
+      _victims.push_back(Victim{&file.first, &file.second, file.second.sequence});
+
+  const bool lfu = (_policy == LFU);
+  std::sort(_victims.begin(), _victims.end(), [lfu](const Victim& a, const Victim& b) {
+    const File& fa = *a.file;
+    const File& fb = *b.file;
+    if (lfu && fa.hits != fb.hits)
+      return fa.hits > fb.hits;
+    if (fa.last_access != fb.last_access)
+      return fa.last_access > fb.last_access;
+    if (fa.sequence != fb.sequence)
+      return fa.sequence > fb.sequence;
+    return *a.name > *b.name;
+  });
+}
+
+void FileCache :: sync() {
+  if (_fd < 0)
+    return;
+
+  bool overflow = false;
+  alignas(struct inotify_event) char buffer[4096];
+  for (ssize_t len; (len = ::read(_fd, buffer, sizeof(buffer))) > 0;) {
+    for (const char* p = buffer; p < buffer + len;) {
+      const auto* event = reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW)
+        overflow = true;
+      if (overflow || ! event->len)
+        continue;
+
+      const std::string name = event->name;
+      if (name.size() <= _suffix.size() || name.compare(name.size() - _suffix.size(), _suffix.size(), _suffix))
+        continue;
+
+      auto it = _files.find(name);
+      if (event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+        if (it != _files.end()) {
+          _victims.clear(); // They point to the names
+          _size -= it->second.size;
+          _files.erase(it);
+        }
+      }
+      else {
+        struct stat st;
+        if (::stat(path(name).c_str(), &st) || ! S_ISREG(st.st_mode))
+          continue;
+        if (it == _files.end())
+          it = _files.emplace(name, File{0, int64_t(st.st_mtime), 0, ++_sequence}).first;
+        _size -= it->second.size;
+        _size += uint64_t(st.st_size);
+        it->second.size = uint64_t(st.st_size);
+      }
+    }
+  }
+
+  // Events were lost, read the directory again
+  if (overflow) {
+    _files.clear();
+    _victims.clear();
+    _size = 0;
+    index();
+    replay_log();
+  }
+}
+
+int FileCache :: work(int max_files) {
+  sync();
+
+  int evicted = 0;
+  bool selected = false;
+
+  while (evicted < max_files && over_budget()) {
+    if (_victims.empty()) {
+      if (selected) // Nothing left that could be evicted
+        break;
+      select_victims();
+      selected = true;
+      continue;
+    }
+
+    const Victim victim = _victims.back();
+    _victims.pop_back();
+
+    // Used or pinned since the selection
+    if (victim.file->sequence != victim.sequence || pinned(*victim.name))
+      continue;
+
+    if (::unlink(path(*victim.name).c_str()) && errno != ENOENT)
+      continue;
+
+    _size -= victim.file->size;
+    _files.erase(_files.find(*victim.name));
+    ++evicted;
+  }
+
+  return evicted;
+}
@@ -0,0 +1,103 @@
+#ifndef LIB_FILECACHE_HPP
+#define LIB_FILECACHE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * Keeps the files of a cache directory below a byte budget.
+ *
+ * open() builds an in-memory index of the files ending in `suffix` (their
+ * sizes and modification times) and replays the access log of the
+ * directory on top of it. The caller reports every use of a file with
+ * access() and every new file with add(). These calls update the index and
+ * append a line to the log, so the order survives restarts.
+ *
+ * work() evicts files while the cache is over its budget, at most a few
+ * per call, so it can be called from the main loop:
+ *  - LRU removes the file that was not used for the longest time.
+ *  - LFU removes the file that was used the least often. Ties go to the
+ *    least recently used one.
+ * The eviction order is computed once per round and reused by the
+ * following calls. Files that were used in the meantime are skipped.
+ * Pinned files (the playing and the next track) are never evicted.
+ *
+ * Files that are created or deleted by others are picked up through
+ * inotify by sync(), which is also called by work().
+ *
+ * The log is rewritten with one line per file once it has grown to more
+ * than twice the number of files.
+ */
+class FileCache {
+public:
+  enum Policy { LRU, LFU };
+  enum { LOG_COMPACT_MIN = 256 };
+
+  FileCache() noexcept;
+ ~FileCache();
+
+  /* A budget of 0 means unlimited */
+  bool open(const std::string& directory, const char* suffix, uint64_t budget, Policy = LRU);
+  void close() noexcept;
+
+  void access(const std::string& name);
+  void add(const std::string& name);
+  void remove(const std::string& name);
+  bool contains(const std::string& name) const { return _files.count(name); }
+
+  void pin(const std::string& name);
+  void unpin(const std::string& name) noexcept;
+  bool pinned(const std::string& name) const noexcept;
+
+  /* Evicts at most `max_files`, returns the number of evicted files */
+  int work(int max_files = 4);
+
+  /* Applies the changes made by others to the directory */
+  void sync();
+
+  uint64_t size()       const noexcept { return _size;         }
+  uint64_t budget()     const noexcept { return _budget;       }
+  size_t   files()      const noexcept { return _files.size(); }
+  bool     over_budget() const noexcept { return _budget && _size > _budget; }
+  int      fd()         const noexcept { return _fd;           }
+  const std::string& directory() const noexcept { return _directory; }
+
+private:
+  struct File {
+    uint64_t size;
+    int64_t  last_access; // Seconds since the epoch
+    uint64_t hits;
+    uint64_t sequence;    // Order of last_access within the same second
+  };
+
+  struct Victim {
+    const std::string* name;
+    const File* file;
+    uint64_t sequence;    // File::sequence at the time of selection
+  };
+
+  std::string _directory;
+  std::string _suffix;
+  uint64_t _budget;
+  uint64_t _size;
+  Policy _policy;
+  std::unordered_map<std::string, File> _files;
+  std::vector<std::string> _pinned;
+  std::vector<Victim> _victims; // Eviction order, last one first
+  uint64_t _sequence;
+  size_t _log_lines;
+  std::FILE* _log;
+  int _fd; // inotify
+
+  std::string path(const std::string& name) const { return _directory + '/' + name; }
+  bool index();
+  void record(const std::string& name, const File&, uint64_t hits);
+  void replay_log();
+  void compact_log();
+  void select_victims();
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "frontcodedchunk.hpp"
+
+#include <cstring>
+#include <utility>
+#include <algorithm>
+
+static inline unsigned char uchar(char c) noexcept {
+  return static_cast<unsigned char>(c);
+}
+
+// FrontCodedChunk ============================================================
+
+int FrontCodedChunk :: add(CString s) {
+  const int id = find(s);
+  if (id)
+    return id;
+
+  return add_unchecked(s);
+}
+
+int FrontCodedChunk :: add_unchecked(CString s) {
+  const int pos = _tail.add_unchecked(s);
+  return pos ? _count + pos : 0;
+}
+
+int FrontCodedChunk :: find(CString s) const noexcept {
+  if (! s.length())
+    return 0;
+
+  const int id = find_sorted(s);
+  if (id)
+    return id;
+
+  const int pos = _tail.find(s);
+  return pos ? _count + pos : 0;
+}
+
+/* Binary search on the first strings of the blocks, then a linear search
+ * inside of the block without decoding the strings. */
+int FrontCodedChunk :: find_sorted(CString s) const noexcept {
+  const char* data = sorted_data();
+
+  size_t lo = 0, hi = _blocks.size();
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (std::strcmp(data + _blocks[mid] + 1, s) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (! lo)
+    return 0;
+
+  const size_t block = lo - 1;
+  const char* p = data + _blocks[block];
+  const int first_id = int(block) * BLOCK_SIZE + 1;
+  const int last_id  = std::min(first_id + BLOCK_SIZE - 1, _count);
+
+  // `matched` is the number of chars `s` shares with the previous string
+  size_t matched = 0;
+  for (int id = first_id; id <= last_id; ++id) {
+    const size_t prefix = uchar(*p++);
+
+    if (prefix < matched) {
+      if (prefix < MAX_PREFIX)
+        return 0; // This string is already greater than `s`
+      matched = prefix; // Capped, it may share even more with `s`
+    }
+
+    if (prefix == matched) {
+      size_t k = 0;
+      while (p[k] && p[k] == s[matched + k])
+        ++k;
+
+      if (! p[k] && ! s[matched + k])
+        return id;
+
+      if (uchar(p[k]) > uchar(s[matched + k]))
+        return 0;
+
+      matched += k;
+    }
+
+    p += std::strlen(p) + 1;
+  }
+
+  return 0;
+}
+
+const char* FrontCodedChunk :: get(int id, std::string& buffer) const {
+  if (id <= 0 || id > _count)
+    return _tail.get(id ? id - _count : 0);
+
+  const int i = id - 1;
+  const char* p = sorted_data() + _blocks[size_t(i / BLOCK_SIZE)];
+
+  for (int n = i % BLOCK_SIZE;; --n) {
+    buffer.resize(uchar(*p++));
+    buffer.append(p);
+    if (! n)
+      break;
+    p += std::strlen(p) + 1;
+  }
+
+  return buffer.c_str();
+}
+
+int FrontCodedChunk :: size() const noexcept {
+  return int(sorted_size() + _blocks.size() * sizeof(int)) + _tail.size();
+}
+
+int FrontCodedChunk :: capacity() const noexcept {
+  const size_t sorted_capacity = _shared ? _shared_size : _sorted.capacity();
+  return int(sorted_capacity + _blocks.capacity() * sizeof(int)) + _tail.capacity();
+}
+
+void FrontCodedChunk :: clear() noexcept {
+  _sorted.clear();
+  _shared = NULL;
+  _blocks.clear();
+  _count = 0;
+  _tail.clear();
+}
+
+bool FrontCodedChunk :: assign_sorted(std::string data) {
+  _sorted = std::move(data);
+  _shared = NULL;
+  return index_blocks();
+}
+
+bool FrontCodedChunk :: share_sorted(const char* data, size_t size) {
+  std::string().swap(_sorted);
+  _shared = data;
+  _shared_size = size;
+  return index_blocks();
+}
+
+/* Rebuilds the block index. Every entry has to consist of the prefix length
+ * and a NUL terminated suffix, otherwise the sorted part is dropped. */
+bool FrontCodedChunk :: index_blocks() {
+  const char* data = sorted_data();
+  const size_t size = sorted_size();
+
+  _blocks.clear();
+  _count = 0;
+
+  for (size_t pos = 0; pos < size; ++_count) {
+    const void* end = (pos + 1 < size ? std::memchr(data + pos + 1, '\0', size - pos - 1) : NULL);
+    if (! end) {
+      clear();
+      return false;
+    }
+
+    if (_count % BLOCK_SIZE == 0)
+      _blocks.push_back(int(pos));
+    pos = size_t(static_cast<const char*>(end) - data) + 1;
+  }
+
+  return true;
+}
+
+// FrontCodedChunk :: Builder =================================================
+
+FrontCodedChunk::Builder :: Builder(FrontCodedChunk& chunk)
+: _chunk(chunk)
+{
+  _chunk.clear();
+}
+
+/* Strings have to be added in ascending order. Adding the last string again
+ * returns its ID. */
+int FrontCodedChunk::Builder :: add(CString s) {
+  if (! s.length())
+    return 0;
+
+  if (_chunk._count && _last.size() == s.length() && ! _last.compare(0, _last.size(), s, s.length()))
+    return _chunk._count;
+
+  size_t prefix = 0;
+  if (_chunk._count % BLOCK_SIZE == 0)
+    _chunk._blocks.push_back(int(_chunk._sorted.size()));
+  else {
+    const size_t max = std::min(size_t(MAX_PREFIX), std::min(_last.size(), s.length()));
+    while (prefix < max && _last[prefix] == s[prefix])
+      ++prefix;
+  }
+
+  _chunk._sorted.push_back(static_cast<char>(prefix));
+  _chunk._sorted.append(s + prefix, s.length() - prefix);
+  _chunk._sorted.push_back('\0');
+  _last.assign(s, s.length());
+  return ++_chunk._count;
+}
+
+// FrontCodedChunk :: Shrinker ================================================
+
+FrontCodedChunk::Shrinker :: Shrinker(FrontCodedChunk& chunk)
+: _chunk(chunk)
+, _id_remap(size_t(chunk._count + chunk._tail.size()))
+{
+}
+
+void FrontCodedChunk::Shrinker :: add(int id) {
+  _id_remap[size_t(id)] = id;
+}
+
+void FrontCodedChunk::Shrinker :: shrink() {
+  std::vector<std::pair<std::string, int>> strings;
+  for (size_t id = 1; id < _id_remap.size(); ++id)
+    if (_id_remap[id])
+      strings.emplace_back(_chunk.get(int(id)), int(id));
+
+  std::sort(strings.begin(), strings.end());
+
+  FrontCodedChunk new_chunk;
+  Builder builder(new_chunk);
+  for (const auto& s : strings)
+    _id_remap[size_t(s.second)] = builder.add(s.first);
+
+  new_chunk.shrink_to_fit();
+  _chunk._sorted = std::move(new_chunk._sorted);
+  _chunk._shared = NULL;
+  _chunk._blocks = std::move(new_chunk._blocks);
+  _chunk._count  = new_chunk._count;
+  _chunk._tail.clear();
+}
+
+int FrontCodedChunk::Shrinker :: get_new_id(int id) {
+  return _id_remap[size_t(id)];
+}
@@ -0,0 +1,120 @@
+#ifndef LIB_FRONTCODEDCHUNK_HPP
+#define LIB_FRONTCODEDCHUNK_HPP
+
+#include "string.hpp"
+#include "heaparray.hpp"
+#include "stringchunk.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * String storage for strings sharing long prefixes (e.g. URLs).
+ *
+ * The strings are kept in two parts:
+ *
+ * - A sorted part, divided into blocks of BLOCK_SIZE strings. The first string
+ *   of a block is stored as is, the following ones only store the length of
+ *   the prefix they share with their predecessor and the remaining suffix.
+ *   IDs are the (1-based) positions of the strings in sorted order, so a
+ *   string can be found using binary search.
+ *
+ * - An unsorted tail (a StringChunk) that receives the strings added after
+ *   the sorted part has been built. The ID of a tail string is the number of
+ *   sorted strings plus its byte offset in the tail.
+ *
+ * The Shrinker merges both parts into a new sorted part, dropping all strings
+ * that are not referenced anymore.
+ *
+ * The strings of the sorted part have to be decoded, so get() returns a copy
+ * or decodes into a buffer provided by the caller.
+ *
+ * Both parts can be shared (see share()), they are read in place then.
+ */
+class FrontCodedChunk {
+public:
+  using CString = ConstCharsLen;
+
+  enum : int { BLOCK_SIZE = 16, MAX_PREFIX = 255 };
+
+  /* First string in the chunk is always an empty string "" with ID 0 */
+  FrontCodedChunk() : _shared(NULL), _shared_size(0), _count(0) {}
+
+  /* Adds string `s` to the chunk.
+   * If the string already exists in the chunk, its ID will be returned and
+   * no new insertion is made. */
+  int add(CString s);
+
+  /* Adds string `s` to the tail of the chunk.
+   * No attempts are made to return an existing string from the chunk. */
+  int add_unchecked(CString s);
+
+  /* Returns the ID for string `s`.
+   * If the string is empty or it could not be found, 0 is returned. */
+  int find(CString s) const noexcept;
+
+  /* Return the number of strings */
+  int count()        const noexcept { return _count + _tail.count(); }
+  int sorted_count() const noexcept { return _count; }
+
+  /* Returns the string with ID `id`. The pointer either points into the
+   * chunk or to `buffer` and is valid as long as both are unchanged. */
+  const char* get(int id, std::string& buffer) const;
+  std::string get(int id) const { std::string s; return get(id, s); }
+
+  int         size()      const noexcept;
+  int         capacity()  const noexcept;
+  void        clear()           noexcept;
+  void        reserve(size_t n)          { _tail.reserve(n); }
+  void        shrink_to_fit()            { _sorted.shrink_to_fit(); _blocks.shrink_to_fit(); }
+  bool        is_shrinked() const noexcept { return _tail.size() == 1; }
+  bool        shared()      const noexcept { return _shared; } // Only the sorted part
+
+  /* Raw access for saving and loading */
+  const char*        sorted_data() const noexcept { return _shared ? _shared : _sorted.data(); }
+  size_t             sorted_size() const noexcept { return _shared ? _shared_size : _sorted.size(); }
+  StringChunk&       tail()              noexcept { return _tail; }
+  const StringChunk& tail()        const noexcept { return _tail; }
+
+  /* Replace the sorted part by `data`, return false if `data` is malformed */
+  bool assign_sorted(std::string data);
+
+  /* Same as assign_sorted(), but the sorted part is read in place from
+   * `data` instead of being copied */
+  bool share_sorted(const char* data, size_t size);
+
+  /* Builds the sorted part from strings given in ascending order */
+  struct Builder {
+    Builder(FrontCodedChunk&);
+    int add(CString s);
+  private:
+    FrontCodedChunk& _chunk;
+    std::string _last;
+  };
+
+  struct Shrinker {
+    void add(int id);
+    int  get_new_id(int old_id);
+    void shrink();
+  private:
+    friend class FrontCodedChunk;
+    Shrinker(FrontCodedChunk&);
+    FrontCodedChunk& _chunk;
+    HeapArray<int> _id_remap;
+  };
+
+  Shrinker get_shrinker() { return Shrinker(*this); }
+
+private:
+  std::string      _sorted;
+  const char*      _shared;
+  size_t           _shared_size;
+  std::vector<int> _blocks; // Offsets of the blocks in `_sorted`
+  int              _count;  // Number of strings in `_sorted`
+  StringChunk      _tail;
+
+  int find_sorted(CString s) const noexcept;
+  bool index_blocks();
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LIB_HISTOGRAM_HPP
+#define LIB_HISTOGRAM_HPP
+
+#include "bit_tools.hpp"
+
+#include <cstdint>
+
+/**
+ * Histogram with power of two buckets.
+ *
+ * Bucket `i` counts the values having a bit length of `i`: bucket 0 holds
+ * the zeros, bucket i > 0 the values in [2^(i-1), 2^i). Adding a value is
+ * O(1) and the histogram has a fixed size, so it can be copied freely.
+ */
+class Log2Histogram {
+public:
+  enum { BUCKETS = 65 };
+
+  Log2Histogram() noexcept
+  : _buckets()
+  , _count(0)
+  , _sum(0)
+  , _max(0)
+  {}
+
+  void add(uint64_t value) noexcept {
+    ++_buckets[bitlength(value)];
+    ++_count;
+    _sum += value;
+    if (value > _max)
+      _max = value;
+  }
+
+  uint64_t count()       const noexcept { return _count; }
+  uint64_t sum()         const noexcept { return _sum;   }
+  uint64_t max()         const noexcept { return _max;   }
+  uint64_t mean()        const noexcept { return _count ? _sum / _count : 0; }
+  uint64_t bucket(int i) const noexcept { return _buckets[i]; }
+
+  /* Largest value of bucket `i` */
+  static uint64_t upper_bound(int i) noexcept {
+    return (i >= 64 ? UINT64_MAX : (uint64_t(1) << i) - 1);
+  }
+
+  /* Upper bound of the bucket containing the `p`th percentile (0..100),
+   * which is never greater than max() */
+  uint64_t percentile(unsigned p) const noexcept {
+    uint64_t rank = (_count * p + 99) / 100;
+    if (rank == 0)
+      rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+      if ((seen += _buckets[i]) >= rank)
+        return (upper_bound(i) < _max ? upper_bound(i) : _max);
+    return _max;
+  }
+
+private:
+  uint64_t _buckets[BUCKETS];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _max;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "httpcache.hpp"
+#include "sscan.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <utility>
+
+#include <unistd.h>
+
+/* Layout of a cache file:
+ *
+ *   HTTPCACHE 1\n
+ *   <url>\n
+ *   <etag>\n
+ *   <last-modified>\n
+ *   <hash> <meta size> <body size>\n
+ *   <meta><body>
+ */
+#define HTTPCACHE_MAGIC "HTTPCACHE 1\n"
+
+uint64_t HttpCache :: hash(const char* data, size_t size, uint64_t h) noexcept {
+  for (const char* end = data + size; data != end; ++data) {
+    h ^= static_cast<unsigned char>(*data);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+HttpCache :: HttpCache(std::string directory)
+: _directory(std::move(directory))
+{
+}
+
+std::string HttpCache :: path(const std::string& url) const {
+  char name[20];
+  std::sprintf(name, "%016" PRIx64, hash(url.data(), url.size()));
+  return _directory + '/' + name;
+}
+
+static bool read_string(std::FILE* fh, std::string& s, size_t size) {
+  s.resize(size);
+  return size == 0 || std::fread(&s[0], 1, size, fh) == size;
+}
+
+bool HttpCache :: load(const std::string& url, Entry& entry, bool with_body) const noexcept {
+  std::FILE* fh = std::fopen(path(url).c_str(), "rb");
+  if (! fh)
+    return false;
+
+  std::string line;
+  bool ok = read_line(fh, line) && line + '\n' == HTTPCACHE_MAGIC
+         && read_line(fh, line) && line == url // Different URL with same hash
+         && read_line(fh, entry.etag)
+         && read_line(fh, entry.last_modified)
+         && read_line(fh, line);
+
+  if (ok) {
+    uint64_t hash;
+    size_t meta_size, body_size;
+    const long pos = std::ftell(fh);
+    ok = SScan(line).read_hex(hash).read_int(meta_size).read_int(body_size)
+      && 0 == std::fseek(fh, 0, SEEK_END)
+      && size_t(std::ftell(fh) - pos) == meta_size + body_size // Truncated file
+      && 0 == std::fseek(fh, pos, SEEK_SET)
+      && read_string(fh, entry.meta, meta_size);
+    if (ok) {
+      entry.hash = hash;
+      if (with_body)
+        ok = read_string(fh, entry.body, body_size);
+      else
+        entry.body.clear();
+    }
+  }
+
+  std::fclose(fh);
+  return ok;
+}
+
+bool HttpCache :: store(const std::string& url, const Entry& entry) const noexcept {
+  const std::string file = path(url);
+  const std::string temp = file + ".tmp";
+
+  std::FILE* fh = std::fopen(temp.c_str(), "wb");
+  if (! fh)
+    return false;
+
+  bool ok = 0 < std::fprintf(fh, HTTPCACHE_MAGIC "%s\n%s\n%s\n%016" PRIx64 " %zu %zu\n",
+      url.c_str(), entry.etag.c_str(), entry.last_modified.c_str(),
+      entry.hash, entry.meta.size(), entry.body.size());
+  ok = ok && entry.meta.size() == std::fwrite(entry.meta.data(), 1, entry.meta.size(), fh);
+  ok = ok && entry.body.size() == std::fwrite(entry.body.data(), 1, entry.body.size(), fh);
+  ok = (0 == std::fclose(fh)) && ok;
+
+  if (ok && 0 == std::rename(temp.c_str(), file.c_str()))
+    return true;
+
+  ::unlink(temp.c_str());
+  return false;
+}
+
+void HttpCache :: remove(const std::string& url) const noexcept {
+  ::unlink(path(url).c_str());
+}
+
+/* Collects ETag and Last-Modified. Every new status line (redirects) resets
+ * the validators collected so far. */
+static size_t header_cb(char *data, size_t size, size_t nmemb, void *entry_) {
+  auto& entry = *static_cast<HttpCache::Entry*>(entry_);
+  const size_t len = size * nmemb;
+  const char* end = data + len;
+
+  while (end != data && (end[-1] == '\n' || end[-1] == '\r'))
+    --end;
+
+  if (len >= 5 && ! std::strncmp(data, "HTTP/", 5)) {
+    entry.etag.clear();
+    entry.last_modified.clear();
+  }
+  else if (! match_header(data, end, "ETag:", entry.etag))
+    match_header(data, end, "Last-Modified:", entry.last_modified);
+
+  return len;
+}
+
+void HttpCache :: prepare(Download& dl, const Entry& cached, Entry& response) noexcept {
+  if (! cached.etag.empty())
+    dl.add_header(("If-None-Match: " + cached.etag).c_str());
+  if (! cached.last_modified.empty())
+    dl.add_header(("If-Modified-Since: " + cached.last_modified).c_str());
+
+  dl.setopt(CURLOPT_HEADERFUNCTION, header_cb);
+  dl.setopt(CURLOPT_HEADERDATA, &response);
+}
@@ -0,0 +1,58 @@
+#ifndef LIB_HTTPCACHE_HPP
+#define LIB_HTTPCACHE_HPP
+
+#include "downloads.hpp"
+
+#include <string>
+#include <cstdint>
+
+/**
+ * On-disk cache for HTTP responses, keyed by URL.
+ *
+ * Each entry lives in its own file inside of the cache directory and holds
+ * the validators of the response (ETag, Last-Modified), a hash of the body,
+ * an opaque string of the user (`meta`) and the body itself.
+ *
+ * prepare() turns a Download into a conditional request for a cached entry
+ * and collects the validators of the response. The cached entry is still
+ * valid if the server answers with 304 or sends a body with the same hash.
+ */
+class HttpCache {
+public:
+  struct Entry {
+    std::string etag;
+    std::string last_modified;
+    std::string meta;
+    std::string body;
+    uint64_t    hash;
+
+    Entry() : hash(0) {}
+  };
+
+  /* 64 bit FNV-1a, can be computed incrementally */
+  enum : uint64_t { HASH_INIT = 14695981039346656037ULL };
+  static uint64_t hash(const char* data, size_t size, uint64_t h = HASH_INIT) noexcept;
+
+  HttpCache(std::string directory);
+
+  /* Reads the entry for `url`. The body is only read if `with_body` is set */
+  bool load(const std::string& url, Entry&, bool with_body = false) const noexcept;
+
+  /* Writes the entry for `url`, replacing an existing one atomically */
+  bool store(const std::string& url, const Entry&) const noexcept;
+
+  void remove(const std::string& url) const noexcept;
+
+  /* Adds If-None-Match/If-Modified-Since for `cached` to `dl` and records the
+   * validators of the response in `response`, which has to outlive `dl` */
+  static void prepare(Download& dl, const Entry& cached, Entry& response) noexcept;
+
+  const std::string& directory() const noexcept { return _directory; }
+
+private:
+  std::string _directory;
+
+  std::string path(const std::string& url) const;
+};
+
+#endif
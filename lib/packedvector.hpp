@@ -48,6 +48,7 @@ protected:
   size_t     _capacity; // element count
   data_type  _bit_mask; // bit mask representing current bit length
   uint8_t    _bits;     // number of bits
+  bool       _borrowed; // `_data` is not owned by the vector, see borrow()
 
 public:
   vector(int bits) noexcept
@@ -56,6 +57,7 @@ public:
   , _capacity(0)
   , _bit_mask(make_bitmask(clamp_bits(bits)))
   , _bits(clamp_bits(bits))
+  , _borrowed(false)
   {
     LIB_PACKEDVECTOR_TRACE(bits);
   }
@@ -66,15 +68,17 @@ public:
   , _capacity(rhs._capacity)
   , _bit_mask(rhs._bit_mask)
   , _bits(rhs._bits)
+  , _borrowed(rhs._borrowed)
   {
     LIB_PACKEDVECTOR_TRACE("VOID");
     rhs._data = NULL;
     rhs._size = 0;
     rhs._capacity = 0;
+    rhs._borrowed = false;
   }
 
  ~vector() {
-    delete[] _data;
+    release();
   }
 
   vector& operator=(vector&& rhs) noexcept {
@@ -82,6 +86,7 @@ public:
     std::swap(_data, rhs._data);
     std::swap(_size, rhs._size);
     std::swap(_capacity, rhs._capacity);
+    std::swap(_borrowed, rhs._borrowed);
     _bit_mask = rhs._bit_mask;
     _bits = rhs._bits;
     return *this;
@@ -112,6 +117,18 @@ public:
   // vector specific methods (not available in std::vector)
   int             bits()      const noexcept { return _bits; }
   data_type       bit_mask()  const noexcept { return _bit_mask; }
+  bool            borrowed()  const noexcept { return _borrowed; }
+
+  /* Use `data` holding `size` elements as storage without taking ownership.
+   * Elements are still modified in place, the memory is only replaced by an
+   * own allocation once the vector has to grow. */
+  void borrow(data_type* data, size_t size) noexcept {
+    LIB_PACKEDVECTOR_TRACE(size);
+    release();
+    _data = data;
+    _size = _capacity = size;
+    _borrowed = true;
+  }
 
   void reserve(size_t n) {
     LIB_PACKEDVECTOR_TRACE(n);
@@ -120,7 +137,7 @@ public:
       const size_t needed_blocks = ceil_div(_bits * n, bitsof<data_type>());
       data_type* new_data = new data_type[needed_blocks];
       std::memcpy(new_data, _data, ceil_div(_bits * _size, size_t(CHAR_BIT)));
-      delete[] _data;
+      release();
       _data = new_data;
       _capacity = needed_blocks * bitsof<data_type>() / _bits;
     }
@@ -172,13 +189,19 @@ public:
       const size_t needed_blocks = ceil_div(_bits * _size, bitsof<data_type>());
       data_type* new_data = new data_type[needed_blocks];
       std::memcpy(new_data, _data, ceil_div(_bits * _size, size_t(CHAR_BIT)));
-      delete[] _data;
+      release();
       _data = new_data;
       _capacity = needed_blocks * bitsof<data_type>() / _bits;
     }
   }
 
 protected:
+  void release() noexcept {
+    if (! _borrowed)
+      delete[] _data;
+    _borrowed = false;
+  }
+
   static constexpr inline data_type make_bitmask(int bits) {
     return ~(std::numeric_limits<data_type>::max() << bits);
   }
@@ -224,6 +247,7 @@ public:
   data_type*      data()                noexcept { return _vec.data();       }
   const data_type*data()          const noexcept { return _vec.data();       }
   int             bits()          const noexcept { return _vec.bits();       }
+  bool            borrowed()      const noexcept { return _vec.borrowed();   }
   value_type      get(size_t idx) const noexcept { return _vec.get(idx);     }
   void            pop_back()            noexcept { _vec.pop_back();          }
 
@@ -240,6 +264,11 @@ public:
     push_back(v);
   }
 
+  void borrow(data_type* data, size_t size, int bits) noexcept {
+    _vec = packed_t(bits);
+    _vec.borrow(data, size);
+  }
+
   void reserve(size_t n, int bits = 1) {
     LIB_PACKEDVECTOR_TRACE(n, bits);
 
@@ -259,7 +288,8 @@ public:
     _vec.resize(n, value);
   }
 
-  void set(size_t index, value_type value) noexcept {
+  // Not noexcept: a value that needs more bits reallocates the vector
+  void set(size_t index, value_type value) {
     LIB_PACKEDVECTOR_TRACE(index, value);
 
     if (data_type(value) > _vec.bit_mask()) {
@@ -1,7 +1,7 @@
 #include "process.hpp"
 
 #include <unistd.h>   // pipe, close, setpgid, fork, dup2, sysconf
-#include <signal.h>   // kill
+#include <signal.h>   // kill, sigprocmask
 #include <sys/wait.h> // waitpid
 
 #include <cstdlib>
@@ -46,6 +46,11 @@ pid_t Process :: open(function_t&& function, bool pipe_stdin, bool pipe_stdout,
 
     setpgid(0, 0);
 
+    // The signal mask survives exec(), don't pass on signals blocked by us
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigprocmask(SIG_SETMASK, &signals, NULL);
+
     if (cwd && chdir(cwd) < 0)
       _exit(EXIT_FAILURE);
 
@@ -1,133 +1,313 @@
 #ifndef SSCAN_HPP
 #define SSCAN_HPP
 
-#include <cstdlib>
-#include <climits>
-#include <cstring>
+#include "stringpack.hpp"
+
+#include <limits>
+#include <string>
+#include <cfloat>
 #include <cerrno>
-#include <cinttypes>
+#include <cstdint>
+#include <cstring>
 
 /**
  * Helper for scanning a string.
  *
- * Provides methods for extracting numbers, skipping chars or whole strings.
+ * Provides methods for extracting numbers, month names, skipping chars or
+ * whole strings.
+ *
+ * The scanned range is bounded by a length, so the input does not have to
+ * be NUL terminated. The number readers don't use strto*() and don't depend
+ * on the locale: They skip leading blanks (space, tab), accept an optional
+ * sign and check the range of the target type. Nothing is allocated.
  *
- * If a read failed, bool(SScan) will return false;
+ * If a read failed, bool(SScan) will return false, the position is left
+ * unchanged and all following reads do nothing.
  * Use `error()` to return the `errno`, which is either
  *  - 0      No error
- *  - ERANGE Over-/underflow (set by strto* functions)
+ *  - ERANGE Over-/underflow
  *  - EINVAL Could not parse the desired type/string
  */
 class SScan {
   const char* _s;
+  const char* _end;
   int _error;
 public:
-  SScan(const char* s) : _s(s), _error(0) {}
-  operator bool()         const noexcept { return !_error; }
-  char operator[](int i)  const noexcept { return _s[i];   }
-  int error()             const noexcept { return _error;  }
-  const char* buffer()    const noexcept { return _s;      }
-  std::size_t length()    const noexcept { return std::strlen(_s); }
-  SScan& clearError()           noexcept { _error = 0; return *this; }
-
-#if 0
-static inline const char* skipWhitespace(const char *s) {
-  while (*s && (*s == ' ' || *s == '\t')) { ++s; }
-  return s;
-}
-  SScan& skip() {
-  }
-#endif
+  SScan(const char* s)             noexcept : _s(s), _end(s + std::strlen(s)), _error(0) {}
+  SScan(const char* s, size_t len) noexcept : _s(s), _end(s + len), _error(0) {}
+  SScan(const std::string& s)      noexcept : _s(s.data()), _end(s.data() + s.size()), _error(0) {}
 
-  SScan& read(char c) {
-    if (*_s == c)
-      ++_s;
-    else
-      _error = EINVAL;
+  operator bool()          const noexcept { return !_error;     }
+  char operator[](size_t i) const noexcept { return i < length() ? _s[i] : '\0'; }
+  int error()              const noexcept { return _error;      }
+  const char* buffer()     const noexcept { return _s;          }
+  std::size_t length()     const noexcept { return size_t(_end - _s); }
+  bool at_end()            const noexcept { return _s == _end;  }
+  SScan& clearError()            noexcept { _error = 0; return *this; }
+
+  SScan& read(char c) noexcept {
+    if (! _error) {
+      if (_s != _end && *_s == c)
+        ++_s;
+      else
+        _error = EINVAL;
+    }
     return *this;
   }
 
   template<size_t LEN>
-  SScan& read(const char (&prefix)[LEN]) {
-    if (! std::strncmp(_s, prefix, LEN - 1))
-      _s += LEN - 1;
-    else
-      _error = EINVAL;
+  SScan& read(const char (&prefix)[LEN]) noexcept {
+    if (! _error) {
+      if (length() >= LEN - 1 && ! std::memcmp(_s, prefix, LEN - 1))
+        _s += LEN - 1;
+      else
+        _error = EINVAL;
+    }
     return *this;
   }
 
-  SScan& skip_until(const char* accept) {
-    while (*_s && !std::strchr(accept, *_s))
+  SScan& skip_until(const char* accept) noexcept {
+    while (_s != _end && !std::strchr(accept, *_s))
       ++_s;
     return *this;
   }
 
-  SScan& seek(size_t n, bool check = true) {
-    if (check && n > length())
-      _s += length();
-    else
-      _s += n;
+  SScan& skip_blanks() noexcept {
+    _s = blanks_end();
     return *this;
   }
 
-#define SScan_define_strto(SUFFIX, TYPE)              \
-  SScan& strto ## SUFFIX (TYPE& i, int base = 10) {   \
-    char *end;                                        \
-    i = std::strto ## SUFFIX (_s, &end, base);        \
-    if (_s == end)                                    \
-      _error = EINVAL;                                \
-    else if (errno)                                   \
-      _error = errno;                                 \
-    _s = end;                                         \
-    return *this;                                     \
-  }
-
-  SScan_define_strto(imax, std::intmax_t)
-  SScan_define_strto(umax, std::uintmax_t)
-  SScan_define_strto(l,    long)
-  SScan_define_strto(ul,   unsigned long)
-  SScan_define_strto(ll,   long long)
-  SScan_define_strto(ull,  unsigned long long)
-#undef SScan_define_strto
-
-  SScan& strtoi(int& i, int base = 10) {
-    std::intmax_t imax;
-    if (this->strtoimax(imax, base)) {
-      if (imax < INT_MIN || imax > INT_MAX)
-        _error = ERANGE;
-      else
-        i = imax;
+  SScan& seek(size_t n) noexcept {
+    _s += (n < length() ? n : length());
+    return *this;
+  }
+
+  /* Reads an integer. Digits may be grouped by `group_separator` ("1,234") */
+  template<class T>
+  SScan& read_int(T& value, char group_separator = '\0') noexcept {
+    return read_number(value, -1, group_separator);
+  }
+
+  /* Reads an unsigned hexadecimal integer without prefix ("ff", "0A3") */
+  template<class T>
+  SScan& read_hex(T& value) noexcept {
+    if (_error)
+      return *this;
+
+    const char* s = blanks_end();
+    std::uintmax_t result = 0;
+    bool overflow = false;
+    int digits = 0;
+
+    for (; s != _end && hex_digit(*s) < 16; ++s, ++digits) {
+      overflow = overflow || result > (std::uintmax_t(std::numeric_limits<T>::max()) - hex_digit(*s)) / 16;
+      result = result * 16 + hex_digit(*s);
     }
+
+    if (! digits)
+      return fail(EINVAL);
+    if (overflow)
+      return fail(ERANGE);
+
+    value = T(result);
+    _s = s;
     return *this;
   }
 
-  SScan& strtoi(short& i, int base = 10) {
-    std::intmax_t imax;
-    if (this->strtoimax(imax, base)) {
-      if (imax < SHRT_MIN || imax > SHRT_MAX)
-        _error = ERANGE;
+  /* Reads a decimal number ("-12.345") as an integer scaled by 10^decimals
+   * (12345 for decimals = 3). Further fraction digits are skipped. */
+  template<class T>
+  SScan& read_fixed(T& value, int decimals) noexcept {
+    return read_number(value, decimals, '\0');
+  }
+
+  /* Reads a decimal number with an optional exponent ("1.5", "-2e-3") */
+  SScan& read_float(float& value) noexcept {
+    if (_error)
+      return *this;
+
+    const char* s = blanks_end();
+    const bool negative = (s != _end && *s == '-');
+    if (s != _end && (*s == '-' || *s == '+'))
+      ++s;
+
+    std::uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; s != _end && is_digit(*s); ++s, ++digits)
+      if (mantissa < UINT64_MAX / 10 - 9)
+        mantissa = mantissa * 10 + digit(*s);
       else
-        i = imax;
+        ++exponent;
+
+    if (s != _end && *s == '.')
+      for (++s; s != _end && is_digit(*s); ++s, ++digits)
+        if (mantissa < UINT64_MAX / 10 - 9) {
+          mantissa = mantissa * 10 + digit(*s);
+          --exponent;
+        }
+
+    if (! digits)
+      return fail(EINVAL);
+
+    if (s != _end && (*s == 'e' || *s == 'E')) {
+      SScan e(s + 1, size_t(_end - s - 1));
+      int n = 0;
+      if (! e.at_end() && ! is_blank(e[0]) && e.read_int(n)) {
+        exponent += n;
+        s = e._s;
+      }
     }
+
+    // Powers of ten up to 10^22 are exact, so a short number is rounded once
+    exponent = (exponent < -400 ? -400 : exponent > 400 ? 400 : exponent);
+    double result = double(mantissa);
+    for (; exponent > 0; exponent -= (exponent < 22 ? exponent : 22))
+      result *= pow10(exponent < 22 ? exponent : 22);
+    for (; exponent < 0; exponent += (exponent > -22 ? -exponent : 22))
+      result /= pow10(exponent > -22 ? -exponent : 22);
+    if (result > double(FLT_MAX))
+      return fail(ERANGE);
+
+    value = float(negative ? -result : result);
+    _s = s;
+    return *this;
+  }
+
+  /* Reads an english month name or its abbreviation ("January", "jan") as
+   * 1 to 12 */
+  SScan& read_month(int& month) noexcept {
+    if (_error)
+      return *this;
+
+    const char* word = blanks_end();
+    const char* s = word;
+    while (s != _end && ((*s | 0x20) >= 'a' && (*s | 0x20) <= 'z'))
+      ++s;
+
+    using pack = StringPack::AlphaNoCase;
+    int m;
+    switch (pack(word, size_t(s - word))) {
+      case pack("jan"): case pack("january"):   m = 1;  break;
+      case pack("feb"): case pack("february"):  m = 2;  break;
+      case pack("mar"): case pack("march"):     m = 3;  break;
+      case pack("apr"): case pack("april"):     m = 4;  break;
+      case pack("may"):                         m = 5;  break;
+      case pack("jun"): case pack("june"):      m = 6;  break;
+      case pack("jul"): case pack("july"):      m = 7;  break;
+      case pack("aug"): case pack("august"):    m = 8;  break;
+      case pack("sep"): case pack("september"): m = 9;  break;
+      case pack("oct"): case pack("october"):   m = 10; break;
+      case pack("nov"): case pack("november"):  m = 11; break;
+      case pack("dec"): case pack("december"):  m = 12; break;
+      default: return fail(EINVAL);
+    }
+
+    month = m;
+    _s = s;
     return *this;
   }
 
-#define SScan_define_strto(SUFFIX, TYPE)             \
-  SScan& strto ## SUFFIX (TYPE& i) {                 \
-    char *end;                                       \
-    i = std::strto ## SUFFIX (_s, &end);             \
-    if (_s == end)                                   \
-      _error = EINVAL;                               \
-    else if (errno)                                  \
-      _error = errno;                                \
-    _s = end;                                        \
-    return *this;                                    \
+  /* Days since 1970-01-01 of a date of the proleptic Gregorian calendar
+   * (month 1 to 12). Unlike mktime() this neither depends on the time zone
+   * nor does it need a `struct tm`. */
+  static int days_since_epoch(int year, int month, int day) noexcept {
+    year -= (month <= 2);
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yoe = year - era * 400;                                  // [0, 399]
+    const int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1; // [0, 365]
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;             // [0, 146096]
+    return era * 146097 + doe - 719468;
+  }
+
+private:
+  static bool     is_blank(char c) noexcept { return c == ' ' || c == '\t'; }
+  static bool     is_digit(char c) noexcept { return c >= '0' && c <= '9'; }
+  static unsigned digit(char c)    noexcept { return unsigned(c - '0');   }
+
+  // 16 for a char that is not a hex digit
+  static unsigned hex_digit(char c) noexcept {
+    if (is_digit(c))
+      return digit(c);
+    c |= 0x20;
+    return (c >= 'a' && c <= 'f' ? unsigned(c - 'a' + 10) : 16);
+  }
+
+  static double pow10(int n) noexcept {
+    double result = 1;
+    while (n--)
+      result *= 10;
+    return result;
+  }
+
+  const char* blanks_end() const noexcept {
+    const char* s = _s;
+    while (s != _end && is_blank(*s))
+      ++s;
+    return s;
   }
 
-  SScan_define_strto(f,  float)
-  SScan_define_strto(d,  double)
-  SScan_define_strto(ld, long double)
-#undef SScan_define_strto
+  SScan& fail(int error) noexcept {
+    _error = error;
+    return *this;
+  }
+
+  // Reads [+-]digits[.digits], the fraction only if decimals >= 0
+  template<class T>
+  SScan& read_number(T& value, int decimals, char group_separator) noexcept {
+    if (_error)
+      return *this;
+
+    const char* s = blanks_end();
+    const bool negative = (s != _end && *s == '-');
+    if (s != _end && (*s == '-' || *s == '+'))
+      ++s;
+    if (negative && ! std::numeric_limits<T>::is_signed)
+      return fail(EINVAL);
+
+    const std::uintmax_t limit = (negative
+      ? std::uintmax_t(0) - std::uintmax_t(std::numeric_limits<T>::min())
+      : std::uintmax_t(std::numeric_limits<T>::max()));
+    std::uintmax_t result = 0;
+    bool overflow = false;
+    int digits = 0;
+
+    for (; s != _end; ++s) {
+      if (is_digit(*s)) {
+        overflow = overflow || result > (limit - digit(*s)) / 10;
+        result = result * 10 + digit(*s);
+        ++digits;
+      }
+      else if (! (group_separator && *s == group_separator && digits
+                  && s + 1 != _end && is_digit(s[1])))
+        break;
+    }
+
+    if (decimals >= 0) {
+      int n = 0;
+      if (s != _end && *s == '.' && s + 1 != _end && is_digit(s[1]))
+        for (++s; s != _end && is_digit(*s); ++s, ++digits)
+          if (n < decimals) {
+            overflow = overflow || result > (limit - digit(*s)) / 10;
+            result = result * 10 + digit(*s);
+            ++n;
+          }
+
+      for (; n < decimals; ++n) {
+        overflow = overflow || result > limit / 10;
+        result *= 10;
+      }
+    }
+
+    if (! digits)
+      return fail(EINVAL);
+    if (overflow)
+      return fail(ERANGE);
+
+    value = (negative ? T(std::uintmax_t(0) - result) : T(result));
+    _s = s;
+    return *this;
+  }
 };
 
 #endif
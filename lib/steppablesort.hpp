@@ -0,0 +1,96 @@
+#ifndef LIB_STEPPABLE_SORT_HPP
+#define LIB_STEPPABLE_SORT_HPP
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+/**
+ * Stable sort of a vector that is done in steps of bounded work, so it can
+ * be interleaved with other work (e.g. handling user input).
+ *
+ * It is a bottom-up merge sort: Every pass merges pairs of sorted runs
+ * into a second buffer, doubling the length of the runs. step() moves at
+ * most `max_elements` elements. The vector must not be touched until step()
+ * returned false, the elements are sorted then.
+ */
+template<typename T, typename TLess = std::less<T>>
+class SteppableSort {
+public:
+  SteppableSort(TLess less = TLess())
+    : _list(NULL)
+    , _less(less)
+    , _width(0)
+    , _lo(0)
+    , _i(0)
+    , _j(0)
+    , _k(0)
+  {}
+
+  void start_sort(std::vector<T>& list) {
+    _list = &list;
+    _buffer.resize(list.size());
+    _width = 1;
+    start_run(0);
+  }
+
+  /* Returns true if there is work left */
+  bool step(size_t max_elements) {
+    if (! _list)
+      return false;
+
+    std::vector<T>& list = *_list;
+    const size_t n = list.size();
+
+    for (size_t moved = 0; _width < n && moved < max_elements; ++moved) {
+      const size_t mid = std::min(_lo + _width, n);
+      const size_t hi  = std::min(_lo + 2 * _width, n);
+
+      if (_j == hi || (_i < mid && ! _less(list[_j], list[_i])))
+        _buffer[_k++] = std::move(list[_i++]);
+      else
+        _buffer[_k++] = std::move(list[_j++]);
+
+      if (_k == hi) { // Next pair of runs, or next pass
+        if (hi == n) {
+          list.swap(_buffer);
+          _width *= 2;
+          start_run(0);
+        }
+        else
+          start_run(hi);
+      }
+    }
+
+    if (_width < n)
+      return true;
+
+    stop();
+    return false;
+  }
+
+  /* Leaves the vector partially sorted */
+  void stop() {
+    _list = NULL;
+    std::vector<T>().swap(_buffer);
+  }
+
+  bool running() const noexcept { return _list; }
+
+private:
+  std::vector<T>* _list;
+  std::vector<T> _buffer;
+  TLess _less;
+  size_t _width; // Length of the sorted runs
+  size_t _lo;    // Start of the runs being merged
+  size_t _i;     // Next element of the left run
+  size_t _j;     // Next element of the right run
+  size_t _k;     // Next position in `_buffer`
+
+  void start_run(size_t lo) noexcept {
+    _lo = _i = _k = lo;
+    _j = std::min(lo + _width, _list->size());
+  }
+};
+
+#endif
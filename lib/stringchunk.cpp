@@ -10,15 +10,23 @@ int StringChunk :: add(CString s) {
   // No check for empty string since find() will return pos `0` (the NUL byte
   // at the beginning) in that case.
 
-  const size_t pos = _data.find(s, 0, s.length() + 1);
-  if (pos != std::string::npos)
-    return pos;
+  if (_shared) {
+    const int id = find(s, 1);
+    if (id || ! s.length())
+      return id;
+  }
+  else {
+    const size_t pos = _data.find(s, 0, s.length() + 1);
+    if (pos != std::string::npos)
+      return pos;
+  }
 
   return add_unchecked(s);
 }
 
 int StringChunk :: add_unchecked(CString s) {
   if (s.length()) {
+    unshare();
     const size_t pos = _data.size();
     _data.append(s, s.length() + 1);
     return pos;
@@ -28,7 +36,14 @@ int StringChunk :: add_unchecked(CString s) {
 }
 
 int StringChunk :: find(CString s, int start_pos) const noexcept {
-  if (s.length()) {
+  if (s.length() && _shared) {
+    const char* end = _shared + _shared_size;
+    const char* str = s;
+    const char* pos = std::search(_shared + start_pos, end, str, str + s.length() + 1);
+    if (pos != end)
+      return pos - _shared;
+  }
+  else if (s.length()) {
     const size_t pos = _data.find(s, size_t(start_pos), s.length() + 1);
     if (pos != std::string::npos)
       return pos;
@@ -38,7 +53,20 @@ int StringChunk :: find(CString s, int start_pos) const noexcept {
 }
 
 int StringChunk :: count() const noexcept {
-  return std::count(_data.cbegin() + 1, _data.cend(), '\0');
+  return std::count(data() + 1, data() + size(), '\0');
+}
+
+void StringChunk :: share(const char* data, size_t size) noexcept {
+  std::string().swap(_data);
+  _shared = data;
+  _shared_size = size;
+}
+
+void StringChunk :: unshare() {
+  if (_shared) {
+    _data.assign(_shared, _shared_size);
+    _shared = NULL;
+  }
 }
 
 bool StringChunk :: is_shrinked() const noexcept {
@@ -47,8 +75,8 @@ bool StringChunk :: is_shrinked() const noexcept {
   int last_len = INT_MAX;
   int last_endChar = 0;
 
-  for (auto _c : _data) {
-    unsigned char c = static_cast<unsigned char>(_c);
+  for (const char* p = data(); p != data() + size(); ++p) {
+    unsigned char c = static_cast<unsigned char>(*p);
 
     if (c) {
       endChar = c;
@@ -79,7 +107,7 @@ bool StringChunk :: is_shrinked() const noexcept {
 
 StringChunk::Shrinker :: Shrinker(StringChunk& chunk)
 : _chunk(chunk)
-, _id_remap(_chunk._data.size())
+, _id_remap(size_t(_chunk.size()))
 , _num_ids(0)
 {
 }
@@ -99,7 +127,7 @@ void StringChunk::Shrinker :: shrink() {
   };
 
   HeapArray<IDAndLength> ids_with_length(_num_ids);
-  const char* chunk_data = _chunk._data.data();
+  const char* chunk_data = _chunk.get(0);
 
   size_t i = 0;
   for (auto& id : _id_remap) {
@@ -144,6 +172,7 @@ void StringChunk::Shrinker :: shrink() {
 
   _chunk._data = std::move(new_chunk._data);
   _chunk._data.shrink_to_fit();
+  _chunk._shared = NULL;
 }
 
 int StringChunk::Shrinker :: get_new_id(int id) {
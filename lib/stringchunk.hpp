@@ -11,7 +11,7 @@ public:
   using CString = ConstCharsLen;
 
   /* First string in the chunk is always an empty string "" with ID 0 */
-  StringChunk() : _data(1, '\0') {}
+  StringChunk() : _data(1, '\0'), _shared(NULL), _shared_size(0) {}
 
   /* Adds string `s` to the stringchunk.
    * If the string already exists in the chunk, its ID will be returned and
@@ -29,14 +29,20 @@ public:
   /* Return the number of NUL terminated strings */
   int count() const noexcept;
 
-  void        clear()           noexcept { _data.assign(1, '\0');     }
-  char const* get(int id) const noexcept { return _data.c_str() + id; }
-  int         size()      const noexcept { return _data.size();       }
-  int         capacity()  const noexcept { return _data.capacity();   }
-  void        resize(size_t n)           { _data.resize(n);  }
-  void        reserve(size_t n)          { _data.reserve(n); }
-  char*       data()            noexcept { return const_cast<char*>(_data.data()); }
-  const char* data()      const noexcept { return _data.data(); }
+  void        clear()           noexcept { _data.assign(1, '\0'); _shared = NULL; }
+  char const* get(int id) const noexcept { return data() + id; }
+  int         size()      const noexcept { return _shared ? _shared_size : _data.size();     }
+  int         capacity()  const noexcept { return _shared ? _shared_size : _data.capacity(); }
+  void        resize(size_t n)           { unshare(); _data.resize(n);  }
+  void        reserve(size_t n)          { unshare(); _data.reserve(n); }
+  char*       data()                     { unshare(); return &_data[0]; }
+  const char* data()      const noexcept { return _shared ? _shared : _data.data(); }
+
+  /* Use `data` (`size` bytes, starting with the empty string) as read-only
+   * storage without copying it. The data is copied as soon as the chunk gets
+   * modified. */
+  void        share(const char* data, size_t size) noexcept;
+  bool        shared()    const noexcept { return _shared; }
 
   struct Shrinker {
     void add(int id);
@@ -55,7 +61,10 @@ public:
 
 private:
   std::string _data;
+  const char* _shared;
+  size_t      _shared_size;
   int find(CString s, int) const noexcept;
+  void unshare();
 };
 
 #endif
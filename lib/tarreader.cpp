@@ -0,0 +1,166 @@
+#include "tarreader.hpp"
+
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+/* Field offsets of a ustar header block */
+enum {
+  NAME     = 0,   NAME_SIZE   = 100,
+  SIZE     = 124, SIZE_SIZE   = 12,
+  CHECKSUM = 148, CHECKSUM_SIZE = 8,
+  TYPE     = 156,
+  MAGIC    = 257,
+  PREFIX   = 345, PREFIX_SIZE = 155,
+};
+
+/* Numbers are octal, GNU tar uses base-256 for big ones (high bit set) */
+static bool parse_number(const char* s, size_t size, uint64_t& value) {
+  value = 0;
+  if (static_cast<unsigned char>(*s) & 0x80) {
+    value = static_cast<unsigned char>(*s) & 0x7F;
+    for (size_t i = 1; i < size; ++i)
+      value = (value << 8) | static_cast<unsigned char>(s[i]);
+    return true;
+  }
+
+  size_t i = 0;
+  while (i < size && s[i] == ' ')
+    ++i;
+  for (; i < size && s[i] >= '0' && s[i] <= '7'; ++i)
+    value = (value << 3) | uint64_t(s[i] - '0');
+  return i == size || s[i] == ' ' || s[i] == '\0';
+}
+
+static std::string field(const char* s, size_t size) {
+  return std::string(s, strnlen(s, size));
+}
+
+static bool valid_checksum(const char* block) {
+  uint64_t expected;
+  if (! parse_number(block + CHECKSUM, CHECKSUM_SIZE, expected))
+    return false;
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < TarReader::BLOCK_SIZE; ++i)
+    sum += (i >= CHECKSUM && i < CHECKSUM + CHECKSUM_SIZE) ? ' ' : static_cast<unsigned char>(block[i]);
+  return sum == expected;
+}
+
+/* Pax records: "<length> <key>=<value>\n" */
+static bool pax_path(const std::string& data, std::string& path) {
+  for (size_t pos = 0; pos < data.size();) {
+    char* end;
+    const unsigned long length = std::strtoul(data.c_str() + pos, &end, 10);
+    if (! length || pos + length > data.size())
+      return false;
+
+    const char* record = end + 1;
+    const char* record_end = data.c_str() + pos + length - 1; // Without '\n'
+    if (record_end - record > 5 && ! std::strncmp(record, "path=", 5)) {
+      path.assign(record + 5, size_t(record_end - record - 5));
+      return true;
+    }
+    pos += length;
+  }
+  return false;
+}
+
+TarReader :: TarReader(const std::string& file)
+: _fh(std::fopen(file.c_str(), "rb"))
+, _file(file)
+, _remaining(0)
+, _padding(0)
+{
+  if (! _fh)
+    throw std::runtime_error(file + ": " + std::strerror(errno));
+}
+
+TarReader :: ~TarReader() {
+  std::fclose(_fh);
+}
+
+void TarReader :: error(const char* message) const {
+  throw std::runtime_error(_file + ": " + message);
+}
+
+void TarReader :: read_block(char* buf, size_t size) {
+  if (size && std::fread(buf, 1, size, _fh) != size)
+    error(std::ferror(_fh) ? std::strerror(errno) : "Unexpected end of archive");
+}
+
+void TarReader :: skip_data() {
+  char buf[BLOCK_SIZE];
+  uint64_t n = _remaining + _padding;
+  _remaining = _padding = 0;
+  if (std::fseek(_fh, long(n), SEEK_CUR)) // Not seekable (pipe)
+    for (; n; n -= std::min(n, uint64_t(sizeof(buf))))
+      read_block(buf, size_t(std::min(n, uint64_t(sizeof(buf)))));
+}
+
+bool TarReader :: next(Entry& entry) {
+  std::string long_name;
+  char block[BLOCK_SIZE];
+
+  skip_data();
+
+  for (;;) {
+    if (std::fread(block, 1, BLOCK_SIZE, _fh) != BLOCK_SIZE) {
+      if (std::ferror(_fh))
+        error(std::strerror(errno));
+      return false; // Archive without end-of-archive blocks
+    }
+
+    bool zero = true;
+    for (char c : block)
+      zero = zero && ! c;
+    if (zero)
+      return false;
+
+    uint64_t size;
+    if (! valid_checksum(block) || ! parse_number(block + SIZE, SIZE_SIZE, size))
+      error("Invalid tar header");
+
+    _remaining = size;
+    _padding = (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE;
+
+    switch (block[TYPE]) {
+      case '0':
+      case '\0':
+      case '7': // Contiguous file
+        if (! long_name.empty())
+          entry.name = std::move(long_name);
+        else if (! std::strncmp(block + MAGIC, "ustar", 5) && block[PREFIX])
+          entry.name = field(block + PREFIX, PREFIX_SIZE) + '/' + field(block + NAME, NAME_SIZE);
+        else
+          entry.name = field(block + NAME, NAME_SIZE);
+        entry.size = size;
+        return true;
+
+      case 'L': // GNU long name for the next entry
+        read(long_name);
+        long_name.resize(strnlen(long_name.c_str(), long_name.size()));
+        break;
+
+      case 'x': { // Pax header for the next entry
+        std::string data;
+        read(data);
+        pax_path(data, long_name);
+        break;
+      }
+
+      default: // Directories, links, global pax headers ...
+        long_name.clear();
+        skip_data();
+    }
+  }
+}
+
+void TarReader :: read(std::string& data) {
+  data.resize(size_t(_remaining));
+  read_block(&data[0], data.size());
+  _remaining = 0;
+  skip_data();
+}
@@ -0,0 +1,44 @@
+#ifndef LIB_TARREADER_HPP
+#define LIB_TARREADER_HPP
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+/**
+ * Sequential reader for uncompressed tar archives (POSIX ustar, GNU, pax).
+ *
+ * next() only stops at regular files, other entries are skipped. Long names
+ * are taken from GNU 'L' entries and from the `path` of pax headers.
+ * Errors and malformed archives throw std::runtime_error.
+ */
+class TarReader {
+public:
+  enum { BLOCK_SIZE = 512 };
+
+  struct Entry {
+    std::string name;
+    uint64_t    size;
+  };
+
+  TarReader(const std::string& file);
+ ~TarReader();
+
+  /* Advances to the next regular file. Returns false at the end */
+  bool next(Entry&);
+
+  /* Reads the data of the current entry */
+  void read(std::string&);
+
+private:
+  std::FILE* _fh;
+  std::string _file;
+  uint64_t _remaining; // Unread data of the current entry
+  uint64_t _padding;   // Padding following the data
+
+  void read_block(char*, size_t);
+  void skip_data();
+  [[noreturn]] void error(const char*) const;
+};
+
+#endif
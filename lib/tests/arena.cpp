@@ -0,0 +1,110 @@
+#include <lib/arena.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <cstdint>
+
+int main() {
+  TEST_BEGIN();
+
+  { /* Test: ArenaString */
+    ArenaString empty;
+    assert(empty.empty() && empty == "");
+    empty.trim();
+    empty.truncate(0);
+    assert(empty == "");
+
+    char buf[] = "  https://a.com/b%20c/%20d/  ";
+    ArenaString s(buf, sizeof(buf) - 1);
+    s.trim();
+    assert(s == "https://a.com/b%20c/%20d/" && s.size() == 25);
+    s.replace_all("%20", ' ');
+    assert(s == "https://a.com/b c/ d/" && s.size() == 21);
+    assert(s.find("//") == 6 && s.find('/', 7) == 7 && s.find("x") == std::string::npos);
+    s.remove_prefix(8);
+    assert(s == "a.com/b c/ d/");
+    s.truncate(s.size() - 1);
+    assert(s == "a.com/b c/ d");
+    s.erase_all(" ");
+    assert(s == "a.com/bc/d" && s.size() == 10);
+    s.erase(0, 6);
+    assert(s == "bc/d" && s.back() == 'd');
+    s.trim("bd");
+    assert(s == "c/" && s.size() == 2);
+    s.trim("c/");
+    assert(s.empty() && s == "");
+  }
+
+  { /* Test: SplitInPlace */
+    char buf[] = "a,,bc,";
+    std::string joined;
+    int parts = 0;
+    for (ArenaString part : SplitInPlace(buf, sizeof(buf) - 1, ',')) {
+      assert(part.c_str()[part.size()] == '\0');
+      joined.append(part.c_str()).append("|");
+      ++parts;
+    }
+    assert(parts == 3 && joined == "a||bc|");
+    assert(streq(buf + 3, "bc"));
+
+    char last[] = "x,yz";
+    ArenaString s(last, sizeof(last) - 1);
+    SplitInPlace::iterator it = SplitInPlace(s, ',').begin();
+    assert(*it == "x");
+    assert(*++it == "yz" && (*it).size() == 2);
+
+    char empty[] = "";
+    parts = 0;
+    for (ArenaString part : SplitInPlace(empty, 0, ','))
+      parts += int(part.size()) + 1;
+    assert(parts == 0);
+  }
+
+  { /* Test: Arena */
+    Arena arena(64);
+    assert(arena.bytes_allocated() == 0);
+
+    ArenaString s = arena.copy("hello");
+    assert(s == "hello" && s.size() == 5);
+    ArenaString t = arena.copy(std::string("world"));
+    assert(t == "world" && s == "hello");
+
+    struct Pair { int a; double b; };
+    auto array = arena.allocate_array<Pair>(3);
+    assert(array.size() == 3 && array[2].a == 0 && array[2].b == 0.0);
+    assert(reinterpret_cast<uintptr_t>(array.data()) % alignof(Pair) == 0);
+
+    const int ints[] = {1, 2, 3};
+    auto copy = arena.copy(ints, 3);
+    assert(copy.size() == 3 && copy[0] == 1 && copy[2] == 3);
+    assert(arena.copy(ints, 0).empty());
+
+    // Allocations bigger than the block size get their own block
+    ArenaString big = arena.allocate_string(1000);
+    assert(big.size() == 1000 && big.c_str()[1000] == '\0');
+    assert(arena.bytes_allocated() >= 1000 + 64);
+    assert(s == "hello" && t == "world");
+
+    // reset() keeps the largest block
+    arena.reset();
+    assert(arena.bytes_used() == 0);
+    const size_t allocated = arena.bytes_allocated();
+    assert(allocated >= 1000 && allocated < 1000 + 64);
+    for (int i = 0; i < 50; ++i)
+      arena.copy("0123456789");
+    assert(arena.bytes_allocated() == allocated);
+    assert(arena.bytes_used() == 50 * 11);
+  }
+
+  { /* Test: Aligned allocation after a block that ends unaligned */
+    Arena arena(64);
+    ArenaString big = arena.allocate_string(20000);
+    auto array = arena.allocate_array<ArenaString>(3);
+    assert(reinterpret_cast<uintptr_t>(array.data()) % alignof(ArenaString) == 0);
+    for (auto& s : array)
+      s = arena.copy("x");
+    assert(big.size() == 20000 && array[2] == "x");
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,85 @@
+#include <lib/base64.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <cstdlib>
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string encode(const std::string& data) {
+  std::string result;
+  unsigned n = 0;
+  size_t i = 0;
+  for (; i + 3 <= data.size(); i += 3) {
+    n = unsigned(data[i] & 0xFF) << 16 | unsigned(data[i+1] & 0xFF) << 8 | unsigned(data[i+2] & 0xFF);
+    result.append({alphabet[n >> 18], alphabet[n >> 12 & 63], alphabet[n >> 6 & 63], alphabet[n & 63]});
+  }
+  if (data.size() - i == 1) {
+    n = unsigned(data[i] & 0xFF) << 16;
+    result.append({alphabet[n >> 18], alphabet[n >> 12 & 63], '=', '='});
+  }
+  else if (data.size() - i == 2) {
+    n = unsigned(data[i] & 0xFF) << 16 | unsigned(data[i+1] & 0xFF) << 8;
+    result.append({alphabet[n >> 18], alphabet[n >> 12 & 63], alphabet[n >> 6 & 63], '='});
+  }
+  return result;
+}
+
+// Both decoders must write the same bytes
+static std::string decode_checked(const std::string& s) {
+  std::string fast(base64::decoded_size(s.size()), '\0');
+  std::string slow(base64::decoded_size(s.size()), '\0');
+  fast.resize(base64::decode(s.data(), s.size(), &fast[0]));
+  slow.resize(base64::decode_scalar(s.data(), s.size(), &slow[0]));
+  assert(fast == slow);
+  return fast;
+}
+
+int main() {
+  TEST_BEGIN();
+
+  { /* Test: decode() */
+    assert(base64::decode(std::string("")) == "");
+    assert(base64::decode(std::string("Zg==")) == "f");
+    assert(base64::decode(std::string("Zm8=")) == "fo");
+    assert(base64::decode(std::string("Zm9v")) == "foo");
+    assert(base64::decode(std::string("Zm9vYg")) == "foob");
+    assert(base64::decode(std::string("Zm9vYmE")) == "fooba");
+    assert(base64::decode(std::string("Zm9vYmFy")) == "foobar");
+  }
+
+  { /* Test: Round trip of random data, all lengths around the block sizes */
+    std::srand(1);
+    for (size_t len = 0; len < 300; ++len)
+      for (int round = 0; round < 10; ++round) {
+        std::string data;
+        for (size_t i = 0; i < len; ++i)
+          data.push_back(char(std::rand()));
+        assert(decode_checked(encode(data)) == data);
+      }
+  }
+
+  { /* Test: Characters outside of the standard alphabet */
+    std::string s = encode(std::string(200, 'x'));
+    std::srand(2);
+    for (int round = 0; round < 1000; ++round) {
+      std::string t = s;
+      t[size_t(std::rand()) % t.size()] = "-_.,= \n\xff"[std::rand() % 8];
+      decode_checked(t);
+    }
+
+    // The URL-safe alphabet gets decoded
+    assert(decode_checked("-_-_") == decode_checked("+/+/"));
+  }
+
+  { /* Test: The decoded size is never exceeded */
+    for (size_t len = 0; len < 200; ++len) {
+      std::string s = encode(std::string(len, '\xfb'));
+      std::string out(base64::decoded_size(s.size()) + 1, '#');
+      assert(base64::decode(s.data(), s.size(), &out[0]) == len);
+      assert(out.back() == '#');
+    }
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,132 @@
+#include <lib/concurrencylimit.hpp>
+#include <lib/downloads.hpp>
+#include <lib/test.hpp>
+#include "httpserver.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <poll.h>
+
+int main() {
+  TEST_BEGIN();
+
+  ConcurrencyLimit::Options options;
+  options.min = 1;
+  options.max = 8;
+  options.initial = 1;
+  options.latency_slack = 20000;
+
+  { /* Test: additive increase up to max */
+    ConcurrencyLimit limit(options);
+    assert(limit.limit() == 1);
+    limit.success(1000);
+    assert(limit.limit() == 2);
+    limit.success(1000); // 2.5
+    limit.success(1000); // 2.9
+    assert(limit.limit() == 2);
+    limit.success(1000);
+    assert(limit.limit() == 3);
+    for (int i = 0; i < 100; ++i)
+      limit.success(1000);
+    assert(limit.limit() == 8);
+    assert(limit.base_latency() == 1000);
+  }
+
+  { /* Test: multiplicative decrease, once per round */
+    ConcurrencyLimit limit(options);
+    for (int i = 0; i < 100; ++i)
+      limit.success(1000);
+    limit.congestion();
+    assert(limit.limit() == 4);
+    for (int i = 0; i < 7; ++i) // Requests sent before the cut
+      limit.congestion();
+    assert(limit.limit() == 4);
+    limit.congestion();
+    assert(limit.limit() == 2);
+    for (int i = 0; i < 10; ++i)
+      limit.congestion();
+    assert(limit.limit() == 1);
+  }
+
+  { /* Test: slow responses */
+    ConcurrencyLimit limit(options);
+    for (int i = 0; i < 100; ++i)
+      limit.success(1000);
+    limit.success(20000); // Within the slack
+    assert(limit.limit() == 8);
+    limit.success(100000);
+    assert(limit.limit() == 7);
+  }
+
+  { /* Test: backoff */
+    ConcurrencyLimit limit(options);
+    bool jitter = false;
+    for (int attempt = 0; attempt < 20; ++attempt) {
+      const uint64_t delay = std::min(uint64_t(options.backoff_max), uint64_t(options.backoff_base) << attempt);
+      const unsigned first = limit.backoff(attempt);
+      for (int i = 0; i < 20; ++i) {
+        const unsigned ms = limit.backoff(attempt);
+        assert(ms >= delay / 2 && ms <= delay);
+        jitter = jitter || (ms != first);
+      }
+    }
+    assert(jitter);
+  }
+
+  { /* Test: against a server that injects failures and latency */
+    enum { REQUESTS = 150 };
+    std::atomic<int> requests(0);
+    HttpServer server([&](const std::string&) {
+      const int n = requests++;
+      if (n >= 50 && n < 60)
+        return HttpServer::response(503, "", "");
+      if (n >= 100 && n < 105)
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      return HttpServer::response(200, "", "OK");
+    });
+
+    ConcurrencyLimit limit(options);
+    Downloads downloads;
+    int sent = 0, done = 0, in_flight = 0;
+    int limit_before_failures = 0, limit_after_failures = 8, limit_after_latency = 8;
+
+    while (done < REQUESTS) {
+      while (in_flight < limit.limit() && sent < REQUESTS) {
+        ++sent;
+        ++in_flight;
+        downloads.add_download(new BufferDownload(server.url()), [&](Download& dl, CURLcode code) {
+          const int n = done++;
+          --in_flight;
+          if (code == CURLE_OK && dl.http_code() == 200) {
+            double first_byte = 0;
+            dl.getinfo(CURLINFO_STARTTRANSFER_TIME, first_byte);
+            limit.success(uint64_t(first_byte * 1e6));
+          }
+          else {
+            if (! limit_before_failures)
+              limit_before_failures = limit.limit();
+            limit.congestion();
+          }
+
+          if (n >= 50 && n < 100)
+            limit_after_failures = std::min(limit_after_failures, limit.limit());
+          else if (n >= 100 && n < 120)
+            limit_after_latency = std::min(limit_after_latency, limit.limit());
+          return Downloads::Remove;
+        });
+      }
+
+      pollfd pfd = {downloads.fd(), POLLIN, 0};
+      ::poll(&pfd, 1, 100);
+      downloads.work();
+    }
+
+    assert(limit_before_failures >= 4);              // Healthy server: grow
+    assert(limit_after_failures <= 2);               // Failures: back off
+    assert(limit_after_latency < limit_before_failures); // Latency: back off
+    assert(limit.limit() > limit_after_latency);     // Recovered
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,107 @@
+#include <lib/directoryindex.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+static std::string dir;
+
+static void touch(const std::string& name) {
+  std::FILE* fh = std::fopen((dir + '/' + name).c_str(), "wb");
+  assert(fh);
+  std::fclose(fh);
+}
+
+static void make_directory(const std::string& name) {
+  assert(0 == ::mkdir((dir + '/' + name).c_str(), 0755));
+}
+
+static void move(const std::string& from, const std::string& to) {
+  assert(0 == std::rename((dir + '/' + from).c_str(), (dir + '/' + to).c_str()));
+}
+
+static int leading_number(const char* name) {
+  return std::atoi(name);
+}
+
+static bool found(DirectoryIndex& index, const char* subdirectory, int key, const char* name) {
+  const std::string* file = index.find(subdirectory, key);
+  return (name ? file && *file == name : ! file);
+}
+
+int main() {
+  TEST_BEGIN();
+
+  char tmp[] = "/tmp/directoryindex.XXXXXX";
+  assert(mkdtemp(tmp));
+  dir = tmp;
+
+  make_directory("Album A");
+  touch("Album A/01 - First.mp3");
+  touch("Album A/02 - Second.mp3");
+  touch("Album A/cover.jpg");
+  make_directory("Album A/Scans");
+  touch("stray file");
+
+  DirectoryIndex index(leading_number);
+
+  { /* Test: open() reads the subdirectories */
+    assert(! index.open(dir + "/none"));
+    assert(index.open(dir));
+    assert(index.fd() >= 0 && index.directories() == 1);
+    assert(found(index, "Album A", 1, "01 - First.mp3"));
+    assert(found(index, "Album A", 2, "02 - Second.mp3"));
+    assert(found(index, "Album A", 3, NULL));
+    assert(found(index, "Album B", 1, NULL));
+    assert(found(index, "Scans", 0, NULL));
+    assert(! index.work());
+  }
+
+  { /* Test: New directories and files are picked up */
+    make_directory("Album B");
+    touch("Album B/1 - One.mp3");
+    touch("Album A/03 - Third.mp3");
+    assert(found(index, "Album B", 1, "1 - One.mp3"));
+    assert(found(index, "Album A", 3, "03 - Third.mp3"));
+    assert(index.directories() == 2);
+
+    // Extracted somewhere else and moved in
+    make_directory("Album A/Scans/Album C");
+    touch("Album A/Scans/Album C/7.mp3");
+    move("Album A/Scans/Album C", "Album C");
+    assert(found(index, "Album C", 7, "7.mp3"));
+  }
+
+  { /* Test: Removed directories and files are dropped */
+    assert(0 == ::unlink((dir + "/Album A/01 - First.mp3").c_str()));
+    assert(found(index, "Album A", 1, NULL));
+    assert(found(index, "Album A", 2, "02 - Second.mp3"));
+
+    move("Album A/02 - Second.mp3", "Album A/04 - Second.mp3");
+    assert(found(index, "Album A", 2, NULL));
+    assert(found(index, "Album A", 4, "04 - Second.mp3"));
+
+    move("Album B", "Album D");
+    assert(found(index, "Album B", 1, NULL));
+    assert(found(index, "Album D", 1, "1 - One.mp3"));
+
+    assert(0 == std::system(("rm -r '" + dir + "/Album C'").c_str()));
+    assert(found(index, "Album C", 7, NULL));
+    assert(index.directories() == 2);
+  }
+
+  { /* Test: Files sharing a key */
+    touch("Album D/01 - Other.mp3");
+    assert(index.find("Album D", 1));
+    assert(0 == ::unlink((dir + "/Album D/" + *index.find("Album D", 1)).c_str()));
+    assert(index.find("Album D", 1));
+  }
+
+  index.close();
+  assert(0 == std::system(("rm -r " + dir).c_str()));
+  TEST_END();
+}
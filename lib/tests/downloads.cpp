@@ -0,0 +1,327 @@
+#include <lib/downloads.hpp>
+#include <lib/test.hpp>
+#include "httpserver.hpp"
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include <unistd.h>
+
+static std::string header_value(const std::string& request, const char* name) {
+  size_t pos = request.find(name);
+  if (pos == std::string::npos)
+    return "";
+  pos += std::strlen(name);
+  return request.substr(pos, request.find("\r\n", pos) - pos);
+}
+
+static std::string read_file(const std::string& file) {
+  std::ifstream in(file, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static bool exists(const std::string& file) {
+  return 0 == ::access(file.c_str(), F_OK);
+}
+
+/* Stand-in for a server supporting ranges. Responses are cut off after
+ * `cut` bytes of the body, `etag` is the current version of `body`. */
+struct RangeServer {
+  std::string body = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  std::string etag = "\"v1\"";
+  std::string range, if_range;
+  size_t cut = std::string::npos;
+  bool send_206 = true;
+
+  std::string respond(const std::string& request) {
+    range    = header_value(request, "Range: bytes=");
+    if_range = header_value(request, "If-Range: ");
+
+    size_t start = 0;
+    int code = 200;
+    if (! range.empty() && (if_range == etag || send_206)) {
+      start = size_t(std::atoi(range.c_str()));
+      code = 206;
+    }
+
+    std::string head = "HTTP/1.1 " + std::to_string(code) + " X\r\n"
+      "Content-Length: " + std::to_string(body.size() - start) + "\r\n"
+      "Connection: close\r\n";
+    if (! etag.empty())
+      head += "ETag: " + etag + "\r\n";
+    if (code == 206)
+      head += "Content-Range: bytes " + std::to_string(start) + "-"
+        + std::to_string(body.size() - 1) + "/" + std::to_string(body.size()) + "\r\n";
+
+    const std::string rest = body.substr(start);
+    return head + "\r\n" + rest.substr(0, cut);
+  }
+};
+
+/* Calls work() until `done` returns true, at most for 5 seconds */
+template<class Pred>
+static bool run(Downloads& downloads, Pred done) {
+  for (int i = 0; i < 5000; ++i) {
+    if (done())
+      return true;
+    downloads.work();
+    ::usleep(1000);
+  }
+  return done();
+}
+
+int main() {
+  TEST_BEGIN();
+
+  char dir[] = "/tmp/downloads.XXXXXX";
+  assert(mkdtemp(dir));
+  const std::string file = std::string(dir) + "/file.part";
+  const std::string sidecar = file + FILEDOWNLOAD_RESUME_SUFFIX;
+
+  RangeServer rs;
+  HttpServer server([&](const std::string& request) { return rs.respond(request); });
+  const std::string url = server.url("/file");
+
+  { /* Test: An interrupted download is continued */
+    rs.cut = 20;
+    FileDownload dl1(url, file, true);
+    assert(CURLE_OK != dl1.perform());
+    assert(! dl1.finish(CURLE_PARTIAL_FILE));
+    assert(read_file(file) == rs.body.substr(0, 20));
+    assert(exists(sidecar) && FileDownload::can_resume(file));
+
+    rs.cut = 10;
+    FileDownload dl2(url, file, true);
+    assert(dl2.resumed_from() == 20);
+    assert(CURLE_OK != dl2.perform());
+    assert(rs.range == "20-" && rs.if_range == "\"v1\"");
+    assert(! dl2.finish(CURLE_PARTIAL_FILE));
+    assert(read_file(file) == rs.body.substr(0, 30));
+
+    rs.cut = std::string::npos;
+    FileDownload dl3(url, file, true);
+    assert(dl3.resumed_from() == 30);
+    CURLcode e = dl3.perform();
+    assert(CURLE_OK == e && dl3.http_code() == 206);
+    assert(dl3.finish(e));
+    assert(read_file(file) == rs.body);
+    assert(! exists(sidecar));
+  }
+
+  { /* Test: A changed resource is downloaded from the start */
+    rs.cut = 20;
+    FileDownload dl1(url, file, true);
+    dl1.perform();
+    dl1.finish(CURLE_PARTIAL_FILE);
+
+    rs.cut = std::string::npos;
+    rs.etag = "\"v2\"";
+    rs.send_206 = false;
+    rs.body = "The new version";
+    FileDownload dl2(url, file, true);
+    assert(dl2.resumed_from() == 20);
+    CURLcode e = dl2.perform();
+    assert(CURLE_OK == e && dl2.http_code() == 200);
+    assert(dl2.finish(e));
+    assert(read_file(file) == rs.body);
+  }
+
+  { /* Test: Bytes of another version are never appended */
+    rs.cut = 5;
+    FileDownload dl1(url, file, true);
+    dl1.perform();
+    dl1.finish(CURLE_PARTIAL_FILE);
+
+    rs.cut = std::string::npos;
+    rs.etag = "\"v3\"";
+    rs.send_206 = true; // Server ignores If-Range
+    FileDownload dl2(url, file, true);
+    CURLcode e = dl2.perform();
+    assert(CURLE_WRITE_ERROR == e);
+    assert(! dl2.finish(e));
+    assert(! exists(file) && ! exists(sidecar));
+  }
+
+  { /* Test: Without resume the partial file is overwritten */
+    rs.cut = 5;
+    FileDownload dl1(url, file, true);
+    dl1.perform();
+    dl1.finish(CURLE_PARTIAL_FILE);
+    assert(FileDownload::can_resume(file));
+
+    rs.cut = std::string::npos;
+    FileDownload dl2(url, file);
+    assert(dl2.resumed_from() == 0);
+    CURLcode e = dl2.perform();
+    assert(rs.range.empty() && dl2.finish(e));
+    assert(read_file(file) == rs.body);
+  }
+
+  { /* Test: on_write() gets the chunks at their offset in the file */
+    rs.cut = 7;
+    FileDownload dl1(url, file, true);
+    dl1.perform();
+    dl1.finish(CURLE_PARTIAL_FILE);
+
+    rs.cut = std::string::npos;
+    std::string written;
+    size_t first_offset = SIZE_MAX;
+    FileDownload dl2(url, file, true);
+    dl2.on_write([&](size_t offset, const char* data, size_t len) {
+      if (first_offset == SIZE_MAX)
+        first_offset = offset;
+      assert(offset == 7 + written.size());
+      assert(read_file(file).size() == offset + len); // Flushed
+      written.append(data, len);
+    });
+    CURLcode e = dl2.perform();
+    assert(dl2.finish(e));
+    assert(first_offset == 7 && written == rs.body.substr(7));
+  }
+
+  { /* Test: A response without a validator can't be resumed */
+    rs.cut = 5;
+    rs.etag = "";
+    FileDownload dl1(url, file, true);
+    dl1.perform();
+    assert(! dl1.finish(CURLE_PARTIAL_FILE));
+    assert(! exists(file) && ! exists(sidecar));
+  }
+
+  ::rmdir(dir);
+
+  { /* Test: Downloads are started by priority */
+    HttpServer server([](const std::string&) { return HttpServer::response(200, "", "x"); });
+    Downloads downloads;
+    downloads.parallel(1);
+    std::string order;
+    const auto add = [&](char name, Downloads::Priority priority) {
+      downloads.add_download(new BufferDownload(server.url()), [&order,name](Download&, CURLcode) {
+        order.push_back(name);
+        return Downloads::Remove;
+      }, priority);
+    };
+
+    add('a', Downloads::Archive);
+    add('c', Downloads::Catalog);
+    add('p', Downloads::Playback);
+    assert(downloads.queued_downloads(Downloads::Archive) == 1);
+    assert(run(downloads, [&]{ return order.size() == 3; }));
+    assert(order == "pca");
+    assert(! downloads.running_downloads() && ! downloads.queued_downloads());
+  }
+
+  { /* Test: Playback pauses the lower classes */
+    std::atomic<bool> got_archive_request(false), release(false);
+    HttpServer server([&](const std::string& request) {
+      if (request.find("/archive") != std::string::npos) {
+        got_archive_request = true;
+        while (! release)
+          ::usleep(1000);
+      }
+      return HttpServer::response(200, "", "data");
+    });
+
+    Downloads downloads;
+    std::string order;
+    const auto add = [&](const char* path, Downloads::Priority priority) {
+      downloads.add_download(new BufferDownload(server.url(path)), [&order,path](Download&, CURLcode) {
+        order += path;
+        return Downloads::Remove;
+      }, priority);
+    };
+
+    add("/archive", Downloads::Archive);
+    assert(run(downloads, [&]{ return bool(got_archive_request); }));
+    add("/track", Downloads::Playback);
+    downloads.work();
+    assert(downloads.running_downloads(Downloads::Playback) == 1);
+    for (const auto& dl : downloads.downloads())
+      assert(dl->paused == (dl->priority == Downloads::Archive));
+
+    release = true;
+    assert(run(downloads, [&]{ return order.size() == 14; }));
+    assert(order == "/track/archive");
+  }
+
+  { /* Test: priority() moves queued and running downloads */
+    std::atomic<bool> got_first_request(false), release(false);
+    HttpServer server([&](const std::string& request) {
+      if (request.find("/first") != std::string::npos) {
+        got_first_request = true;
+        while (! release)
+          ::usleep(1000);
+      }
+      return HttpServer::response(200, "", "data");
+    });
+
+    Downloads downloads;
+    std::string order;
+    const auto add = [&](const char* path) {
+      Download* download = new BufferDownload(server.url(path));
+      downloads.add_download(download, [&order,path](Download&, CURLcode) {
+        order += path;
+        return Downloads::Remove;
+      }, Downloads::Prefetch);
+      return download;
+    };
+
+    Download* first = add("/first");
+    assert(run(downloads, [&]{ return bool(got_first_request); }));
+    Download* second = add("/second");
+    downloads.work();
+    assert(downloads.queued_downloads(Downloads::Prefetch) == 1);
+
+    // Started at once, the prefetch is paused
+    downloads.priority(second, Downloads::Playback);
+    assert(downloads.queued_downloads(Downloads::Prefetch) == 0);
+    assert(downloads.running_downloads(Downloads::Playback) == 1);
+    for (const auto& dl : downloads.downloads())
+      assert(dl->paused == (dl->download.get() == first));
+
+    downloads.priority(first, Downloads::Playback);
+    assert(downloads.running_downloads(Downloads::Prefetch) == 0);
+    assert(downloads.running_downloads(Downloads::Playback) == 2);
+    for (const auto& dl : downloads.downloads())
+      assert(! dl->paused);
+
+    release = true;
+    assert(run(downloads, [&]{ return order.size() == 13; }));
+    assert(! downloads.running_downloads() && ! downloads.queued_downloads());
+  }
+
+  { /* Test: Rate limit of a class */
+    const std::string body(2000, 'x');
+    HttpServer server([&](const std::string&) { return HttpServer::response(200, "", body); });
+    Downloads downloads;
+    downloads.options(Downloads::Catalog, Downloads::Options(INT_MAX, 10000));
+
+    int finished = 0;
+    const auto add = [&]() {
+      downloads.add_download(new BufferDownload(server.url()), [&](Download&, CURLcode) {
+        ++finished;
+        return Downloads::Remove;
+      });
+    };
+
+    add();
+    assert(run(downloads, [&]{ return finished == 1; }));
+    assert(downloads.wait_time() < 0); // No running downloads
+
+    // The bucket is empty, the next download has to wait for about 200ms
+    const auto start = std::chrono::steady_clock::now();
+    add();
+    downloads.work();
+    assert(downloads.wait_time() > 0);
+    assert(run(downloads, [&]{ return finished == 2; }));
+    assert(std::chrono::steady_clock::now() - start > std::chrono::milliseconds(100));
+  }
+
+  TEST_END();
+}
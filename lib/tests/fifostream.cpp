@@ -0,0 +1,121 @@
+#include <lib/fifostream.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Appends to the file like a download does */
+struct Writer {
+  std::FILE* fh;
+  uint64_t size;
+
+  void write(FifoStream& stream, const std::string& data) {
+    assert(data.size() == std::fwrite(data.data(), 1, data.size(), fh));
+    std::fflush(fh);
+    stream.write(size, data.data(), data.size());
+    size += data.size();
+  }
+};
+
+/* Reads what is available, returns false on end of file */
+static bool read_available(int fd, std::string& out) {
+  char buffer[8192];
+  for (;;) {
+    const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+    if (n == 0)
+      return false;
+    if (n < 0)
+      return true;
+    out.append(buffer, size_t(n));
+  }
+}
+
+static bool exists(const std::string& file) {
+  return 0 == ::access(file.c_str(), F_OK);
+}
+
+int main() {
+  TEST_BEGIN();
+
+  char dir[] = "/tmp/fifostream.XXXXXX";
+  assert(mkdtemp(dir));
+  const std::string file = std::string(dir) + "/track.part";
+  const std::string fifo = std::string(dir) + "/stream";
+
+  std::string content;
+  for (int i = 0; content.size() < (3 << 20); ++i)
+    content += std::to_string(i) + ' ';
+
+  { /* Test: The stream follows the file and ends after finish() */
+    Writer writer{std::fopen(file.c_str(), "wb"), 0};
+    assert(writer.fh);
+    // Resumed download: the file already has some bytes
+    std::fwrite(content.data(), 1, 1000, writer.fh);
+    std::fflush(writer.fh);
+    writer.size = 1000;
+
+    FifoStream stream;
+    assert(! stream.open(std::string(dir) + "/none/stream", file));
+    assert(stream.open(fifo, file));
+    assert(stream.size() == 1000 && stream.delivered() == 1000);
+
+    const int reader = ::open(fifo.c_str(), O_RDONLY|O_NONBLOCK);
+    assert(reader >= 0);
+    std::string got;
+    assert(read_available(reader, got) && got == content.substr(0, 1000));
+
+    writer.write(stream, content.substr(1000, 1000));
+    assert(stream.delivered() == 2000 && ! stream.pending());
+
+    // Faster than the reader, the rest is read back from the file
+    writer.write(stream, content.substr(2000));
+    assert(stream.pending() && stream.delivered() < content.size());
+
+    stream.finish();
+    assert(stream.is_open() && stream.wait_time() < 0);
+    for (int i = 0; i < 1000 && stream.is_open(); ++i) {
+      assert(read_available(reader, got));
+      if (! stream.pending())
+        assert(stream.wait_time() == FifoStream::DRAIN_INTERVAL);
+      stream.work();
+    }
+
+    assert(! stream.is_open() && ! exists(fifo));
+    assert(! read_available(reader, got));
+    assert(got == content);
+    ::close(reader);
+    std::fclose(writer.fh);
+  }
+
+  { /* Test: A file that is started over ends the stream */
+    Writer writer{std::fopen(file.c_str(), "wb"), 0};
+    FifoStream stream;
+    assert(stream.open(fifo, file));
+    writer.write(stream, "old");
+    assert(stream.delivered() == 3);
+
+    assert(0 == ::ftruncate(fileno(writer.fh), 0));
+    std::rewind(writer.fh);
+    writer.size = 0;
+    writer.write(stream, "new");
+    assert(! stream.is_open() && ! exists(fifo));
+    std::fclose(writer.fh);
+  }
+
+  { /* Test: Without a reader the FIFO stays until close() */
+    FifoStream stream;
+    assert(stream.open(fifo, file));
+    stream.finish();
+    assert(stream.is_open() && exists(fifo));
+    stream.close();
+    assert(! exists(fifo));
+  }
+
+  assert(0 == std::system((std::string("rm -r ") + dir).c_str()));
+  TEST_END();
+}
@@ -0,0 +1,142 @@
+#include <lib/filecache.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static std::string dir;
+
+static void write_file(const std::string& name, size_t size, time_t mtime = 0) {
+  const std::string path = dir + '/' + name;
+  std::FILE* fh = std::fopen(path.c_str(), "wb");
+  assert(fh);
+  for (size_t i = 0; i < size; ++i)
+    std::fputc('x', fh);
+  std::fclose(fh);
+
+  if (mtime) {
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    assert(0 == ::utimensat(AT_FDCWD, path.c_str(), times, 0));
+  }
+}
+
+static bool exists(const std::string& name) {
+  return 0 == ::access((dir + '/' + name).c_str(), F_OK);
+}
+
+int main() {
+  TEST_BEGIN();
+
+  char tmp[] = "/tmp/filecache.XXXXXX";
+  assert(mkdtemp(tmp));
+  dir = tmp;
+
+  { /* Test: open() indexes the files with the suffix */
+    write_file("a.mp3", 100, 1000);
+    write_file("b.mp3", 100, 2000);
+    write_file("c.mp3", 100, 3000);
+    write_file("d.mp3.part", 500);
+    write_file("e.txt", 500);
+
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 0));
+    assert(cache.files() == 3 && cache.size() == 300);
+    assert(! cache.over_budget() && cache.work() == 0);
+    assert(! FileCache().open(dir + "/none", ".mp3", 0));
+  }
+
+  { /* Test: LRU evicts the oldest files, the order survives a restart */
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 200));
+    cache.access("a.mp3");
+    cache.close();
+
+    assert(cache.open(dir, ".mp3", 200));
+    assert(cache.over_budget());
+    assert(cache.work() == 1);
+    assert(exists("a.mp3") && ! exists("b.mp3") && exists("c.mp3"));
+    assert(cache.size() == 200 && ! cache.over_budget());
+  }
+
+  { /* Test: LFU evicts the least used file */
+    write_file("b.mp3", 100);
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 200, FileCache::LFU));
+    cache.add("b.mp3"); // Newest
+    cache.access("c.mp3");
+    cache.access("c.mp3");
+    cache.access("a.mp3");
+    cache.close();
+
+    // a: 2 hits, b: 1 hit, c: 2 hits
+    assert(cache.open(dir, ".mp3", 200, FileCache::LFU));
+    assert(cache.work() == 1);
+    assert(exists("a.mp3") && ! exists("b.mp3") && exists("c.mp3"));
+  }
+
+  { /* Test: Pinned files are never evicted */
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 50));
+    cache.pin("a.mp3");
+    cache.pin("c.mp3");
+    assert(cache.work() == 0 && cache.over_budget());
+    cache.unpin("c.mp3");
+    assert(cache.work() == 1);
+    assert(exists("a.mp3") && ! exists("c.mp3"));
+  }
+
+  { /* Test: Eviction is incremental, files used meanwhile are skipped */
+    for (int i = 0; i < 10; ++i)
+      write_file("f" + std::to_string(i) + ".mp3", 10, 5000 + i);
+
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 40));
+    cache.remove("a.mp3");
+    assert(! exists("a.mp3"));
+    assert(cache.files() == 10 && cache.size() == 100);
+
+    assert(cache.work(2) == 2);
+    assert(! exists("f0.mp3") && ! exists("f1.mp3"));
+    cache.access("f2.mp3");
+    assert(cache.work(3) == 3);
+    assert(exists("f2.mp3") && ! exists("f3.mp3") && ! exists("f5.mp3"));
+    assert(cache.work() == 1);
+    assert(cache.size() == 40 && cache.files() == 4);
+    assert(exists("f2.mp3") && ! exists("f6.mp3") && exists("f7.mp3"));
+
+    cache.remove("f9.mp3");
+    assert(! exists("f9.mp3") && cache.size() == 30);
+  }
+
+  { /* Test: Changes by others are picked up */
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 0));
+    assert(cache.contains("f2.mp3") && ! cache.contains("g.mp3"));
+    write_file("g.mp3", 5);
+    assert(0 == ::unlink((dir + "/f2.mp3").c_str()));
+    cache.sync();
+    assert(cache.contains("g.mp3") && ! cache.contains("f2.mp3"));
+    assert(cache.files() == 3 && cache.size() == 25);
+    cache.remove("g.mp3");
+  }
+
+  { /* Test: The log is compacted */
+    FileCache cache;
+    assert(cache.open(dir, ".mp3", 0));
+    for (int i = 0; i < 1000; ++i)
+      cache.access("f7.mp3");
+    cache.close();
+
+    struct stat st;
+    assert(0 == ::stat((dir + "/.access.log").c_str(), &st));
+    assert(st.st_size < 20 * (FileCache::LOG_COMPACT_MIN + 10));
+  }
+
+  assert(0 == std::system(("rm -r " + dir).c_str()));
+  TEST_END();
+}
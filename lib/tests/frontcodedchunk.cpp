@@ -0,0 +1,133 @@
+#include <lib/frontcodedchunk.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#define TEST_DATA \
+  {"artist-album-01", "artist-album-02", "artist-other", "b", "ba", "bab", "zzz"}
+
+int main() {
+  TEST_BEGIN();
+
+  { /* Test: behaviour of empty strings */
+    FrontCodedChunk chunk;
+    assert(0 == chunk.find("non-existent"));
+    assert(0 == chunk.add(""));
+    assert(chunk.get(0) == "");
+    assert(0 == chunk.count());
+    assert(chunk.is_shrinked());
+  }
+
+  { /* Test: strings in the tail */
+    FrontCodedChunk chunk;
+    for (auto s : TEST_DATA)
+      assert(chunk.get(chunk.add(s)) == s);
+    assert(chunk.count() == 7);
+    assert(chunk.add("ba") == chunk.find("ba"));
+    assert(! chunk.is_shrinked());
+  }
+
+  { /* Test: Builder + find() on the sorted part */
+    FrontCodedChunk chunk;
+    FrontCodedChunk::Builder builder(chunk);
+    std::vector<std::string> strings;
+    for (int i = 0; i < 1000; ++i) {
+      char buf[64];
+      std::sprintf(buf, "https://ektoplazm.com/files/artist-%03d-album-%02d.mp3", i / 10, i % 10);
+      strings.push_back(buf);
+      assert(builder.add(buf) == i + 1);
+    }
+
+    assert(chunk.count() == 1000);
+    assert(chunk.is_shrinked());
+    for (size_t i = 0; i < strings.size(); ++i) {
+      assert(chunk.get(int(i + 1)) == strings[i]);
+      assert(chunk.find(strings[i]) == int(i + 1));
+    }
+
+    assert(0 == chunk.find("https://ektoplazm.com/files/artist-000-album-0"));
+    assert(0 == chunk.find("https://ektoplazm.com/files/artist-050-album-05.mp"));
+    assert(0 == chunk.find("https://ektoplazm.com/files/artist-050-album-05.mp3x"));
+    assert(0 == chunk.find("a"));
+    assert(0 == chunk.find("z"));
+
+    // Shared prefixes are not stored again
+    assert(size_t(chunk.size()) < strings.size() * strings[0].size() / 2);
+
+    // Strings are decoded into the buffer of the caller
+    std::string first, buffer;
+    assert(chunk.get(1, first) == first.c_str());
+    for (int i = 2; i <= 100; ++i)
+      assert(streq(strings[size_t(i - 1)].c_str(), chunk.get(i, buffer)));
+    assert(first == strings[0]);
+  }
+
+  { /* Test: find() with prefixes longer than MAX_PREFIX */
+    FrontCodedChunk chunk;
+    FrontCodedChunk::Builder builder(chunk);
+    const std::string base(300, 'x');
+    std::vector<std::string> strings = {
+      base + "a", base + "b", base + "b/1", base + "b/2", base + "c", base + "cc"};
+    for (const auto& s : strings)
+      builder.add(s);
+
+    for (size_t i = 0; i < strings.size(); ++i) {
+      assert(chunk.get(int(i + 1)) == strings[i]);
+      assert(chunk.find(strings[i]) == int(i + 1));
+    }
+    assert(0 == chunk.find(base));
+    assert(0 == chunk.find(base + "b/0"));
+    assert(0 == chunk.find(base + "b/3"));
+    assert(0 == chunk.find(base + "d"));
+  }
+
+  { /* Test: Shrinker merges the tail and drops unreferenced strings */
+    FrontCodedChunk chunk;
+    std::vector<int> ids;
+    for (auto s : TEST_DATA)
+      ids.push_back(chunk.add(s));
+    int dup = chunk.add_unchecked("ba");
+
+    auto shrinker = chunk.get_shrinker();
+    for (size_t i = 0; i < ids.size(); ++i)
+      if (i != 2)
+        shrinker.add(ids[i]);
+    shrinker.add(dup);
+    shrinker.shrink();
+
+    assert(chunk.is_shrinked());
+    assert(chunk.count() == 6);
+    assert(shrinker.get_new_id(dup) == shrinker.get_new_id(ids[4]));
+    assert(0 == chunk.find("artist-other"));
+    assert(chunk.get(shrinker.get_new_id(ids[0])) == "artist-album-01");
+    assert(chunk.get(shrinker.get_new_id(ids[6])) == "zzz");
+
+    // New strings go to the tail again
+    int id = chunk.add("c");
+    assert(id > chunk.count() - 1);
+    assert(chunk.get(id) == "c");
+    assert(chunk.find("zzz") == shrinker.get_new_id(ids[6]));
+  }
+
+  { /* Test: sorted part read in place */
+    FrontCodedChunk built;
+    FrontCodedChunk::Builder builder(built);
+    for (auto s : TEST_DATA)
+      builder.add(s);
+
+    std::string data(built.sorted_data(), built.sorted_size());
+    FrontCodedChunk chunk;
+    assert(chunk.share_sorted(data.data(), data.size()));
+    assert(chunk.count() == 7);
+    assert(chunk.find("bab") == 6);
+    assert(chunk.get(3) == "artist-other");
+
+    // Truncated data is rejected
+    assert(! chunk.share_sorted(data.data(), data.size() - 1));
+    assert(chunk.count() == 0);
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,48 @@
+#include "../histogram.hpp"
+#include "../test.hpp"
+
+int main() {
+  TEST_BEGIN();
+
+  { /* Test: empty histogram */
+    Log2Histogram h;
+    assert(h.count() == 0);
+    assert(h.mean() == 0);
+    assert(h.percentile(50) == 0);
+  }
+
+  { /* Test: buckets */
+    Log2Histogram h;
+    h.add(0);
+    h.add(1);
+    h.add(2);
+    h.add(3);
+    h.add(4);
+    h.add(UINT64_MAX);
+    assert(h.bucket(0) == 1);
+    assert(h.bucket(1) == 1);
+    assert(h.bucket(2) == 2);
+    assert(h.bucket(3) == 1);
+    assert(h.bucket(64) == 1);
+    assert(h.count() == 6);
+    assert(h.max() == UINT64_MAX);
+    assert(Log2Histogram::upper_bound(0) == 0);
+    assert(Log2Histogram::upper_bound(3) == 7);
+    assert(Log2Histogram::upper_bound(64) == UINT64_MAX);
+  }
+
+  { /* Test: percentiles */
+    Log2Histogram h;
+    for (uint64_t i = 1; i <= 100; ++i)
+      h.add(i);
+    assert(h.count() == 100);
+    assert(h.sum() == 5050);
+    assert(h.mean() == 50);
+    assert(h.percentile(0) == 1);
+    assert(h.percentile(50) == 63);  // 50 is in [32, 64)
+    assert(h.percentile(90) == 100); // Capped by max()
+    assert(h.percentile(100) == 100);
+  }
+
+  TEST_END();
+}
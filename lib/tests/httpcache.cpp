@@ -0,0 +1,115 @@
+#include <lib/httpcache.hpp>
+#include <lib/test.hpp>
+#include "httpserver.hpp"
+
+#include <string>
+#include <cstdlib>
+
+#define BODY "<html>Page 1 of 417</html>"
+
+static std::string header_value(const std::string& request, const char* name) {
+  size_t pos = request.find(name);
+  if (pos == std::string::npos)
+    return "";
+  pos += std::strlen(name);
+  return request.substr(pos, request.find("\r\n", pos) - pos);
+}
+
+int main() {
+  TEST_BEGIN();
+
+  char dir[] = "/tmp/httpcache.XXXXXX";
+  assert(mkdtemp(dir));
+  HttpCache cache(dir);
+
+  { /* Test: store() + load() */
+    HttpCache::Entry entry, loaded;
+    assert(! cache.load("http://a/", loaded));
+
+    entry.etag = "\"abc\"";
+    entry.last_modified = "Mon, 01 Jan 2018 00:00:00 GMT";
+    entry.meta = "album-1\nalbum-2\n";
+    entry.body = std::string("body\nwith\0zero", 14);
+    entry.hash = HttpCache::hash(entry.body.data(), entry.body.size());
+    assert(cache.store("http://a/", entry));
+
+    assert(cache.load("http://a/", loaded));
+    assert(loaded.etag == entry.etag);
+    assert(loaded.last_modified == entry.last_modified);
+    assert(loaded.meta == entry.meta);
+    assert(loaded.hash == entry.hash);
+    assert(loaded.body.empty());
+
+    assert(cache.load("http://a/", loaded, true));
+    assert(loaded.body == entry.body);
+
+    assert(! cache.load("http://b/", loaded));
+    cache.remove("http://a/");
+    assert(! cache.load("http://a/", loaded));
+  }
+
+  { /* Test: hash() can be computed incrementally */
+    const char* s = BODY;
+    const size_t len = std::strlen(s);
+    assert(HttpCache::hash(s, len) == HttpCache::hash(s + 5, len - 5, HttpCache::hash(s, 5)));
+    assert(HttpCache::hash(s, len) != HttpCache::hash(s, len - 1));
+  }
+
+  { /* Test: revalidation against a server */
+    bool send_validators = true;
+    std::string if_none_match, if_modified_since;
+
+    HttpServer server([&](const std::string& request) {
+      if_none_match     = header_value(request, "If-None-Match: ");
+      if_modified_since = header_value(request, "If-Modified-Since: ");
+      if (! send_validators)
+        return HttpServer::response(200, "", BODY);
+      if (if_none_match == "\"v1\"")
+        return HttpServer::response(304, "ETag: \"v1\"\r\n", "");
+      return HttpServer::response(200,
+          "ETag: \"v1\"\r\nLast-Modified: Tue, 02 Jan 2018 00:00:00 GMT\r\n", BODY);
+    });
+
+    // First request is unconditional
+    HttpCache::Entry cached, response;
+    BufferDownload dl1(server.url("/page/1"));
+    HttpCache::prepare(dl1, cached, response);
+    assert(CURLE_OK == dl1.perform());
+    assert(dl1.http_code() == 200);
+    assert(if_none_match.empty() && if_modified_since.empty());
+    assert(dl1.buffer() == BODY);
+    assert(response.etag == "\"v1\"");
+    assert(response.last_modified == "Tue, 02 Jan 2018 00:00:00 GMT");
+
+    response.body = dl1.buffer();
+    response.hash = HttpCache::hash(response.body.data(), response.body.size());
+    assert(cache.store(server.url("/page/1"), response));
+
+    // Second request is conditional and gets a 304
+    assert(cache.load(server.url("/page/1"), cached));
+    HttpCache::Entry response2;
+    BufferDownload dl2(server.url("/page/1"));
+    HttpCache::prepare(dl2, cached, response2);
+    assert(CURLE_OK == dl2.perform());
+    assert(dl2.http_code() == 304);
+    assert(if_none_match == "\"v1\"");
+    assert(if_modified_since == "Tue, 02 Jan 2018 00:00:00 GMT");
+    assert(dl2.buffer().empty());
+
+    // Server without validators: unchanged content is detected by the hash
+    send_validators = false;
+    HttpCache::Entry response3;
+    BufferDownload dl3(server.url("/page/1"));
+    HttpCache::prepare(dl3, cached, response3);
+    assert(CURLE_OK == dl3.perform());
+    assert(dl3.http_code() == 200);
+    assert(response3.etag.empty());
+    assert(HttpCache::hash(dl3.buffer().data(), dl3.buffer().size()) == cached.hash);
+
+    cache.remove(server.url("/page/1"));
+  }
+
+  assert(0 == rmdir(dir));
+
+  TEST_END();
+}
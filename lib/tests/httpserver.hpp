@@ -0,0 +1,88 @@
+#ifndef LIB_TESTS_HTTPSERVER_HPP
+#define LIB_TESTS_HTTPSERVER_HPP
+
+/* Minimal HTTP server for tests.
+ *
+ * Listens on a random port on 127.0.0.1 and serves one connection at a time
+ * in a background thread. The handler receives the request head (request
+ * line and headers) and returns the complete response, which is sent before
+ * the connection is closed. */
+
+#include <string>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+class HttpServer {
+public:
+  using Handler = std::function<std::string(const std::string& request)>;
+
+  HttpServer(Handler handler)
+  : _handler(std::move(handler))
+  , _fd(::socket(AF_INET, SOCK_STREAM, 0))
+  , _port(0)
+  {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+
+    if (_fd < 0
+        || ::bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+        || ::listen(_fd, 8)
+        || ::getsockname(_fd, reinterpret_cast<sockaddr*>(&addr), &len))
+      throw std::runtime_error(std::strerror(errno));
+
+    _port = ntohs(addr.sin_port);
+    _thread = std::thread(&HttpServer::serve, this);
+  }
+
+ ~HttpServer() {
+    ::shutdown(_fd, SHUT_RDWR);
+    _thread.join();
+    ::close(_fd);
+  }
+
+  std::string url(const char* path = "/") const {
+    return "http://127.0.0.1:" + std::to_string(_port) + path;
+  }
+
+  /* Builds a response */
+  static std::string response(int code, const std::string& headers, const std::string& body) {
+    return "HTTP/1.1 " + std::to_string(code) + " X\r\n"
+      "Content-Length: " + std::to_string(body.size()) + "\r\n"
+      "Connection: close\r\n" + headers + "\r\n" + body;
+  }
+
+private:
+  Handler _handler;
+  std::thread _thread;
+  int _fd;
+  int _port;
+
+  void serve() {
+    for (int client; (client = ::accept(_fd, NULL, NULL)) >= 0; ::close(client)) {
+      std::string request;
+      char buf[4096];
+      for (ssize_t n; request.find("\r\n\r\n") == std::string::npos
+                      && (n = ::recv(client, buf, sizeof(buf), 0)) > 0;)
+        request.append(buf, size_t(n));
+
+      const std::string resp = _handler(request);
+      for (size_t sent = 0; sent < resp.size();) {
+        const ssize_t n = ::send(client, resp.data() + sent, resp.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+          break;
+        sent += size_t(n);
+      }
+    }
+  }
+};
+
+#endif
@@ -152,5 +152,20 @@ int main() {
     v.check_contents_by_iterator();
   }
 
+  { // borrow: modified in place, copied when growing
+    unsigned int storage[4] = {0, 0, 0, 0};
+    DynamicPackedVector<int> v;
+    v.borrow(storage, 16, 8);
+    v[3] = 42;
+    CHCK( storage[0] == 42u << 24 );
+    CHCK( v.borrowed() );
+
+    v.push_back(7);
+    v[3] = 43;
+    CHCK( ! v.borrowed() );
+    CHCK( v.size() == 17 && v[3] == 43 && v[16] == 7 );
+    CHCK( storage[0] == 42u << 24 );
+  }
+
   TEST_END();
 }
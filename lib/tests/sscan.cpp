@@ -1,23 +1,145 @@
 #include <lib/sscan.hpp>
 #include <lib/test.hpp>
 
-void test_myscanf(const char* s) {
-  std::intmax_t a, b, c, d;
-  SScan scanner(s);
-  scanner.strtoimax(a);
-  scanner.strtoimax(b);
-  scanner.strtoimax(c);
-  scanner.strtoimax(d);
-  assert(a == 1);
-  assert(b == 2);
-  assert(c == 3);
-  assert(d == 4);
-  assert(scanner);
-}
+#include <climits>
+
+int main() {
+  TEST_BEGIN();
+
+  { /* Test: read_int() */
+    std::intmax_t a, b, c, d;
+    SScan scanner("1 2\t3 +4");
+    scanner.read_int(a).read_int(b).read_int(c).read_int(d);
+    assert(scanner && scanner.at_end());
+    assert(a == 1 && b == 2 && c == 3 && d == 4);
+
+    int i = 0;
+    assert(SScan("-42x").read_int(i) && i == -42);
+    assert(SScan("2147483647").read_int(i) && i == INT_MAX);
+    assert(SScan("-2147483648").read_int(i) && i == INT_MIN);
+
+    short s = 0;
+    assert(SScan("-32768").read_int(s) && s == SHRT_MIN);
+    assert(SScan("32768").read_int(s).error() == ERANGE && s == SHRT_MIN);
+
+    unsigned u = 0;
+    assert(SScan("4294967295").read_int(u) && u == UINT_MAX);
+    assert(SScan("4294967296").read_int(u).error() == ERANGE);
+    assert(SScan("-1").read_int(u).error() == EINVAL);
+
+    assert(SScan("").read_int(i).error() == EINVAL);
+    assert(SScan("-").read_int(i).error() == EINVAL);
+    assert(SScan("x1").read_int(i).error() == EINVAL);
+  }
+
+  { /* Test: read_int() with a group separator */
+    int i = 0;
+    SScan scanner("1,234,567,");
+    assert(scanner.read_int(i, ',') && i == 1234567);
+    assert(scanner.length() == 1 && scanner[0] == ',');
+    assert(SScan(",1").read_int(i, ',').error() == EINVAL);
+    assert(SScan("1,234").read_int(i) && i == 1);
+  }
+
+  { /* Test: read_hex() */
+    uint64_t h = 0;
+    unsigned u = 0, v = 0;
+    SScan scanner("cbf29ce484222325 fF\t0a3");
+    assert(scanner.read_hex(h).read_hex(u).read_hex(v) && scanner.at_end());
+    assert(h == 0xcbf29ce484222325ULL && u == 0xff && v == 0xa3);
+
+    assert(SScan("ffffffff").read_hex(u) && u == UINT_MAX);
+    assert(SScan("100000000").read_hex(u).error() == ERANGE);
+    assert(SScan("12g").read_hex(u) && u == 0x12);
+    assert(SScan("").read_hex(u).error() == EINVAL);
+    assert(SScan("-1").read_hex(u).error() == EINVAL);
+    assert(SScan("x1").read_hex(u).error() == EINVAL);
+  }
+
+  { /* Test: The length bounds the input */
+    int i = 0;
+    const char s[] = "12345";
+    SScan scanner(s, 3);
+    assert(scanner.read_int(i) && i == 123 && scanner.at_end());
+    assert(scanner[0] == '\0');
+    assert(! scanner.read('4'));
+    assert(! SScan(s, 0).read_int(i));
+  }
+
+  { /* Test: A failed read stops the chain and keeps the position */
+    int a = 0, b = 0;
+    SScan scanner("1:x:2");
+    scanner.read_int(a).read(':').read_int(b).read(':').read_int(b);
+    assert(! scanner && scanner.error() == EINVAL);
+    assert(a == 1 && b == 0);
+    assert(streq(scanner.buffer(), "x:2"));
+    assert(scanner.clearError().seek(2).read_int(b) && b == 2);
+  }
+
+  { /* Test: read() + skip_until() + seek() */
+    short minutes = 0, seconds = 0;
+    SScan scanner("(4:32)");
+    assert(scanner.skip_until("0123456789").read_int(minutes).read(':').read_int(seconds));
+    assert(minutes == 4 && seconds == 32);
+    assert(scanner.read(")") && scanner.at_end());
+    assert(SScan("abc").seek(10).at_end());
+    assert(! SScan("ab").read("abc"));
+  }
+
+  { /* Test: read_fixed() */
+    int i = 0;
+    assert(SScan("2.01").read_fixed(i, 2) && i == 201);
+    assert(SScan("2.019").read_fixed(i, 2) && i == 201);
+    assert(SScan("2.5").read_fixed(i, 3) && i == 2500);
+    assert(SScan("-7").read_fixed(i, 1) && i == -70);
+    assert(SScan("456.25").read_fixed(i, 0) && i == 456);
+    SScan scanner("3. x");
+    assert(scanner.read_fixed(i, 1) && i == 30 && scanner[0] == '.');
+    assert(SScan("2147483647").read_fixed(i, 1).error() == ERANGE);
+  }
+
+  { /* Test: read_float() */
+    float f = 0;
+    assert(SScan("1.5").read_float(f) && f == 1.5f);
+    assert(SScan("-0.25").read_float(f) && f == -0.25f);
+    assert(SScan(".5").read_float(f) && f == 0.5f);
+    assert(SScan("4.56").read_float(f) && f == 4.56f);
+    assert(SScan("2e3").read_float(f) && f == 2000.0f);
+    assert(SScan("-2E-3").read_float(f) && f == -0.002f);
+    assert(SScan("0.1").read_float(f) && f == 0.1f);
+    assert(SScan("123456789012345678901234").read_float(f) && f == 123456789012345678901234.0f);
+    assert(SScan("1e39").read_float(f).error() == ERANGE);
+    assert(SScan(".").read_float(f).error() == EINVAL);
+
+    SScan scanner("7e x");
+    assert(scanner.read_float(f) && f == 7.0f && scanner[0] == 'e');
+  }
+
+  { /* Test: read_month() */
+    int month = 0;
+    assert(SScan("January").read_month(month) && month == 1);
+    assert(SScan("feb").read_month(month) && month == 2);
+    assert(SScan("SEPTEMBER").read_month(month) && month == 9);
+    assert(SScan("May 5").read_month(month) && month == 5);
+    assert(SScan("Dec.").read_month(month) && month == 12);
+    assert(SScan("Janu").read_month(month).error() == EINVAL);
+    assert(SScan("").read_month(month).error() == EINVAL);
+  }
+
+  { /* Test: days_since_epoch() */
+    assert(SScan::days_since_epoch(1970, 1, 1) == 0);
+    assert(SScan::days_since_epoch(1969, 12, 31) == -1);
+    assert(SScan::days_since_epoch(2000, 3, 1) == 11017);
+    assert(SScan::days_since_epoch(2020, 1, 5) == 18266);
+    assert(SScan::days_since_epoch(2024, 2, 29) + 1 == SScan::days_since_epoch(2024, 3, 1));
+  }
+
+  { /* Test: A date like on the browse pages */
+    int month = 0, day = 0, year = 0;
+    SScan scanner("January 5, 2020");
+    assert(scanner.read_month(month).read_int(day).read(',').read_int(year) && scanner.at_end());
+    assert(SScan::days_since_epoch(year, month, day) == 18266);
+  }
 
-int main(int, char** argv) {
-  const char* s = argv[1];
-  std::cout << s << std::endl;
-  for (int i = 0; i < 9999999; ++i)
-    test_myscanf(s);
+  TEST_END();
 }
@@ -0,0 +1,75 @@
+#include <lib/steppablesort.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+struct Item {
+  int key;
+  int position;
+};
+
+struct KeyLess {
+  bool operator()(const Item& a, const Item& b) const { return a.key < b.key; }
+};
+
+int main() {
+  TEST_BEGIN();
+
+  { /* Test: empty and single element lists are sorted right away */
+    std::vector<int> list;
+    SteppableSort<int> sort;
+    sort.start_sort(list);
+    assert(! sort.step(1) && ! sort.running());
+
+    list.push_back(42);
+    sort.start_sort(list);
+    assert(! sort.step(1) && list.size() == 1 && list[0] == 42);
+  }
+
+  { /* Test: the result equals std::stable_sort(), for any step size */
+    std::srand(1);
+    for (int n : {2, 3, 7, 16, 100, 1000, 1025})
+      for (size_t max_elements : {size_t(1), size_t(5), size_t(64), size_t(-1)}) {
+        std::vector<Item> list;
+        for (int i = 0; i < n; ++i)
+          list.push_back(Item{std::rand() % 10, i});
+
+        std::vector<Item> expected = list;
+        std::stable_sort(expected.begin(), expected.end(), KeyLess());
+
+        SteppableSort<Item, KeyLess> sort;
+        sort.start_sort(list);
+        size_t steps = 0;
+        while (sort.step(max_elements))
+          ++steps;
+
+        assert(list.size() == expected.size());
+        for (size_t i = 0; i < list.size(); ++i)
+          assert(list[i].key == expected[i].key && list[i].position == expected[i].position);
+        if (max_elements == 1) // Every pass moves all elements
+          assert(steps + 1 >= list.size());
+      }
+  }
+
+  { /* Test: stop() */
+    std::vector<int> list = {3, 2, 1};
+    SteppableSort<int> sort;
+    sort.start_sort(list);
+    assert(sort.step(1) && sort.running());
+    sort.stop();
+    assert(! sort.running() && ! sort.step(1) && list.size() == 3);
+  }
+
+  { /* Test: strings */
+    std::vector<std::string> list = {"c", "a", "b", "a"};
+    SteppableSort<std::string> sort;
+    sort.start_sort(list);
+    while (sort.step(2));
+    assert(list == std::vector<std::string>({"a", "a", "b", "c"}));
+  }
+
+  TEST_END();
+}
@@ -48,6 +48,22 @@ int main() {
     assert(chunk.is_shrinked());
   }
 
+  { /* Test: shared data is only copied on modification */
+    const char data[] = "\0foo\0bar";
+    StringChunk chunk;
+    chunk.share(data, sizeof(data));
+    assert(chunk.shared());
+    assert(streq("bar", chunk.get(chunk.add("bar"))));
+    assert(chunk.find("oo") == 2);
+    assert(chunk.count() == 2);
+    assert(chunk.shared());
+
+    int id = chunk.add("baz");
+    assert(! chunk.shared());
+    assert(streq("baz", chunk.get(id)));
+    assert(streq("foo", chunk.get(chunk.find("foo"))));
+  }
+
 #ifdef TEST_STRINGCHUNK_PERFORMANCE
   {
     StringChunk chunk;
@@ -0,0 +1,125 @@
+#include <lib/tarreader.hpp>
+#include <lib/test.hpp>
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Builds a ustar header block */
+static std::string header(const std::string& name, size_t size, char type, const char* prefix = "") {
+  std::string block(TarReader::BLOCK_SIZE, '\0');
+  std::memcpy(&block[0], name.data(), std::min(name.size(), size_t(100)));
+  std::snprintf(&block[124], 12, "%011lo", static_cast<unsigned long>(size));
+  block[156] = type;
+  std::memcpy(&block[257], "ustar", 6);
+  std::memcpy(&block[263], "00", 2);
+  std::memcpy(&block[345], prefix, std::strlen(prefix));
+
+  unsigned long sum = 0;
+  std::memset(&block[148], ' ', 8);
+  for (char c : block)
+    sum += static_cast<unsigned char>(c);
+  std::snprintf(&block[148], 8, "%06lo", sum);
+  return block;
+}
+
+static std::string entry(const std::string& name, const std::string& data, char type = '0', const char* prefix = "") {
+  std::string result = header(name, data.size(), type, prefix) + data;
+  result.resize(result.size() + (512 - data.size() % 512) % 512, '\0');
+  return result;
+}
+
+static std::string pax_record(const std::string& key, const std::string& value) {
+  const std::string record = " " + key + "=" + value + "\n";
+  size_t length = record.size() + 1;
+  while (std::to_string(length).size() + record.size() != length)
+    ++length;
+  return std::to_string(length) + record;
+}
+
+static void write_file(const char* file, const std::string& data) {
+  std::FILE* fh = std::fopen(file, "wb");
+  assert(fh);
+  assert(std::fwrite(data.data(), 1, data.size(), fh) == data.size());
+  std::fclose(fh);
+}
+
+int main() {
+  TEST_BEGIN();
+
+  char file[] = "/tmp/tarreader.XXXXXX";
+  const int fd = mkstemp(file);
+  assert(fd >= 0);
+  close(fd);
+
+  const std::string long_name = std::string(150, 'x') + "/page-1.html";
+  const std::string big(1000, 'b');
+
+  std::string archive =
+    entry("././@LongLink", long_name + '\0', 'L') +
+    entry("pages/", "", '5') +
+    entry("pages/1", "<html>1</html>") +
+    entry("pages/2", "") +
+    entry("link", "", '2') +
+    entry("././@LongLink", long_name + '\0', 'L') +
+    entry("truncated", big) +
+    entry("x", pax_record("mtime", "1") + pax_record("path", "pax/page-2.html"), 'x') +
+    entry("ignored", "pax") +
+    entry("page-3.html", "3", '\0', "prefix") +
+    std::string(1024, '\0');
+  write_file(file, archive);
+
+  { /* Test: entries */
+    TarReader tar(file);
+    TarReader::Entry e;
+    std::string data;
+
+    assert(tar.next(e));
+    assert(e.name == "pages/1" && e.size == 14);
+    tar.read(data);
+    assert(data == "<html>1</html>");
+
+    assert(tar.next(e)); // Data of empty entry
+    assert(e.name == "pages/2" && e.size == 0);
+    tar.read(data);
+    assert(data.empty());
+
+    assert(tar.next(e)); // GNU long name, data skipped without read()
+    assert(e.name == long_name && e.size == 1000);
+
+    assert(tar.next(e)); // Pax path
+    assert(e.name == "pax/page-2.html");
+    tar.read(data);
+    assert(data == "pax");
+
+    assert(tar.next(e)); // Ustar prefix
+    assert(e.name == "prefix/page-3.html");
+    tar.read(data);
+    assert(data == "3");
+
+    assert(! tar.next(e));
+  }
+
+  { /* Test: corrupt header */
+    archive[20] ^= 1;
+    write_file(file, archive);
+    TarReader tar(file);
+    TarReader::Entry e;
+    except(tar.next(e));
+  }
+
+  { /* Test: truncated archive */
+    write_file(file, entry("a", big).substr(0, 700));
+    TarReader tar(file);
+    TarReader::Entry e;
+    std::string data;
+    assert(tar.next(e));
+    except(tar.read(data));
+  }
+
+  unlink(file);
+
+  TEST_END();
+}
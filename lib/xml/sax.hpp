@@ -109,6 +109,7 @@ class Attributes {
   const xmlChar** _attrs;
 public:
   Attributes(const xmlChar** attributes) noexcept : _attrs(attributes) {}
+  Attributes(const char** attributes)    noexcept : _attrs(reinterpret_cast<const xmlChar**>(attributes)) {}
 
   Attribute get(const char* name) const noexcept {
     if (_attrs) {
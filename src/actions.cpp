@@ -85,7 +85,8 @@ PLAYLIST_PLAY:
     mainwindow->playlist.active_index(index);
     if (! mainwindow->playlist.empty() && mainwindow->playlist.active_index() >= 0) {
       auto track = mainwindow->playlist.active_item();
-      player.play(trackloader.get_file_for_track(track, false));
+      std::string file = trackloader.get_file_for_track(track, false);
+      player.play(file, trackloader.retry_file(file));
     }
     break;
 
@@ -13,20 +13,53 @@
 #include <lib/string.hpp>
 #include <lib/filesystem.hpp>
 #include <lib/cfile.hpp>
+#include <lib/tarreader.hpp>
 
 #include <libxml/xmlversion.h>
 
 #include <clocale>
 #include <csignal>
+#include <cerrno>
+#include <system_error>
+#include <algorithm>
+#include <chrono>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 
 Database::Database database;
-Updater updater(database);
+Downloads downloads;
+Updater updater(database, downloads);
 Mpg123Playback player;
-TrackLoader trackloader;
+TrackLoader trackloader(downloads);
 Views::MainWindow* mainwindow;
 
-static volatile int caught_signal;
-static void on_signal(int sig) { caught_signal = sig; }
+/* These signals are blocked and read from a signalfd by the main loop */
+static sigset_t handled_signals() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGWINCH);
+  return signals;
+}
+
+/* The database will *at least* hold this amount of data */
+static void reserve_database() {
+  database.styles.reserve(EKTOPLAZM_STYLE_COUNT);
+  database.albums.reserve(EKTOPLAZM_ALBUM_COUNT);
+  database.tracks.reserve(EKTOPLAZM_TRACK_COUNT);
+  database.chunk_meta.reserve(EKTOPLAZM_META_SIZE);
+  database.chunk_desc.reserve(EKTOPLAZM_DESC_SIZE);
+  database.chunk_cover_url.reserve(EKTOPLAZM_COVER_URL_SIZE);
+  database.chunk_album_url.reserve(EKTOPLAZM_ALBUM_URL_SIZE);
+  database.chunk_track_url.reserve(EKTOPLAZM_TRACK_URL_SIZE);
+  database.chunk_style_url.reserve(EKTOPLAZM_STYLE_URL_SIZE);
+  database.chunk_archive_url.reserve(EKTOPLAZM_ARCHIVE_URL_SIZE);
+}
 
 class Application {
 public:
@@ -37,10 +70,16 @@ public:
 
 private:
   void print_db_stats();
+  bool attach_shared_database();
+  void publish_shared_database();
   void delete_stale_download_files();
+  void renumber_records(Views::MainWindow&, Database::Tracks::Track&);
+
+  int _signal_fd;
 };
 
 Application :: Application()
+: _signal_fd(-1)
 {
   init();
 }
@@ -50,14 +89,27 @@ Application :: ~Application() {
   delete_stale_download_files();
 
   try {
-    // Write unoptimized database just in case shrink() fails
-    database.save(Config::database_file);
-    database.shrink_to_fit();
-    database.save(Config::database_file);
+    // An attached database is the snapshot of another instance, changes made
+    // to it are not saved
+    if (! database.attached()) {
+      // Deleted rows are not saved, so finish the compaction first
+      database.compaction.finish();
+
+      // Write unoptimized database just in case shrink() fails
+      database.save(Config::database_file);
+      database.shrink_to_fit();
+      // Publish before saving, so the database file stays newer than our own
+      // snapshot (see attach_shared_database())
+      publish_shared_database();
+      database.save(Config::database_file);
+    }
   } catch (const std::exception& e) {
     pprintf("Error saving database to file: %s\n", e);
   }
 
+  if (_signal_fd >= 0)
+    ::close(_signal_fd);
+
   log_write("Terminated gracefully.\n");
 }
 
@@ -85,7 +137,6 @@ void Application :: init() {
     ::wresize(stdscr, 1, 1); // Save some bytes...
 
     Config::init();
-    updater.downloads().parallel(10);
 
     e = "Error while reading configuration file";
     if (fs::exists(Ektoplayer::config_file()))
@@ -98,34 +149,47 @@ void Application :: init() {
     if (! fs::is_directory(Config::cache_dir))
       fs::create_directory(Config::cache_dir);
 
+    e = "Could not create page cache directory";
+    fs::create_directories(fs::path(Config::cache_dir) / "pages");
+    updater.use_cache(Config::cache_dir + "/pages");
+    trackloader.cache().open(Config::cache_dir, ".mp3", uint64_t(std::max(Config::track_cache_size, 0)) << 20,
+                             FileCache::Policy(Config::track_cache_policy));
+
     e = "Could not create album_dir";
     if (! fs::is_directory(Config::album_dir))
       fs::create_directory(Config::album_dir);
+    trackloader.albums().open(Config::album_dir);
 
     e = "Could not create archive_dir";
     if (! fs::is_directory(Config::archive_dir))
       fs::create_directory(Config::archive_dir);
 
+    if (Config::archive_rate_limit > 0) {
+      Downloads::Options archives = downloads.options(Downloads::Archive);
+      archives.max_rate = uint64_t(Config::archive_rate_limit) * 1024;
+      downloads.options(Downloads::Archive, archives);
+    }
+
+    e = "Could not create signalfd";
+    const sigset_t signals = handled_signals();
+    _signal_fd = ::signalfd(-1, &signals, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (_signal_fd < 0)
+      throw std::system_error(errno, std::generic_category());
+
     e = "Error opening log file";
     CFile::stderr().reopen(Config::log_file, "a");
     CFile::stderr().setlinebuf();
 
     e = "Error reading database file. Try again, then delete it. Sorry!";
-    if (fs::exists(Config::database_file))
+    if (attach_shared_database()) {
+      log_write("Attached to shared database %s\n", Config::shared_database_file);
+    }
+    else if (fs::exists(Config::database_file)) {
       database.load(Config::database_file);
-    else {
-      // The database will *at least* hold this amount of data
-      database.styles.reserve(EKTOPLAZM_STYLE_COUNT);
-      database.albums.reserve(EKTOPLAZM_ALBUM_COUNT);
-      database.tracks.reserve(EKTOPLAZM_TRACK_COUNT);
-      database.chunk_meta.reserve(EKTOPLAZM_META_SIZE);
-      database.chunk_desc.reserve(EKTOPLAZM_DESC_SIZE);
-      database.chunk_cover_url.reserve(EKTOPLAZM_COVER_URL_SIZE);
-      database.chunk_album_url.reserve(EKTOPLAZM_ALBUM_URL_SIZE);
-      database.chunk_track_url.reserve(EKTOPLAZM_TRACK_URL_SIZE);
-      database.chunk_style_url.reserve(EKTOPLAZM_STYLE_URL_SIZE);
-      database.chunk_archive_url.reserve(EKTOPLAZM_ARCHIVE_URL_SIZE);
+      publish_shared_database();
     }
+    else
+      reserve_database();
 
     if (Config::use_colors < 0)
       Config::use_colors = COLORS;
@@ -140,18 +204,38 @@ void Application :: init() {
 void Application :: run() {
   print_db_stats();
 
-  if (database.tracks.size() < 1000)
-    updater.start();
-  else if (Config::small_update_pages > 0)
-    updater.start(Config::small_update_pages);
+  // Updating an attached database is up to the instance that published it
+  if (! database.attached()) {
+    if (database.tracks.size() < 1000)
+      updater.start();
+    else if (Config::small_update_pages > 0)
+      updater.start(Config::small_update_pages, Updater::Incremental);
+  }
 
   Views::MainWindow mainwindow;
   ::mainwindow = &mainwindow;
 
   int key;
+  int poll_timeout;
   WINDOW *win;
   MEVENT mouse;
+  winsize ws;
+  signalfd_siginfo siginfo;
   Database::Tracks::Track prefetching_track;
+  unsigned compaction_generation = database.compaction.generation();
+  std::chrono::steady_clock::time_point info_drawn;
+  bool info_shows_update = false;
+
+  // Everything the main loop waits for
+  enum { STDIN, SIGNALS, PLAYER_STDOUT, PLAYER_STDERR, DOWNLOADS, UPDATER, STREAM, NFDS };
+  pollfd fds[NFDS];
+  fds[STDIN].fd     = STDIN_FILENO;
+  fds[SIGNALS].fd   = _signal_fd;
+  fds[DOWNLOADS].fd = downloads.fd();
+  fds[UPDATER].fd   = updater.fd();
+  for (auto& pfd : fds)
+    pfd.events = POLLIN;
+  fds[STREAM].events = POLLOUT;
 
   mainwindow.playlist.playlist = database.get_tracks();
 
@@ -160,13 +244,16 @@ WINDOW_RESIZE:
   mainwindow.draw();
 
 MAINLOOP:
-  switch (caught_signal) {
-    case SIGINT:
-    case SIGTERM:
-      return;
-    case SIGWINCH:
-      caught_signal = 0;
-      goto WINDOW_RESIZE;
+  while (sizeof(siginfo) == ::read(_signal_fd, &siginfo, sizeof(siginfo))) {
+    switch (siginfo.ssi_signo) {
+      case SIGINT:
+      case SIGTERM:
+        return;
+      case SIGWINCH:
+        if (! ::ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws))
+          ::resize_term(ws.ws_row, ws.ws_col);
+        goto WINDOW_RESIZE;
+    }
   }
 
   player.work();
@@ -181,7 +268,7 @@ MAINLOOP:
     auto list = mainwindow.playlist.list();
     auto next_track = (*list)[size_t(mainwindow.playlist.active_index() + 1) % list->size()];
     if (next_track != prefetching_track) {
-      trackloader.get_file_for_track(next_track);
+      trackloader.get_file_for_track(next_track, false, Downloads::Prefetch);
       prefetching_track = next_track;
     }
   }
@@ -189,6 +276,54 @@ MAINLOOP:
   if (player.is_track_completed())
     Actions::call(Actions::PLAYLIST_NEXT);
 
+  downloads.work();
+
+  // Feed the player with the part of the track that it didn't get yet
+  trackloader.stream().work();
+
+  // Delete the tracks that exceed track_cache_size, a few per iteration
+  const bool evicted = trackloader.cache().work();
+
+  // Insert the albums parsed by the updater since the last iteration
+  updater.work();
+
+  // Sleep no longer than the components allow
+  poll_timeout = player.wait_time();
+  if (updater.wait_time() >= 0 && (poll_timeout < 0 || updater.wait_time() < poll_timeout))
+    poll_timeout = updater.wait_time();
+  if (downloads.wait_time() >= 0 && (poll_timeout < 0 || downloads.wait_time() < poll_timeout))
+    poll_timeout = downloads.wait_time();
+  if (trackloader.stream().wait_time() >= 0 && (poll_timeout < 0 || trackloader.stream().wait_time() < poll_timeout))
+    poll_timeout = trackloader.stream().wait_time();
+  if (evicted)
+    poll_timeout = 0;
+
+  // Compact the database in small steps, but only while it is not modified
+  if (! updater.busy()) {
+    database.compaction.start();
+    database.compaction.step(2000);
+    if (compaction_generation != database.compaction.generation()) {
+      compaction_generation = database.compaction.generation();
+      renumber_records(mainwindow, prefetching_track);
+    }
+    if (database.compaction.running())
+      poll_timeout = 0; // Continue compacting if the user does not hit a key
+  }
+
+  // Redraw the update statistics about once a second, and once more when it is done
+  if ((updater.busy() || info_shows_update) && mainwindow.windows.current_widget() == &mainwindow.info) {
+    const auto now = std::chrono::steady_clock::now();
+    int since_drawn = int(std::chrono::duration_cast<std::chrono::milliseconds>(now - info_drawn).count());
+    if (since_drawn >= 1000 || ! updater.busy()) {
+      mainwindow.info.draw();
+      info_drawn = now;
+      info_shows_update = updater.busy();
+      since_drawn = 0;
+    }
+    if (updater.busy() && (poll_timeout < 0 || 1000 - since_drawn < poll_timeout))
+      poll_timeout = 1000 - since_drawn;
+  }
+
   mainwindow.progressBar.percent(player.percent());
   mainwindow.infoLine.set_position_and_length(player.position(), player.length());
   mainwindow.infoLine.state(player.state());
@@ -199,47 +334,73 @@ MAINLOOP:
   mainwindow.noutrefresh();
   doupdate();
 
-  win = mainwindow.getWINDOW();
-  if (! win)
-    win = stdscr;
-
-  // Do as much download work as possible, be only interrupted by the user
-  wtimeout(win, 0);
-  while (trackloader.downloads().work() || updater.downloads().work()) {
-    if (((key = wgetch(win)) != ERR))
-      goto HANDLE_KEY;
-  }
-
-  if (trackloader.downloads().running_downloads() || trackloader.downloads().queued_downloads()
-      ||  updater.downloads().running_downloads() || updater.downloads().queued_downloads())
-    wtimeout(win, 100); // Short timeout, want to continue downloading soon
-  else if (player.is_stopped() || player.is_paused())
-    wtimeout(win, -1);  // We have *nothing* to do, wait until user hits a key
-  else
-    wtimeout(win, 900); // In playing state we need some UI refreshes
-
-  key = wgetch(win);
-HANDLE_KEY:
-  switch (key) {
-    case ERR:
-      break;
-    case KEY_MOUSE:
-      if (OK == getmouse(&mouse))
-        mainwindow.handle_mouse(mouse);
-      break;
-    default:
-      mainwindow.handle_key(key);
+  // Sleep until there is something to do
+  fds[PLAYER_STDOUT].fd = player.stdout_fd(); // Negative descriptors are ignored
+  fds[PLAYER_STDERR].fd = player.stderr_fd();
+  fds[STREAM].fd = (trackloader.stream().pending() ? trackloader.stream().fd() : -1);
+  if (::poll(fds, NFDS, poll_timeout) < 0 && errno != EINTR)
+    throw std::system_error(errno, std::generic_category(), "poll()");
+
+  if (fds[STDIN].revents & (POLLHUP|POLLERR|POLLNVAL))
+    return; // Lost the terminal
+
+  if (fds[STDIN].revents & POLLIN) {
+    win = mainwindow.getWINDOW();
+    if (! win)
+      win = stdscr;
+
+    wtimeout(win, 0);
+    while ((key = wgetch(win)) != ERR) {
+      if (key == KEY_MOUSE) {
+        if (OK == getmouse(&mouse))
+          mainwindow.handle_mouse(mouse);
+      }
+      else
+        mainwindow.handle_key(key);
+    }
   }
 
   goto MAINLOOP;
 }
 
+/* Partial downloads that can be resumed are kept */
 void Application :: delete_stale_download_files() {
   Filesystem::error_code e;
   for (auto dir : {&Config::cache_dir, &Config::archive_dir})
-    for (const auto& f : Filesystem::directory_iterator(*dir, e))
-      if (ends_with(f.path().filename(), EKTOPLAZM_DOWNLOAD_SUFFIX))
+    for (const auto& f : Filesystem::directory_iterator(*dir, e)) {
+      const std::string file = f.path().string();
+      if (ends_with(file, EKTOPLAZM_DOWNLOAD_SUFFIX) && ! FileDownload::can_resume(file))
+        Filesystem::remove(f, e);
+      else if (ends_with(file, EKTOPLAZM_DOWNLOAD_SUFFIX FILEDOWNLOAD_RESUME_SUFFIX)
+               && ! Filesystem::exists(file.substr(0, file.size() - std::strlen(FILEDOWNLOAD_RESUME_SUFFIX)), e))
         Filesystem::remove(f, e);
+    }
+}
+
+/* Records hold row IDs, which have been changed by the database compaction */
+void Application :: renumber_records(Views::MainWindow& mainwindow, Database::Tracks::Track& prefetching_track) {
+  auto& playlist = mainwindow.playlist.playlist;
+  int active_index = mainwindow.playlist.active_index();
+  int new_active_index = -1;
+  size_t n = 0;
+
+  for (size_t i = 0; i < playlist.size(); ++i) {
+    auto track = Database::renumbered(playlist[i]);
+    if (track) {
+      if (int(i) == active_index)
+        new_active_index = int(n);
+      playlist[n++] = track;
+    }
+  }
+
+  playlist.resize(n);
+  mainwindow.playlist.active_index(new_active_index);
+  mainwindow.browser.fill_list();
+  prefetching_track = Database::renumbered(prefetching_track);
+  // A deleted track is renumbered to 0, which clears the views
+  mainwindow.infoLine.track(Database::renumbered(mainwindow.infoLine.track()));
+  mainwindow.info.track(Database::renumbered(mainwindow.info.track()));
+  mainwindow.info.draw();
 }
 
 void Application :: print_db_stats() {
@@ -254,11 +415,190 @@ void Application :: print_db_stats() {
   }
 }
 
-int main() try {
+/* A snapshot is only used if it is at least as new as our own database file.
+ * Otherwise we load our file and become the publisher. */
+bool Application :: attach_shared_database() {
+  const std::string& file = Config::shared_database_file;
+  struct stat snapshot, own;
+
+  if (file.empty() || ::stat(file.c_str(), &snapshot))
+    return false;
+
+  if (! ::stat(Config::database_file.c_str(), &own) &&
+      (own.st_mtim.tv_sec > snapshot.st_mtim.tv_sec ||
+       (own.st_mtim.tv_sec == snapshot.st_mtim.tv_sec && own.st_mtim.tv_nsec > snapshot.st_mtim.tv_nsec)))
+    return false;
+
+  try {
+    database.attach(file);
+    return true;
+  } catch (const std::exception& e) {
+    log_write("Could not attach to shared database %s: %s\n", file, e);
+    return false;
+  }
+}
+
+void Application :: publish_shared_database() {
+  if (Config::shared_database_file.empty())
+    return;
+
+  try {
+    database.publish(Config::shared_database_file);
+  } catch (const std::exception& e) {
+    log_write("Could not publish shared database %s: %s\n", Config::shared_database_file, e);
+  }
+}
+
+/* ============================================================================
+ * Offline import of saved browse pages (--import-dir, --import-archive)
+ * ==========================================================================*/
+
+// Pages handed to the updater but not inserted yet. Bounds the memory used
+// by page sources and parsed albums.
+enum { IMPORT_QUEUE_SIZE = 16 };
+
+/* Inserts parsed albums until the updater takes more pages, or until it is
+ * idle if `drain` is set */
+static void import_wait(bool drain) {
+  while (drain ? updater.busy() : updater.pages_in_flight() >= IMPORT_QUEUE_SIZE) {
+    if (! updater.work()) {
+      pollfd fd = { updater.fd(), POLLIN, 0 };
+      ::poll(&fd, 1, 100);
+    }
+  }
+}
+
+static void import_page(std::string& source, uint64_t& bytes, int& pages) {
+  import_wait(false);
+  bytes += source.size();
+  ++pages;
+  if (! updater.import_page(std::move(source)))
+    throw std::runtime_error("Could not start the parser threads");
+  source.clear();
+}
+
+static void read_file(const Filesystem::path& file, std::string& data) {
+  CFile fh = CFile::open(file.string(), "rb");
+  char buf[64 * 1024];
+  data.clear();
+  for (size_t n; (n = fh.read(buf, 1, sizeof(buf))) > 0;)
+    data.append(buf, n);
+}
+
+/* Files are imported in natural order (page 2 before page 10) */
+static bool natural_less(const Filesystem::path& a, const Filesystem::path& b) {
+  const std::string sa = a.string(), sb = b.string();
+  return sa.size() != sb.size() ? sa.size() < sb.size() : sa < sb;
+}
+
+static int import(int argc, char** argv) {
+  namespace fs = Filesystem;
+  const char* dir = NULL;
+  const char* archive = NULL;
+  const char* database_file = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && ! std::strcmp(argv[i], "--import-dir"))
+      dir = argv[++i];
+    else if (i + 1 < argc && ! std::strcmp(argv[i], "--import-archive"))
+      archive = argv[++i];
+    else if (i + 1 < argc && ! std::strcmp(argv[i], "--database"))
+      database_file = argv[++i];
+    else
+      dir = archive = NULL, i = argc;
+  }
+
+  if (! dir == ! archive) {
+    std::fprintf(stderr,
+        "Usage: %s --import-dir DIR|--import-archive TAR [--database FILE]\n"
+        "Builds the database from saved browse pages, without network access.\n"
+        "       %s --memory-stats [FILE]\n"
+        "Prints the memory statistics of the database as JSON.\n",
+        argv[0], argv[0]);
+    return 1;
+  }
+
+  Config::init();
+  if (fs::exists(Ektoplayer::config_file()))
+    Config::read(Ektoplayer::config_file().c_str());
+  const std::string file = (database_file ? database_file : Config::database_file);
+
+  if (fs::exists(file))
+    database.load(file);
+  else
+    reserve_database();
+
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t bytes = 0;
+  int pages = 0;
+  std::string source;
+
+  if (dir) {
+    std::vector<fs::path> files;
+    for (const auto& f : fs::directory_iterator(dir))
+      if (fs::is_regular_file(f.path()))
+        files.push_back(f.path());
+    std::sort(files.begin(), files.end(), natural_less);
+
+    for (const auto& f : files) {
+      read_file(f, source);
+      import_page(source, bytes, pages);
+    }
+  }
+  else {
+    TarReader tar(archive);
+    TarReader::Entry entry;
+    while (tar.next(entry)) {
+      tar.read(source);
+      import_page(source, bytes, pages);
+    }
+  }
+
+  import_wait(true);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  database.shrink_to_fit();
+  database.save(file);
+
+  const UpdaterStats stats = updater.stats();
+  std::printf(
+      "Imported %d pages (%.1f MB) in %.2fs: %.1f MB/s, %.1f pages/s\n"
+      "Albums: %d new, %d updated, %d unchanged\n"
+      "Parse time: %s\n"
+      "Insert time: %s\n"
+      "Saved %zu albums and %zu tracks to %s\n",
+      pages, double(bytes) / 1e6, seconds,
+      double(bytes) / 1e6 / std::max(seconds, 1e-6), pages / std::max(seconds, 1e-6),
+      stats.albums_new, stats.albums_updated, stats.albums_unchanged,
+      UpdaterStats::to_string(stats.parse_time, "us").c_str(),
+      UpdaterStats::to_string(stats.insert_time, "us").c_str(),
+      database.albums.size(), database.tracks.size(), file.c_str());
+  return 0;
+}
+
+/* The memory statistics are collected on demand only, they take a while */
+static int print_memory_stats(int argc, char** argv) {
+  Config::init();
+  if (Filesystem::exists(Ektoplayer::config_file()))
+    Config::read(Ektoplayer::config_file().c_str());
+
+  database.load(argc > 2 ? argv[2] : Config::database_file);
+  std::printf("%s\n", database.memory_stats().to_json().c_str());
+  return 0;
+}
+
+int main(int argc, char** argv) try {
   LIBXML_TEST_VERSION;
-  std::signal(SIGINT, on_signal);
-  std::signal(SIGTERM, on_signal);
-  std::signal(SIGWINCH, on_signal);
+
+  if (argc > 1 && ! std::strcmp(argv[1], "--memory-stats"))
+    return print_memory_stats(argc, argv);
+  if (argc > 1)
+    return import(argc, argv);
+
+  // Block the signals before any thread is started, so they all inherit the
+  // mask and the signals can only be received by the signalfd
+  const sigset_t signals = handled_signals();
+  ::sigprocmask(SIG_BLOCK, &signals, NULL);
 
 #ifndef NDEBUG
   log_write("Running a DEBUG build!\n");
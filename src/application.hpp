@@ -6,8 +6,10 @@ namespace Views    { class MainWindow; }
 class Mpg123Playback;
 class TrackLoader;
 class Updater;
+class Downloads;
 
 extern Database::Database   database;
+extern Downloads            downloads;
 extern Mpg123Playback       player;
 extern Updater              updater;
 extern TrackLoader          trackloader;
@@ -6,12 +6,19 @@
 #include <lib/sscan.hpp>
 #include <lib/string.hpp>
 #include <lib/stringpack.hpp>
+#include <lib/xml/sax.hpp>
 
 #include <cctype>
+#include <cstring>
 #include <string>
+#include <stdexcept>
 
 #ifndef NDEBUG
 #include <iostream>
+inline std::ostream& operator<<(std::ostream& o, const ArenaString& s) {
+  return o << s.c_str();
+}
+
 inline std::ostream& operator<<(std::ostream& o, const Style& s) {
   return o << s.url << '|' << s.name;
 }
@@ -47,218 +54,380 @@ inline std::ostream& operator<<(std::ostream& o, const Album& a) {
 }
 #endif
 
-static void fix_album_data(Album& album);
-static inline const char* safe_str(const char* s) { return (s ? s : ""); }
+static void fix_album_data(Album& album, Arena& arena);
 
-struct XPathExpressionCache {
-  struct {
-    size_t len;
-    const char* str;
-    xmlXPathCompExprPtr compExpr;
-  } Entries[13];
+static std::time_t parse_date(const std::string& s) {
+  // "January 5, 2020"
+  int month, day, year;
+  if (SScan(s).read_month(month).read_int(day).read(',').read_int(year))
+    return std::time_t(SScan::days_since_epoch(year, month, day)) * 24 * 60 * 60;
+  return 0;
+}
 
-  XPathExpressionCache() : Entries() {}
+static htmlSAXHandler make_sax_handler() {
+  htmlSAXHandler handler = {};
+  handler.startElement = Xml::Sax::wrap_startElement<BrowsePageParser>;
+  handler.endElement   = Xml::Sax::wrap_endElement<BrowsePageParser>;
+  handler.characters   = Xml::Sax::wrap_characters<BrowsePageParser>;
+  handler.cdataBlock   = Xml::Sax::wrap_characters<BrowsePageParser>; // <script>
+  return handler;
+}
 
-  template<size_t N>
-  inline xmlXPathCompExprPtr operator[](const char (&s)[N]) { return get(s, N); }
+BrowsePageParser :: BrowsePageParser(AlbumCallback callback)
+: _ctxt(NULL)
+, _callback(std::move(callback))
+, _markdown(_description)
+, _num_captures(0)
+, _num_pages(0)
+, _depth(0)
+, _rating_strongs(0)
+, _post_depth(0)
+, _h1_depth(0)
+, _meta_depth(0)
+, _rated_depth(0)
+, _dc_depth(0)
+, _style_depth(0)
+, _dll_depth(0)
+, _tl_depth(0)
+, _desc_depth(0)
+, _have_date(false)
+, _have_title(false)
+, _have_downloads(false)
+, _have_description(false)
+, _track_open(false)
+, _track_numbered(false)
+{
+  static htmlSAXHandler handler = make_sax_handler();
+  _ctxt = ::htmlCreatePushParserCtxt(&handler, this, NULL, 0, NULL, XML_CHAR_ENCODING_NONE);
+  if (! _ctxt)
+    throw std::runtime_error("htmlCreatePushParserCtxt()");
+
+  ::htmlCtxtUseOptions(_ctxt,
+    HTML_PARSE_RECOVER|HTML_PARSE_NOERROR|HTML_PARSE_NOWARNING|HTML_PARSE_NONET|HTML_PARSE_NOBLANKS);
+  _captures.resize(4);
+}
+
+BrowsePageParser :: ~BrowsePageParser() {
+  ::htmlFreeParserCtxt(_ctxt);
+}
+
+void BrowsePageParser :: parse_chunk(const char* data, size_t size, bool finish) {
+  ::htmlParseChunk(_ctxt, data, int(size), finish);
+}
 
-  xmlXPathCompExprPtr get(const char* expr, size_t len) {
-    for (auto& e : Entries)
-      if (! e.compExpr) {
-        e.len = len;
-        e.str = expr;
-        return (e.compExpr = xmlXPathCompile(reinterpret_cast<const xmlChar*>(expr)));
+void BrowsePageParser :: startElement(const char* name, const char** attrs) {
+  ++_depth;
+
+  Xml::Sax::Attributes attributes(attrs);
+  const auto cls = attributes["class"].value;
+
+  // Everything inside of the description is converted to markdown
+  if (_desc_depth)
+    _markdown.startElement(name, attrs);
+
+  using pack = StringPack::Raw;
+  switch (pack(name)) {
+  case pack("div"):
+    if (cls == "post")
+      begin_album();
+    else if (_post_depth && ! _tl_depth && cls == "tl") {
+      _tl_depth = _depth;
+      _track_open = false;
+    }
+    break;
+
+  case pack("span"):
+    if (! _post_depth) {
+      // <span class='pages'>Page 1 of 31</span>
+      if (! _num_pages && cls == "pages")
+        begin_capture(PAGES, true);
+    }
+    else if (_tl_depth) {
+      switch (pack(static_cast<const char*>(cls))) {
+      case pack("n"): begin_capture(TRACK_NUMBER); break;
+      case pack("t"): begin_capture(TRACK_TITLE);  break;
+      case pack("r"): begin_capture(TRACK_REMIX);  break;
+      case pack("a"): begin_capture(TRACK_ARTIST); break;
+      case pack("d"): begin_capture(TRACK_INFO);   break;
       }
-      else if (e.len == len && !std::strcmp(e.str, expr))
-        return e.compExpr;
+    }
+    else {
+      switch (pack(static_cast<const char*>(cls))) {
+      case pack("d"):
+        if (! _have_date) {
+          _have_date = true;
+          begin_capture(DATE, true);
+        }
+        // <span class="d">Rated <strong>89.10%</strong> with <strong>189</strong>
+        if (_meta_depth && ! _rated_depth)
+          _rated_depth = _depth;
+        break;
+      case pack("dc"):    if (! _dc_depth)    _dc_depth = _depth;    break;
+      case pack("style"): if (! _style_depth) _style_depth = _depth; break;
+      case pack("dll"):   if (! _dll_depth)   _dll_depth = _depth;   break;
+      }
+    }
+    break;
 
-    assert(!"Not reached");
-    return NULL;
-  }
-};
+  case pack("strong"):
+    if (_rated_depth)
+      begin_capture(RATING);
+    else if (_dc_depth && ! _have_downloads) {
+      _have_downloads = true;
+      begin_capture(DOWNLOADS);
+    }
+    break;
 
-XPathExpressionCache cache;
+  case pack("a"):
+    if (! _post_depth)
+      break;
+    else if (_style_depth) {
+      _style_url = attributes["href"].value;
+      begin_capture(STYLE);
+    }
+    else if (_dll_depth) {
+      // <span class="dll"><a href="...zip">MP3 Download</a>
+      const char* href = attributes["href"].value;
+      if (*href)
+        _archive_urls.push_back(_arena.copy(href));
+    }
+    else if (_h1_depth && _h1_depth == _depth - 1 && ! _have_title) {
+      _have_title = true;
+      _album.url = _arena.copy(attributes["href"].value);
+      begin_capture(TITLE);
+    }
+    break;
 
-BrowsePageParser :: BrowsePageParser(const std::string& source)
-: doc(Html::readDoc(source, NULL, NULL,
-    HTML_PARSE_RECOVER|HTML_PARSE_NOERROR|HTML_PARSE_NOWARNING|HTML_PARSE_COMPACT|HTML_PARSE_NOBLANKS))
-, xpath(doc.xpath())
-, xpath_albums(xpath.query(cache["//div[@class = 'post']"]))
-, xpath_albums_it(xpath_albums)
-{
+  case pack("h1"):
+    if (_post_depth && ! _h1_depth)
+      _h1_depth = _depth;
+    break;
+
+  case pack("p"):
+    if (! _post_depth)
+      break;
+    if (! _meta_depth && cls == "postmetadata")
+      _meta_depth = _depth;
+    if (! _have_description) {
+      _have_description = true;
+      _desc_depth = _depth;
+    }
+    break;
+
+  case pack("img"):
+    if (_post_depth && _album.cover_url.empty() && cls == "cover")
+      _album.cover_url = _arena.copy(attributes["src"].value);
+    break;
+
+  case pack("script"):
+    // <script type="text/javascript"> soundFile:"..."
+    if (_post_depth && _track_urls.empty())
+      begin_capture(SCRIPT);
+    break;
+  }
 }
 
-int BrowsePageParser :: num_pages() {
-  // <span class='pages'>Page 1 of 31</span>
-  auto result = xpath.query_string(cache["string(//span[@class = 'pages']/text())"]);
-  if (result) {
-    const char* s = std::strrchr(result.c_str(), ' ');
-    if (s)
-      return std::atoi(s);
+void BrowsePageParser :: endElement(const char* name) {
+  if (_desc_depth)
+    _markdown.endElement(name);
+
+  while (_num_captures && _captures[_num_captures - 1].depth == _depth)
+    end_capture(_captures[--_num_captures]);
+
+  if (_depth == _desc_depth)   _desc_depth = 0;
+  if (_depth == _h1_depth)     _h1_depth = 0;
+  if (_depth == _meta_depth)   _meta_depth = 0;
+  if (_depth == _rated_depth)  _rated_depth = 0;
+  if (_depth == _dc_depth)     _dc_depth = 0;
+  if (_depth == _style_depth)  _style_depth = 0;
+  if (_depth == _dll_depth)    _dll_depth = 0;
+
+  if (_depth == _tl_depth) {
+    _tl_depth = 0;
+    // Metadata without a track number does not belong to a track
+    if (_track_open && ! _track_numbered)
+      _tracks.pop_back();
+    _track_open = false;
   }
 
-  return 0;
+  if (_depth == _post_depth)
+    end_album();
+
+  --_depth;
 }
 
-#if 0
-int BrowsePageParser :: get_base_url() {
-  // -> https://ektoplazm.com/style/uplifting/page/2 (remove "/2")
-  std::string base_url = xpath.query_string("string(//div[contains(@class, 'wp-pagenavi')]//a/@href)");
-  if (! base_url.empty()) {
-    base_url = base_url.substr(0, base_url.find_last_not_of("0123456789") + 1);
+void BrowsePageParser :: characters(const char* s, int len) {
+  for (size_t i = 0; i < _num_captures; ++i) {
+    Capture& capture = _captures[i];
+    if (! capture.direct || capture.depth == _depth)
+      capture.text.append(s, size_t(len));
   }
+
+  if (_desc_depth)
+    _markdown.characters(s, size_t(len));
 }
-#endif
 
-Album BrowsePageParser :: next_album() {
-  Album album;
-
-  if (! xpath_albums_it)
-    return album;
-
-  album.styles.reserve(3);
-  album.tracks.reserve(11);
-  album.archive_urls.reserve(3);
-
-  Xml::Node post = xpath_albums_it.next();
-
-  // Date
-  auto date = xpath.query_string(cache["string(.//span[@class = 'd']/text())"], post);
-  if (date) {
-    std::tm t = {};
-    char month[96];
-    std::sscanf(date.c_str(), "%s %d, %d", month, &t.tm_mday, &t.tm_year); // TODO: remove sscanf
-    month[0] |= 0x20; // tolower
-    month[1] |= 0x20; // tolower
-    month[2] |= 0x20; // tolower
-    month[3] = '\0';
-    const char  months[] = "jan" "feb" "mar" "apr" "may" "jun" "jul" "aug" "sep" "oct" "nov" "dec";
-    const char* found_month = std::strstr(months, month);
-    if (found_month)
-      t.tm_mon = (months - found_month) / 3;
-    t.tm_year -= 1900;
-    album.date = std::mktime(&t);
-  }
+void BrowsePageParser :: begin_capture(Field field, bool direct) {
+  if (_num_captures == _captures.size())
+    _captures.resize(_num_captures * 2);
+
+  Capture& capture = _captures[_num_captures++];
+  capture.field  = field;
+  capture.depth  = _depth;
+  capture.direct = direct;
+  capture.text.clear();
+}
+
+void BrowsePageParser :: end_capture(Capture& capture) {
+  std::string& text = capture.text;
 
-  // Download count
-  auto dc = xpath.query_string(cache["string(.//span[@class = 'dc']//strong/text())"], post);
-  if (dc)
-    album.download_count = std::atoi(erase_all(dc.c_str(), ','));
-
-  // Rating, Voting count
-  // <span class="d">Rated <strong>89.10%</strong> with <strong>189</strong>
-  auto strongs = xpath.query(cache[".//p[@class = 'postmetadata']//span[@class = 'd']//strong"], post);
-  album.rating = std::atof(safe_str(strongs[0].nearest_content()));
-  album.votes  = std::atoi(safe_str(strongs[1].nearest_content()));
-
-  // Styles
-  for (const auto& a : xpath.query(cache[".//span[@class = 'style']//a"], post)) {
-    std::string url = a["href"];
-    if (! url.empty())
-      album.styles.push_back(Style{std::move(url), a.nearest_content()});
+  switch (capture.field) {
+  case PAGES: {
+    const size_t pos = text.rfind(' ');
+    if (pos != std::string::npos)
+      SScan(text.data() + pos, text.size() - pos).read_int(_num_pages);
+    break;
   }
 
-  // Description (first <p> </p>)
-  album.description = xpath.query(cache[".//p"], post)[0].dump();
-  trim(album.description);
+  case DATE:
+    _album.date = parse_date(text);
+    break;
 
-  // Cover URL
-  album.cover_url = xpath.query(cache[".//img[@class = 'cover']"], post)[0]["src"];
+  case RATING:
+    if (_rating_strongs == 0)
+      SScan(text).read_float(_album.rating);
+    else if (_rating_strongs == 1)
+      SScan(text).read_int(_album.votes);
+    ++_rating_strongs;
+    break;
 
-  // Album title and URL
-  auto a_title = xpath.query(cache[".//h1/a"], post)[0];
-  album.url   = a_title["href"];
-  album.title = a_title.all_text();
-  trim(album.title);
+  case DOWNLOADS:
+    SScan(text).read_int(_album.download_count, ',');
+    break;
 
-  // Archive URLs (<span class="dll"><a href="...zip">MP3 Download</a>)
-  for (const auto& a : xpath.query(cache[".//span[@class = 'dll']//a"], post)) {
-    std::string url = a["href"];
-    if (! url.empty())
-      album.archive_urls.push_back(std::move(url));
-  }
+  case STYLE:
+    if (! _style_url.empty())
+      _styles.push_back(Style{_arena.copy(_style_url), _arena.copy(text)});
+    break;
+
+  case TITLE:
+    _album.title = _arena.copy(text);
+    _album.title.trim();
+    break;
 
-  // Direct mp3 track URLs
-  // <script type="text/javascript"> soundFile:"..."
-  std::vector<std::string> tracks;
-  for (const auto& script : xpath.query(cache[".//script"], post)) {
+  case SCRIPT: {
     const char *base64_begin, *base64_end;
-    if (! (base64_begin = script.nearest_content()))
-      continue;
-    if (! (base64_begin = std::strstr(base64_begin, "soundFile:")))
-      continue;
+    if (! (base64_begin = std::strstr(text.c_str(), "soundFile:")))
+      break;
     if (! (base64_begin = std::strchr(base64_begin, '"')))
-      continue;
+      break;
     if (! (base64_end = std::strchr(++base64_begin, '"')))
-      continue;
+      break;
+
+    // "url1,url2,...", the URLs are split in place
+    const size_t base64_len = size_t(base64_end - base64_begin);
+    char* urls = static_cast<char*>(_arena.allocate(base64::decoded_size(base64_len) + 1, 1));
+    const size_t urls_len = base64::decode(base64_begin, base64_len, urls);
+    urls[urls_len] = '\0';
+    for (ArenaString url : SplitInPlace(urls, urls_len, ','))
+      _track_urls.push_back(url);
+    break;
+  }
 
-    std::string result = base64::decode(base64_begin, size_t(base64_end-base64_begin));
-    split(tracks, result, [](char c){return c == ',';});
+  case TRACK_NUMBER:
+    if (_track_open && _track_numbered)
+      _track_open = false;
+    SScan(text).read_int(current_track().number);
+    _track_numbered = true;
+    break;
+
+  case TRACK_TITLE:
+    (current_track().title = _arena.copy(text)).trim();
+    break;
+
+  case TRACK_REMIX:
+    (current_track().remix = _arena.copy(text)).trim("\t ()");
+    break;
+
+  case TRACK_ARTIST:
+    (current_track().artist = _arena.copy(text)).trim();
+    break;
+
+  case TRACK_INFO: {
+    Track& track = current_track();
+    if (text.find(':') != std::string::npos) { // "(4:32)"
+      short minutes = 0;
+      SScan(text).skip_until("0123456789").read_int(minutes).read(':').read_int(track.length);
+      track.length += minutes * 60;
+    }
+    else { // "(134 BPM)"
+      SScan(text).skip_until("0123456789").read_int(track.bpm);
+    }
     break;
   }
+  }
+}
+
+/* Tracks are started by their number. Other fields preceding the number
+ * belong to the same track. */
+Track& BrowsePageParser :: current_track() {
+  if (! _track_open) {
+    _tracks.emplace_back();
+    _track_open = true;
+    _track_numbered = false;
+  }
+
+  return _tracks.back();
+}
+
+void BrowsePageParser :: begin_album() {
+  _album = Album();
+  _markdown.clear();
+  _styles.clear();
+  _tracks.clear();
+  _archive_urls.clear();
+  _track_urls.clear();
+
+  _post_depth = _depth;
+  _rating_strongs = 0;
+  _have_date = _have_title = _have_downloads = _have_description = false;
+  _track_open = false;
+}
+
+void BrowsePageParser :: end_album() {
+  _post_depth = 0;
 
   // This should only happen on `.../dj-basilisk-the-colours-of-ektoplazm`
-  if (tracks.empty())
-    return album;
+  if (_track_urls.empty())
+    return;
 
   // Some albums only have one MP3 url for multiple tracks
-  if (tracks.size() == 1)
-    album.is_single_url = true;
-
-  // Assign metadata to track urls
-  // - There may be multiple tracklists (evidence url?)
-  auto track_urls_iter = make_iterator_pair(tracks);
-  for (const auto& tracklist : xpath.query(cache[".//div[@class = 'tl']"], post)) {
-    Track track;
-    for (const auto& span : xpath.query(cache[".//span"], tracklist)) {
-      using pack = StringPack::Raw;
-      switch (pack(span["class"])) {
-        case pack("n"):
-          if (! track.url.empty()) {
-            album.tracks.push_back(std::move(track));
-            track = Track{};
-          }
-
-          track.number = std::atoi(safe_str(span.nearest_content()));
-          if (album.is_single_url)
-            track.url = *track_urls_iter;
-          else if (track_urls_iter)
-            track.url = std::move(track_urls_iter.next());
-          break;
-        case pack("t"):
-          trim((track.title = span.all_text()));
-          break;
-        case pack("r"):
-          trim((track.remix = span.all_text()), "\t ()");
-          break;
-        case pack("a"):
-          trim((track.artist = span.all_text()));
-          break;
-        case pack("d"):
-          const char* s = span.nearest_content();
-          if (s) {
-            if (std::strchr(s, ':')) { // "(4:32)"
-              short minutes = 0;
-              SScan(s).skip_until("0123456789").strtoi(minutes).read(':').strtoi(track.length);
-              track.length += minutes * 60;
-            }
-            else { // "(134 BPM)"
-              SScan(s).skip_until("0123456789").strtoi(track.bpm);
-            }
-          }
-          break;
-      }
+  if (_track_urls.size() == 1)
+    _album.is_single_url = true;
+
+  // Assign the track URLs in order, tracks without URL are dropped. The
+  // strings are edited in place later, so each track gets its own copy.
+  for (size_t i = 0; i < _tracks.size(); ++i) {
+    if (_album.is_single_url)
+      _tracks[i].url = _arena.copy(_track_urls[0].c_str(), _track_urls[0].size());
+    else if (i < _track_urls.size())
+      _tracks[i].url = _track_urls[i];
+    else {
+      _tracks.resize(i);
+      break;
     }
-
-    if (! track.url.empty())
-      album.tracks.push_back(std::move(track));
   }
 
-  fix_album_data(album);
-  return album;
+  _album.description  = _arena.copy(_description);
+  _album.styles       = _arena.copy(_styles.data(), _styles.size());
+  _album.tracks       = _arena.copy(_tracks.data(), _tracks.size());
+  _album.archive_urls = _arena.copy(_archive_urls.data(), _archive_urls.size());
+  fix_album_data(_album, _arena);
+  if (! _album.empty())
+    _callback(_album);
 }
 
-static inline size_t find_dash(const std::string& s, size_t& dash_len) {
+static inline size_t find_dash(const ArenaString& s, size_t& dash_len) {
   size_t pos;
   if ((pos = s.find("–")) != std::string::npos) // Unicode dash (precedence!)
     dash_len = sizeof("–") - 1;
@@ -267,37 +436,38 @@ static inline size_t find_dash(const std::string& s, size_t& dash_len) {
   return pos;
 }
 
-static void fix_album_data(Album& album) {
-  size_t idx, dash_len = 0;
+/* Splits `s` at the dash into `left` and `right`. The strings still share
+ * the memory, the dash gets overwritten by the terminator of `left`. */
+static inline bool split_at_dash(ArenaString s, ArenaString& left, ArenaString& right) {
+  size_t dash_len = 0;
+  const size_t idx = find_dash(s, dash_len);
+  if (idx == std::string::npos)
+    return false;
+
+  right = s;
+  right.remove_prefix(idx + dash_len);
+  left = s;
+  left.truncate(idx);
+  left.trim();
+  right.trim();
+  return true;
+}
 
+static void fix_album_data(Album& album, Arena& arena) {
   // Sometimes the track title is merged into the track artist.
   // ("artist - track") -> https://ektoplazm.com/free-music/gods-food
   for (auto& track : album.tracks)
-    if (track.title.empty()) {
-      idx = find_dash(track.artist, dash_len);
-      if (idx != std::string::npos) {
-        track.title = track.artist.substr(idx + dash_len);
-        track.artist.erase(idx);
-        trim(track.title);
-        trim(track.artist);
-      }
-    }
+    if (track.title.empty())
+      split_at_dash(track.artist, track.artist, track.title);
 
   // Extract the artist name from the album title ("album_artist - album_title")
-  idx = find_dash(album.title, dash_len);
-  if (idx != std::string::npos) {
-    album.artist = album.title.substr(0, idx);
-    album.title.erase(0, idx + dash_len);
-    trim(album.title);
-    trim(album.artist);
-  } else {
-    album.artist = "Unknown Artist";
-  }
+  if (! split_at_dash(album.title, album.artist, album.title))
+    album.artist = arena.copy("Unknown Artist");
 
   // Use album.artist if track.artist is empty
   for (auto& track : album.tracks)
     if (track.artist.empty())
-      track.artist = album.artist;
+      track.artist = arena.copy(album.artist.c_str(), album.artist.size());
 }
 
 #ifdef TEST_BROWSEPAGE
@@ -1,17 +1,24 @@
 #ifndef BROWSEPAGE_HPP
 #define BROWSEPAGE_HPP
 
-#include <lib/xml.hpp>
-#include <lib/iterator/iterator_pair.hpp>
+#include "markdown.hpp"
+
+#include <lib/arena.hpp>
+
+#include <libxml/HTMLparser.h>
 
 #include <ctime>
 #include <string>
 #include <vector>
 #include <iosfwd>
+#include <functional>
+
+/* The strings of the parse results point into the arena of the parser,
+ * see BrowsePageParser::arena() */
 
 struct Style {
-  std::string url;
-  std::string name;
+  ArenaString url;
+  ArenaString name;
 
 #ifndef NDEBUG
   friend inline std::ostream& operator<<(std::ostream&, const Style&);
@@ -19,10 +26,10 @@ struct Style {
 };
 
 struct Track {
-  std::string url;
-  std::string title;
-  std::string artist;
-  std::string remix;
+  ArenaString url;
+  ArenaString title;
+  ArenaString artist;
+  ArenaString remix;
   short       bpm = 0;
   short       length = 0;
   short       number = 0;
@@ -33,19 +40,19 @@ struct Track {
 };
 
 struct Album {
-  std::string url;
-  std::string title;
-  std::string artist;
-  std::string description;
-  std::string cover_url;
-  std::time_t date;
+  ArenaString url;
+  ArenaString title;
+  ArenaString artist;
+  ArenaString description; // Markdown
+  ArenaString cover_url;
+  std::time_t date = 0;
   int         download_count = 0;
   int         votes = 0;
   float       rating = 0.0;
   bool        is_single_url = 0;
-  std::vector<std::string> archive_urls;
-  std::vector<Style> styles;
-  std::vector<Track> tracks;
+  ArrayView<ArenaString> archive_urls;
+  ArrayView<Style> styles;
+  ArrayView<Track> tracks;
 
   inline bool empty() const noexcept {
     return tracks.empty();
@@ -56,17 +63,96 @@ struct Album {
 #endif
 };
 
+/**
+ * Single pass parser for the browse pages.
+ *
+ * The HTML is parsed using libxml's SAX interface, no document tree is built.
+ * A small state machine recognises the parts of an album inside of a
+ * <div class="post"> and passes the album to the callback as soon as the div
+ * is closed. Albums without tracks are skipped.
+ *
+ * The album and its strings live in arena(), which is only reset by
+ * reset_arena(). The callback may keep the album as long as the arena is not
+ * reset. While an album is parsed its parts are collected in buffers that are
+ * reused for the next album, so a parser does not allocate per album once
+ * the buffers and the arena have grown.
+ */
 class BrowsePageParser {
 public:
-  BrowsePageParser(const std::string&);
-  int num_pages();
-  Album next_album(); /* throws */
+  using AlbumCallback = std::function<void(Album&)>;
+
+  BrowsePageParser(AlbumCallback);
+ ~BrowsePageParser();
+
+  /* Parses the next part of the page, `finish` has to be set on the last one */
+  void parse_chunk(const char* data, size_t size, bool finish = false);
+  void parse(const std::string& page) { parse_chunk(page.c_str(), page.size(), true); }
+
+  /* Total number of pages, available once the pagination has been parsed */
+  int num_pages() const noexcept { return _num_pages; }
+
+  Arena& arena()       noexcept { return _arena;  }
+  void reset_arena()   noexcept { _arena.reset(); }
+
+  // SAX callbacks, see Xml::Sax
+  void startElement(const char*, const char**);
+  void endElement(const char*);
+  void characters(const char*, int);
 
 private:
-  Html::Doc doc;
-  Xml::XPath xpath;
-  Xml::XPathResult xpath_albums;
-  iterator_pair<Xml::XPathResult::iterator> xpath_albums_it;
+  enum Field : unsigned char {
+    PAGES, DATE, RATING, DOWNLOADS, STYLE, TITLE, SCRIPT,
+    TRACK_NUMBER, TRACK_TITLE, TRACK_REMIX, TRACK_ARTIST, TRACK_INFO
+  };
+
+  // Text content of an element that is collected until the element ends
+  struct Capture {
+    Field       field;
+    int         depth;
+    bool        direct; // Only the text nodes that are direct children
+    std::string text;
+  };
+
+  htmlParserCtxtPtr        _ctxt;
+  AlbumCallback            _callback;
+  Arena                    _arena;
+  Album                    _album;
+  std::string              _description;  // Album description as markdown ...
+  Html2Markdown::Converter _markdown;     // ... converted from the SAX events
+  std::string              _style_url;
+  std::vector<Style>       _styles;       // Parts of `_album` ...
+  std::vector<Track>       _tracks;
+  std::vector<ArenaString> _archive_urls;
+  std::vector<ArenaString> _track_urls;
+  std::vector<Capture>     _captures; // Used as a stack, entries are recycled
+  size_t                   _num_captures;
+  int                      _num_pages;
+  int                      _depth;
+  int                      _rating_strongs;
+
+  // Depths of the currently open elements of interest (0 = not open)
+  int  _post_depth;   // <div class="post">
+  int  _h1_depth;     // <h1> (album title)
+  int  _meta_depth;   // <p class="postmetadata">
+  int  _rated_depth;  // <span class="d"> inside of postmetadata (rating)
+  int  _dc_depth;     // <span class="dc"> (download count)
+  int  _style_depth;  // <span class="style">
+  int  _dll_depth;    // <span class="dll"> (archive URLs)
+  int  _tl_depth;     // <div class="tl"> (tracklist)
+  int  _desc_depth;   // First <p> (description, converted to markdown)
+
+  bool _have_date;
+  bool _have_title;
+  bool _have_downloads;
+  bool _have_description;
+  bool _track_open;
+  bool _track_numbered;
+
+  void begin_album();
+  void end_album();
+  void begin_capture(Field, bool direct = false);
+  void end_capture(Capture&);
+  Track& current_track();
 };
 
 #endif
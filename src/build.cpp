@@ -29,11 +29,18 @@
 #include<memory>
 
 #include "../lib/base64.cpp"
+#include "../lib/concurrencylimit.cpp"
+#include "../lib/directoryindex.cpp"
 #include "../lib/downloads.cpp"
+#include "../lib/fifostream.cpp"
+#include "../lib/filecache.cpp"
+#include "../lib/httpcache.cpp"
 #include "../lib/filesystem.cpp"
 #include "../lib/shellsplit.cpp"
 #include "../lib/stringchunk.cpp"
+#include "../lib/frontcodedchunk.cpp"
 #include "../lib/process.cpp"
+#include "../lib/tarreader.cpp"
 #include "../lib/xml.cpp"
 #define __cpp_exceptions 200202
 
@@ -6,13 +6,13 @@
 #include <lib/algorithm.hpp>
 #include <lib/filesystem.hpp>
 #include <lib/shellsplit.hpp>
+#include <lib/sscan.hpp>
 #include <lib/stringpack.hpp>
 #include <lib/cfile.hpp>
 #include <lib/hash.hpp>
 
 #include <vector>
 #include <cstdio>
-#include <cinttypes>
 #include <algorithm>
 
 using namespace Views;
@@ -20,17 +20,17 @@ using namespace Views;
 // Parsing functions for primitives ===========================================
 
 static int parse_int(ConstChars s) {
-  char *end;
-  int i = std::strtoimax(s, &end, 10);
-  if (!*s || *end)
+  int i;
+  SScan scan(s);
+  if (! scan.read_int(i) || ! scan.at_end())
     throw ConfigError(s, "Not an integer");
   return i;
 }
 
 static float parse_float(ConstChars s) {
-  char *end;
-  float f = std::strtof(s, &end);
-  if (!*s || *end)
+  float f;
+  SScan scan(s);
+  if (! scan.read_float(f) || ! scan.at_end())
     throw ConfigError(s, "Not a float");
   return f;
 }
@@ -64,6 +64,15 @@ static int parse_use_colors(ConstChars s) {
   throw ConfigError(s, "Expected auto|mono|8|256");
 }
 
+static int parse_cache_policy(ConstChars s) {
+  using pack = StringPack::AlnumNoCase;
+  switch (pack(s)) {
+    case pack("lru"):   return 0;
+    case pack("lfu"):   return 1;
+  }
+  throw ConfigError(s, "Expected lru|lfu");
+}
+
 static short parse_color(ConstChars s) {
   short color = UI::Color::parse(s.s);
   if (color != UI::Color::Invalid)
@@ -234,7 +243,7 @@ static PlaylistColumns parse_playlist_columns(ConstChars s) {
         case pack("right"): fmt.justify = PlaylistColumnFormat::Justify::Right;  break;
         case pack("left"):  fmt.justify = PlaylistColumnFormat::Justify::Left;   break;
         case pack("size"):
-          fmt.size = std::atoi(attr.value.c_str());
+          SScan(attr.value).read_int(fmt.size);
           fmt.relative = (attr.value.back() == '%');
       }
     }
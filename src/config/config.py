@@ -113,6 +113,12 @@ options = [
         help: 'Database file for storing ektoplazm metadata',
         lateinit: True
         }),
+    ('shared_database_file', {
+        type: 'std::string', set: 'Filesystem::expand',
+        default: '""',
+        help: 'Read-only database snapshot shared by multiple instances (e.g. "/dev/shm/ektoplayer.db").\nAn instance that loads `database_file` publishes it there, following instances map it instead of loading their own copy. The snapshot is only used if it belongs to the user (or root) and is not writable by group or others. Empty to disable.',
+        lateinit: True
+        }),
     ('log_file', {
         type: 'std::string', set: 'Filesystem::expand',
         default: '"~/.config/ektoplayer/ektoplayer.log"',
@@ -167,10 +173,26 @@ options = [
         default: '0.50',
         help: 'Specify after how many percent the next track shall be prefetched. Set it to 0 to disable it.',
         }),
+    ('archive_rate_limit', {
+        type: 'int', set: 'parse_int',
+        default: '0',
+        help: 'Maximum download rate of album archives in KiB/s. 0 means unlimited. Archives are paused anyway while a track for playback is downloaded',
+        }),
+    ('track_cache_size', {
+        type: 'int', set: 'parse_int',
+        default: '2048',
+        help: 'Maximum size of the mp3 files in `cache_dir` in MiB. The files that were not played for the longest time (or the least often, see `track_cache_policy`) are deleted. 0 means unlimited',
+        }),
+    ('track_cache_policy', {
+        type: 'int', set: 'parse_cache_policy',
+        default: '"lru"',
+        c_default: '0',
+        help: 'Which tracks are deleted first if `track_cache_size` is exceeded. lru|lfu',
+        }),
     ('small_update_pages', {
         type: 'int', set: 'parse_int',
-        default: '3',
-        help: 'How many pages should be fetched after start',
+        default: '10',
+        help: 'Maximum number of pages fetched by the incremental update after start. The update stops at the first page without new albums',
         }),
     ('use_colors', {
         type: 'int', set: 'parse_use_colors',
@@ -1,5 +1,8 @@
 extern int use_colors;
+extern int track_cache_size;
+extern int archive_rate_limit;
 extern int small_update_pages;
+extern int track_cache_policy;
 extern int playlist_load_newest;
 extern bool tabbar_visible;
 extern bool infoline_display;
@@ -16,6 +19,7 @@ extern std::string album_dir;
 extern std::string cache_dir;
 extern std::string archive_dir;
 extern std::string database_file;
+extern std::string shared_database_file;
 extern InfoLineFormat infoline_format_top_8;
 extern InfoLineFormat infoline_format_top_256;
 extern InfoLineFormat infoline_format_bottom_8;
@@ -1,5 +1,8 @@
 int                         Config :: use_colors = -1;
-int                         Config :: small_update_pages = 3;
+int                         Config :: track_cache_size = 2048;
+int                         Config :: archive_rate_limit = 0;
+int                         Config :: small_update_pages = 10;
+int                         Config :: track_cache_policy = 0;
 int                         Config :: playlist_load_newest = 1000;
 bool                        Config :: tabbar_visible = true;
 bool                        Config :: infoline_display = true;
@@ -16,6 +19,7 @@ std::string                 Config :: album_dir /* will be initialized later */;
 std::string                 Config :: cache_dir /* will be initialized later */;
 std::string                 Config :: archive_dir /* will be initialized later */;
 std::string                 Config :: database_file /* will be initialized later */;
+std::string                 Config :: shared_database_file /* will be initialized later */;
 InfoLineFormat              Config :: infoline_format_top_8 = {
 {static_cast<Database::ColumnID>(Database::COLUMN_NONE), "<< ", COLOR_BLACK},
 {static_cast<Database::ColumnID>(Database::TRACK_TITLE), "",    COLOR_YELLOW, -1, A_BOLD},
@@ -12,12 +12,16 @@ case Hash::djb2("browser.columns"): browser_columns = parse_playlist_columns(val
 case Hash::djb2("infoline.display"): infoline_display = parse_bool(value); break;
 case Hash::djb2("infoline.visible"): infoline_visible = parse_bool(value); break;
 case Hash::djb2("playlist.columns"): playlist_columns = parse_playlist_columns(value); break;
+case Hash::djb2("track_cache_size"): track_cache_size = parse_int(value); break;
+case Hash::djb2("archive_rate_limit"): archive_rate_limit = parse_int(value); break;
 case Hash::djb2("small_update_pages"): small_update_pages = parse_int(value); break;
+case Hash::djb2("track_cache_policy"): track_cache_policy = parse_cache_policy(value); break;
 case Hash::djb2("browser.columns_256"): browser_columns_256 = parse_playlist_columns(value); break;
 case Hash::djb2("progressbar.display"): progressbar_display = parse_bool(value); break;
 case Hash::djb2("progressbar.visible"): progressbar_visible = parse_bool(value); break;
 case Hash::djb2("playlist.columns_256"): playlist_columns_256 = parse_playlist_columns(value); break;
 case Hash::djb2("playlist_load_newest"): playlist_load_newest = parse_int(value); break;
+case Hash::djb2("shared_database_file"): shared_database_file = Filesystem::expand(value); break;
 case Hash::djb2("infoline.format_top_8"): infoline_format_top_8 = parse_infoline_format(value); break;
 case Hash::djb2("progressbar.rest_char"): progressbar_rest_char = parse_char(value); break;
 case Hash::djb2("delete_after_extraction"): delete_after_extraction = parse_bool(value); break;
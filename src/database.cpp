@@ -6,26 +6,44 @@
 #include <lib/cfile.hpp>
 
 #include <type_traits>
+#include <algorithm>
 #include <climits>
 #include <cstdint>
 #include <cstring>
 #include <cstdio>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 namespace Database {
 
-const uint16_t DB_ABI_VERSION      = 1;
+const uint16_t DB_ABI_VERSION      = 2;
 const uint16_t DB_ENDIANNESS_CHECK = 0xFEFF;
 
+/* With `align` set, the buffers are aligned so they can be used in place by
+ * the Mapper */
 struct Dumper {
-  Dumper(FILE* fh)
+  Dumper(FILE* fh, bool align = false)
     : _fh(fh)
+    , _align(align)
+    , _pos(0)
   {}
 
   void dump(const StringChunk& p) {
     const size_t size = size_t(p.size());
     dump(size);
-    write(p.data(), size);
+    write_buffer(p.data(), size);
+    dump(size);
+  }
+
+  void dump(const FrontCodedChunk& p) {
+    const size_t size = p.sorted_size();
+    dump(size);
+    write_buffer(p.sorted_data(), size);
     dump(size);
+    dump(p.tail());
   }
 
   template<typename T>
@@ -34,7 +52,7 @@ struct Dumper {
     const size_t  size = v.size();
     dump(bits);
     dump(size);
-    write(v.data(), ceil_div(bits * size, size_t(CHAR_BIT)));
+    write_buffer(v.data(), ceil_div(bits * size, size_t(CHAR_BIT)));
     dump(bits);
     dump(size);
   }
@@ -45,7 +63,7 @@ struct Dumper {
     const size_t  size  = v.size();
     dump(bytes);
     dump(size);
-    write(v.data(), bytes * size);
+    write_buffer(v.data(), bytes * size);
     dump(bytes);
     dump(size);
   }
@@ -63,10 +81,21 @@ struct Dumper {
 
 private:
   FILE* _fh;
+  bool _align;
+  size_t _pos;
 
   void write(const void* buf, size_t size) {
     if (std::fwrite(buf, size, 1, _fh) != 1)
       throw std::runtime_error(std::strerror(EIO));
+    _pos += size;
+  }
+
+  void write_buffer(const void* buf, size_t size) {
+    static const char padding[alignof(size_t)] = {0};
+    if (_align && _pos % sizeof(padding))
+      write(padding, sizeof(padding) - _pos % sizeof(padding));
+    if (size)
+      write(buf, size);
   }
 };
 
@@ -83,6 +112,18 @@ struct Loader {
       throw std::runtime_error("bad footer");
   }
 
+  void load(FrontCodedChunk& chunk) {
+    const size_t size = load<size_t>();
+    std::string sorted(size, '\0');
+    if (size)
+      read(&sorted[0], size);
+    if (load<size_t>() != size)
+      throw std::runtime_error("bad footer");
+    if (! chunk.assign_sorted(std::move(sorted)))
+      throw std::runtime_error("bad data");
+    load(chunk.tail());
+  }
+
   template<typename T>
   void load(DynamicPackedVector<T>& vec) {
     const uint8_t bits = load<uint8_t>();
@@ -128,6 +169,109 @@ private:
   }
 };
 
+/* Reads a database written by an aligned Dumper from memory. The buffers are
+ * used in place, so `data` has to stay mapped. */
+struct Mapper {
+  Mapper(char* data, size_t size)
+    : _data(data)
+    , _size(size)
+    , _pos(0)
+  {}
+
+  void map(StringChunk& chunk) {
+    const size_t size = load<size_t>();
+    const char* data = buffer(size);
+    if (! size || data[0] || data[size - 1])
+      throw std::runtime_error("bad data");
+    chunk.share(data, size);
+    if (load<size_t>() != size)
+      throw std::runtime_error("bad footer");
+  }
+
+  void map(FrontCodedChunk& chunk) {
+    const size_t size = load<size_t>();
+    if (! chunk.share_sorted(buffer(size), size))
+      throw std::runtime_error("bad data");
+    if (load<size_t>() != size)
+      throw std::runtime_error("bad footer");
+    map(chunk.tail());
+  }
+
+  template<typename T>
+  void map(DynamicPackedVector<T>& vec) {
+    using data_type = typename DynamicPackedVector<T>::data_type;
+    const uint8_t bits = load<uint8_t>();
+    const size_t  size = load<size_t>();
+    if (! bits || bits > sizeof(data_type) * CHAR_BIT)
+      throw std::runtime_error("bad bit count");
+    // The vector reads whole words, the footer following the data is large
+    // enough to cover the last one.
+    char* data = buffer(ceil_div(bits * size, size_t(CHAR_BIT)));
+    vec.borrow(reinterpret_cast<data_type*>(data), size, bits);
+    if (load<uint8_t>() != bits) throw std::runtime_error("bad footer");
+    if (load<size_t>() != size)  throw std::runtime_error("bad footer");
+  }
+
+  template<typename T>
+  void map(std::vector<T>& v) {
+    const uint8_t bytes = load<uint8_t>();
+    const size_t  size  = load<size_t>();
+    if (bytes != sizeof(T))
+      throw std::runtime_error("byte count != sizeof(T)");
+    v.resize(size);
+    if (size)
+      std::memcpy(v.data(), buffer(bytes * size), bytes * size);
+    if (load<uint8_t>() != bytes) throw std::runtime_error("bad footer");
+    if (load<size_t>() != size)   throw std::runtime_error("bad footer");
+  }
+
+  template<typename T>
+  inline T load() {
+    T value;
+    static_assert(std::is_arithmetic<T>::value, "T not an integer");
+    std::memcpy(&value, read(sizeof(value)), sizeof(value));
+    return value;
+  }
+
+  void map(Table& t) {
+    for (const auto& col : t.columns)
+      map(*col);
+  }
+
+private:
+  char*  _data;
+  size_t _size;
+  size_t _pos;
+
+  char* read(size_t size) {
+    if (size > _size - _pos)
+      throw std::runtime_error("unexpected end of data");
+    char* data = _data + _pos;
+    _pos += size;
+    return data;
+  }
+
+  char* buffer(size_t size) {
+    if (_pos % alignof(size_t))
+      read(alignof(size_t) - _pos % alignof(size_t));
+    return read(size);
+  }
+};
+
+/* ============================================================================
+ * Table
+ * ==========================================================================*/
+
+void Table :: erase(size_t id) {
+  if (deleted.size() < size())
+    deleted.resize(size());
+  if (id && ! deleted[id]) {
+    deleted[id] = true;
+    ++deleted_count;
+    ++db._generation;
+  }
+}
+
 /* ============================================================================
  * Database
  * ==========================================================================*/
@@ -137,12 +281,30 @@ Database :: Database() noexcept
 , albums(*this, chunk_album_url, chunk_cover_url, chunk_archive_url, chunk_desc, chunk_meta)
 , tracks(*this, chunk_track_url, chunk_meta)
 , tables({&styles, &albums, &tracks})
-, chunks({&chunk_meta, &chunk_desc, &chunk_style_url, &chunk_album_url,
-    &chunk_track_url, &chunk_cover_url, &chunk_archive_url})
+, chunks({&chunk_meta, &chunk_desc, &chunk_style_url, &chunk_cover_url})
+, url_chunks({&chunk_album_url, &chunk_track_url, &chunk_archive_url})
+, compaction(*this)
+, chunk_columns({{
+    {"meta",        &chunk_meta,        {&styles.name, &albums.title,
+                                         &albums.artist, &tracks.title,
+                                         &tracks.artist, &tracks.remix}},
+    {"desc",        &chunk_desc,        {&albums.description}},
+    {"style_url",   &chunk_style_url,   {&styles.url}},
+    {"cover_url",   &chunk_cover_url,   {&albums.cover_url}}
+  }})
+, url_chunk_columns({{
+    {"album_url",   &chunk_album_url,   {&albums.url}},
+    {"track_url",   &chunk_track_url,   {&tracks.url}},
+    {"archive_url", &chunk_archive_url, {&albums.archive_mp3,
+                                         &albums.archive_wav,
+                                         &albums.archive_flac}}
+  }})
+, _generation(0)
 {
 }
 
 void Database :: load(const std::string& file) {
+  ++_generation;
   auto fh = CFile::open(file, "r");
 
   Loader l(fh);
@@ -155,43 +317,177 @@ void Database :: load(const std::string& file) {
   for (auto p : chunks)
     l.load(*p);
 
+  for (auto p : url_chunks)
+    l.load(*p);
+
   for (auto t : tables)
     l.load(*t);
-}
 
-void Database :: save(const std::string& file) const {
-  auto fh = CFile::open(file, "w");
+  tracks.update_clustered();
+}
 
-  Dumper d(fh);
+static void dump_database(Dumper& d, const Database& db) {
   d.dump(DB_ENDIANNESS_CHECK);
   d.dump(DB_ABI_VERSION);
-  for (auto p : chunks)
+  for (auto p : db.chunks)
     d.dump(*p);
-  for (auto t : tables)
+  for (auto p : db.url_chunks)
+    d.dump(*p);
+  for (auto t : db.tables)
     d.dump(*t);
 }
 
+void Database :: save(const std::string& file) const {
+  auto fh = CFile::open(file, "w");
+
+  Dumper d(fh);
+  dump_database(d, *this);
+}
+
+/* ============================================================================
+ * Database :: Shared snapshots
+ * ==========================================================================*/
+
+/* The snapshot is written to a temporary file that replaces `file` at last,
+ * so instances that already mapped `file` keep their (old) mapping */
+void Database :: publish(const std::string& file) const {
+  std::string tmp = file + ".XXXXXX";
+  const int fd = ::mkstemp(&tmp[0]);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category());
+
+  try {
+    if (::fchmod(fd, 0644)) {
+      ::close(fd);
+      throw std::system_error(errno, std::generic_category());
+    }
+
+    auto fh = CFile::fdopen(fd, "w");
+    Dumper d(fh, true);
+    dump_database(d, *this);
+    if (fh.flush())
+      throw std::system_error(errno, std::generic_category());
+
+    if (::rename(tmp.c_str(), file.c_str()))
+      throw std::system_error(errno, std::generic_category());
+  }
+  catch (...) {
+    ::unlink(tmp.c_str());
+    throw;
+  }
+}
+
+/* The private mapping shows later writes of the owner to pages we have not
+ * copied yet, so checking the references once only protects us if nobody
+ * else can write the file: It has to belong to us (or root) and must not be
+ * writable by group or others. */
+void Database :: attach(const std::string& file) {
+  if (attached())
+    throw std::runtime_error("Database already attached");
+  ++_generation;
+
+  const int fd = ::open(file.c_str(), O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category());
+
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (! ::fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0
+      && (st.st_uid == ::getuid() || st.st_uid == 0) && !(st.st_mode & (S_IWGRP|S_IWOTH)))
+    data = ::mmap(NULL, size_t(st.st_size), PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    throw std::runtime_error("Not a regular file, empty, owned or writable by others");
+
+  // Kept mapped even on errors, chunks and columns may already refer to it
+  _snapshot.data = data;
+  _snapshot.size = size_t(st.st_size);
+
+  try {
+    Mapper m(static_cast<char*>(data), _snapshot.size);
+    if (m.load<uint16_t>() != DB_ENDIANNESS_CHECK)
+      throw std::runtime_error("Database endianess mismatch");
+
+    if (m.load<uint16_t>() != DB_ABI_VERSION)
+      throw std::runtime_error("Database ABI version mismatch");
+
+    for (auto p : chunks)
+      m.map(*p);
+
+    for (auto p : url_chunks)
+      m.map(*p);
+
+    for (auto t : tables)
+      m.map(*t);
+
+    validate();
+    tracks.update_clustered();
+  }
+  catch (...) {
+    for (auto p : chunks)
+      p->clear();
+    for (auto p : url_chunks)
+      p->clear();
+    for (auto t : tables)
+      t->resize(0);
+    throw;
+  }
+}
+
+Database::Snapshot :: ~Snapshot() {
+  if (data)
+    ::munmap(data, size);
+}
+
+static size_t id_limit(const StringChunk& chunk) noexcept {
+  return size_t(chunk.size());
+}
+
+static size_t id_limit(const FrontCodedChunk& chunk) noexcept {
+  return size_t(chunk.sorted_count() + chunk.tail().size());
+}
+
+static void check_references(const Column& column, size_t limit) {
+  for (size_t i = 0; i < column.size(); ++i)
+    if (size_t(unsigned(column[i])) >= limit)
+      throw std::runtime_error("Invalid reference");
+}
+
+void Database :: validate() const {
+  for (const auto t : tables)
+    for (const auto c : t->columns)
+      if (c->size() != t->size())
+        throw std::runtime_error("Column size mismatch");
+
+  for (const auto& cc : chunk_columns)
+    for (const auto c : cc.columns)
+      check_references(*c, id_limit(*cc.chunk));
+
+  for (const auto& cc : url_chunk_columns)
+    for (const auto c : cc.columns)
+      check_references(*c, id_limit(*cc.chunk));
+
+  check_references(tracks.album_id, albums.size());
+
+  const size_t max_styles = sizeof(int) * CHAR_BIT - 1;
+  const size_t style_bits = std::min(styles.size(), max_styles);
+  check_references(albums.styles, size_t(1) << style_bits);
+}
+
 void Database :: shrink_to_fit() {
-  shrink_chunk_to_fit(chunk_style_url, {&styles.url});
-  shrink_chunk_to_fit(chunk_track_url, {&tracks.url});
-  shrink_chunk_to_fit(chunk_album_url, {&albums.url});
-  shrink_chunk_to_fit(chunk_cover_url, {&albums.cover_url});
-  shrink_chunk_to_fit(chunk_desc,      {&albums.description});
-  shrink_chunk_to_fit(chunk_archive_url,
-    {&albums.archive_mp3, &albums.archive_wav, &albums.archive_flac});
-  shrink_chunk_to_fit(chunk_meta, {&styles.name, &albums.title,
-    &albums.artist, &tracks.title, &tracks.artist, &tracks.remix});
+  ++_generation;
+  for (auto& cc : chunk_columns)
+    shrink_chunk_to_fit(*cc.chunk, cc.columns);
+  for (auto& cc : url_chunk_columns)
+    shrink_chunk_to_fit(*cc.chunk, cc.columns);
 
   for (auto& table : tables)
     table->shrink_to_fit();
 }
 
-void Database :: shrink_chunk_to_fit(StringChunk& chunk, std::initializer_list<Column*> columns) {
-  if (chunk.is_shrinked())
-    return;
-  log_write("shrinking chunk ... ");
-
-  StringChunk::Shrinker shrinker = chunk.get_shrinker();
+template<class TChunk>
+static void shrink_chunk(TChunk& chunk, const std::vector<Column*>& columns) {
+  typename TChunk::Shrinker shrinker = chunk.get_shrinker();
   for (auto col : columns)
     for (auto id : *col)
       shrinker.add(id);
@@ -205,21 +501,654 @@ void Database :: shrink_chunk_to_fit(StringChunk& chunk, std::initializer_list<C
     //  id = idRemap[id];
 }
 
+template<class TChunk>
+void Database :: shrink_chunk_to_fit(TChunk& chunk, const std::vector<Column*>& columns) {
+  if (chunk.is_shrinked())
+    return;
+  log_write("shrinking chunk ... ");
+  shrink_chunk(chunk, columns);
+}
+
+/* ============================================================================
+ * Database :: Compaction
+ * ==========================================================================*/
+
+static void reserve_like(Column& column, const Column& like, size_t n) {
+#if DATABASE_USE_PACKED_VECTOR
+  column.reserve(n, like.bits());
+#else
+  (void) like;
+  column.reserve(n);
+#endif
+}
+
+bool Compaction :: needed() const noexcept {
+  for (const auto table : _db.tables)
+    if (table->deleted_count)
+      return true;
+  return _db.tracks.clustered < _db.tracks.size();
+}
+
+void Compaction :: start() {
+  if (running() || ! needed())
+    return;
+
+  log_write("Starting database compaction\n");
+  const size_t n_tables = _db.tables.size();
+  _order.assign(n_tables, {});
+  _remap.assign(n_tables, {});
+  _columns.clear();
+  _columns.resize(n_tables);
+  _table = 0;
+  _row   = 0;
+  _state = SCAN_ROWS;
+  _db_generation = _db._generation;
+}
+
+/* Drops the work done so far */
+void Compaction :: abort() {
+  _order.clear();
+  _remap.clear();
+  _columns.clear();
+  _chunk_columns.clear();
+  std::vector<bool>().swap(_referenced);
+  _string_ids.clear();
+  _strings.clear();
+  _track_sort.stop();
+  _string_sort.stop();
+  _builder.reset();
+  _chunks.clear();
+  _url_chunks.clear();
+  _state = IDLE;
+}
+
+void Compaction :: finish() {
+  start();
+  while (step(SIZE_MAX));
+}
+
+bool Compaction::TrackOrder :: operator()(int a, int b) const noexcept {
+  const Tracks& tracks = db->tracks;
+  const int album_a = tracks.album_id[size_t(a)];
+  const int album_b = tracks.album_id[size_t(b)];
+  if (album_a != album_b)
+    return album_a < album_b;
+  return int(tracks.number[size_t(a)]) < int(tracks.number[size_t(b)]);
+}
+
+bool Compaction :: step(size_t max_rows) {
+  // The new columns and chunks lack what was inserted or deleted meanwhile
+  if (running() && _db_generation != _db._generation) {
+    log_write("Restarting database compaction, the database was modified\n");
+    abort();
+    start();
+  }
+
+  switch (_state) {
+  case IDLE:
+    return false;
+
+  case SCAN_ROWS:
+    if (scan_rows(max_rows))
+      return true;
+    _row = 0;
+    if (++_table < _db.tables.size())
+      return true;
+    // Row 0 has the smallest album and number, so it stays in front
+    _track_sort.start_sort(_order[2]); // Same order as `tables`
+    _state = SORT_TRACKS;
+    return true;
+
+  case SORT_TRACKS:
+    if (_track_sort.step(max_rows))
+      return true;
+    _table = 0;
+    _state = COPY_ROWS;
+    return true;
+
+  case COPY_ROWS:
+    if (copy_rows(max_rows))
+      return true;
+    _row = 0;
+    if (++_table < _db.tables.size())
+      return true;
+    _chunks.assign(_db.chunk_columns.size(), StringChunk());
+    _url_chunks.assign(_db.url_chunk_columns.size(), UrlChunk());
+    _chunk  = 0;
+    _column = 0;
+    _phase  = MARK;
+    _state  = CLEAN_CHUNKS;
+    return true;
+
+  case CLEAN_CHUNKS:
+    if (clean_chunk(max_rows))
+      return true;
+    commit();
+    log_write("Finished database compaction\n");
+    _state = IDLE;
+    return false;
+  }
+
+  return false;
+}
+
+/* Collects the rows to keep. Tracks of deleted albums are deleted. */
+bool Compaction :: scan_rows(size_t max_rows) {
+  Table& table = *_db.tables[_table];
+  auto& order = _order[_table];
+  if (! _row)
+    order.reserve(table.size() - table.deleted_count);
+
+  Tracks& tracks = _db.tracks;
+  const size_t end = _row + std::min(max_rows, table.size() - _row);
+  for (size_t id = _row; id < end; ++id) {
+    if (&table == &tracks && id && ! tracks.is_deleted(id)
+        && _db.albums.is_deleted(size_t(tracks.album_id[id]))) {
+      tracks.erase(id);
+      _db_generation = _db._generation; // Our own change
+    }
+
+    if (! table.is_deleted(id))
+      order.push_back(int(id));
+  }
+
+  if ((_row = end) < table.size())
+    return true;
+
+  _remap[_table].assign(table.size(), 0);
+  return false;
+}
+
+bool Compaction :: copy_rows(size_t max_rows) {
+  Table& table = *_db.tables[_table];
+  const auto& order = _order[_table];
+  auto& remap = _remap[_table];
+  auto& columns = _columns[_table];
+
+  if (columns.empty()) {
+    columns.resize(table.columns.size());
+    for (size_t c = 0; c < columns.size(); ++c)
+      reserve_like(columns[c], *table.columns[c], order.size());
+  }
+
+  const size_t end = _row + std::min(max_rows, order.size() - _row);
+  for (size_t i = _row; i < end; ++i)
+    remap[size_t(order[i])] = int(i);
+
+  for (size_t c = 0; c < columns.size(); ++c) {
+    const Column* column = table.columns[c];
+    for (size_t i = _row; i < end; ++i)
+      columns[c].push_back(translate(column, (*column)[size_t(order[i])]));
+  }
+
+  return (_row = end) < order.size();
+}
+
+/* Returns true if there is work left on this or the following chunks */
+bool Compaction :: clean_chunk(size_t max_rows) {
+  const size_t n_chunks = _db.chunk_columns.size();
+  const bool is_url_chunk = (_chunk >= n_chunks);
+
+  if (_chunk_columns.empty()) {
+    const auto& columns = (is_url_chunk
+      ? _db.url_chunk_columns[_chunk - n_chunks].columns
+      : _db.chunk_columns[_chunk].columns);
+    for (auto column : columns)
+      _chunk_columns.push_back(&new_column(column));
+  }
+
+  if (is_url_chunk
+      ? clean_chunk(*_db.url_chunk_columns[_chunk - n_chunks].chunk, _url_chunks[_chunk - n_chunks], max_rows)
+      : clean_chunk(*_db.chunk_columns[_chunk].chunk, _chunks[_chunk], max_rows))
+    return true;
+
+  _chunk_columns.clear();
+  _phase = MARK;
+  return ++_chunk < n_chunks + _db.url_chunk_columns.size();
+}
+
+/* Copies the strings of `chunk` that are referenced by the new columns to
+ * `new_chunk` and rewrites the IDs in the new columns */
+template<class TChunk>
+bool Compaction :: clean_chunk(const TChunk& chunk, TChunk& new_chunk, size_t max_rows) {
+  switch (_phase) {
+  case MARK:
+    if (_referenced.empty())
+      _referenced.resize(id_limit(chunk));
+    if (for_each_row(max_rows, [&](Column& column, size_t row) {
+          _referenced[size_t(column[row])] = true;
+        }))
+      return true;
+    _string_ids.assign(_referenced.size(), 0);
+    _phase = COLLECT;
+    return true;
+
+  case COLLECT:
+    if (collect_strings(chunk, new_chunk, max_rows))
+      return true;
+    std::vector<bool>().swap(_referenced);
+    _string_sort.start_sort(_strings);
+    _row = 0;
+    _phase = SORT;
+    return true;
+
+  case SORT:
+    if (_string_sort.step(max_rows))
+      return true;
+    _phase = BUILD;
+    return true;
+
+  case BUILD:
+    if (build_chunk(new_chunk, max_rows))
+      return true;
+    std::vector<String>().swap(_strings);
+    _row = 0;
+    _phase = REMAP;
+    return true;
+
+  case REMAP:
+    if (for_each_row(max_rows, [&](Column& column, size_t row) {
+          column[row] = _string_ids[size_t(column[row])];
+        }))
+      return true;
+    std::vector<int>().swap(_string_ids);
+    return false;
+  }
+
+  return false;
+}
+
+/* Unlike shrinking, this does not change the order of the strings, so it is
+ * a linear operation and keeps the chunk shrinked.
+ * An ID may also point into the middle of a string (suffix sharing). */
+bool Compaction :: collect_strings(const StringChunk& chunk, StringChunk& new_chunk, size_t max_rows) {
+  const char* data = chunk.data();
+  const size_t size = size_t(chunk.size());
+
+  for (size_t n = 0; n < max_rows && (_row = std::max<size_t>(_row, 1)) < size; ++n) {
+    const size_t start = _row;
+    const size_t end = start + std::strlen(data + start);
+
+    bool is_referenced = false;
+    for (size_t i = start; i <= end && !is_referenced; ++i)
+      is_referenced = _referenced[i];
+
+    if (is_referenced) {
+      const int pos = new_chunk.add_unchecked(StringChunk::CString(data + start, end - start));
+      for (size_t i = start; i <= end; ++i)
+        _string_ids[i] = pos + int(i - start);
+    }
+
+    _row = end + 1;
+  }
+
+  return _row < size;
+}
+
+/* A front coded chunk drops unreferenced strings when it gets rebuilt */
+bool Compaction :: collect_strings(const FrontCodedChunk& chunk, FrontCodedChunk&, size_t max_rows) {
+  std::string buffer;
+  for (size_t n = 0; n < max_rows && (_row = std::max<size_t>(_row, 1)) < _referenced.size(); ++n, ++_row)
+    if (_referenced[_row])
+      _strings.emplace_back(chunk.get(int(_row), buffer), int(_row));
+
+  return _row < _referenced.size();
+}
+
+/* The strings of a StringChunk were copied in their order already */
+bool Compaction :: build_chunk(StringChunk&, size_t) {
+  return false;
+}
+
+bool Compaction :: build_chunk(FrontCodedChunk& new_chunk, size_t max_rows) {
+  if (! _builder)
+    _builder.reset(new FrontCodedChunk::Builder(new_chunk));
+
+  const size_t end = _row + std::min(max_rows, _strings.size() - _row);
+  for (; _row < end; ++_row)
+    _string_ids[size_t(_strings[_row].second)] = _builder->add(_strings[_row].first);
+
+  if (_row < _strings.size())
+    return true;
+
+  _builder.reset();
+  new_chunk.shrink_to_fit();
+  return false;
+}
+
+/* Calls `f(column, row)` for the rows of the new columns referencing the
+ * chunk being cleaned */
+template<class TFunc>
+bool Compaction :: for_each_row(size_t max_rows, TFunc f) {
+  for (; _column < _chunk_columns.size(); ++_column, _row = 0) {
+    Column& column = *_chunk_columns[_column];
+    const size_t end = _row + std::min(max_rows, column.size() - _row);
+    max_rows -= end - _row;
+    for (; _row < end; ++_row)
+      f(column, _row);
+
+    if (_row < column.size())
+      return true;
+  }
+
+  _column = 0;
+  _row = 0;
+  return false;
+}
+
+/* The new column that replaces `column` */
+Column& Compaction :: new_column(const Column* column) noexcept {
+  size_t t = 0, c = 0;
+  for (; t < _db.tables.size(); ++t, c = 0) {
+    const auto& columns = _db.tables[t]->columns;
+    while (c < columns.size() && columns[c] != column)
+      ++c;
+    if (c < columns.size())
+      break;
+  }
+
+  assert(t < _db.tables.size());
+  return _columns[t][c];
+}
+
+/* Replaces the columns and chunks by the new ones */
+void Compaction :: commit() {
+  for (size_t t = 0; t < _db.tables.size(); ++t) {
+    Table& table = *_db.tables[t];
+    for (size_t c = 0; c < table.columns.size(); ++c)
+      std::swap(*table.columns[c], _columns[t][c]);
+    table.deleted.clear();
+    table.deleted_count = 0;
+    table.remap = std::move(_remap[t]);
+  }
+
+  for (size_t i = 0; i < _chunks.size(); ++i) {
+    StringChunk& chunk = *_db.chunk_columns[i].chunk;
+    if (_chunks[i].size() != chunk.size()) // Otherwise nothing was removed
+      chunk = std::move(_chunks[i]);
+  }
+
+  for (size_t i = 0; i < _url_chunks.size(); ++i)
+    *_db.url_chunk_columns[i].chunk = std::move(_url_chunks[i]);
+
+  _db.tracks.clustered = _db.tracks.size();
+
+  abort();
+  ++_generation;
+  ++_db._generation;
+}
+
+/* Rewrites a value that references rows of another table */
+int Compaction :: translate(const Column* column, int value) const noexcept {
+  if (column == &_db.tracks.album_id) {
+    const auto& albums = _remap[1]; // Same order as `tables`
+    return size_t(value) < albums.size() ? albums[size_t(value)] : 0;
+  }
+
+  if (column == &_db.albums.styles) {
+    const auto& styles = _remap[0]; // Same order as `tables`
+    int new_value = 0;
+    for (auto bit : iterate_set_bits(value)) {
+      const size_t id = size_t(bit + 1);
+      if (id < styles.size() && styles[id])
+        new_value |= 1 << (styles[id] - 1);
+    }
+    return new_value;
+  }
+
+  return value;
+}
+
+/* ============================================================================
+ * Database :: Memory statistics
+ * ==========================================================================*/
+
+static int column_bits(const Column& column) noexcept {
+#if DATABASE_USE_PACKED_VECTOR
+  return column.bits();
+#else
+  return int(sizeof(Column::value_type) * CHAR_BIT);
+#endif
+}
+
+static size_t column_bytes(const Column& column, size_t n) noexcept {
+  return ceil_div(size_t(column_bits(column)) * n, size_t(CHAR_BIT));
+}
+
+static bool column_shared(const Column& column) noexcept {
+#if DATABASE_USE_PACKED_VECTOR
+  return column.borrowed();
+#else
+  return false;
+#endif
+}
+
+static ColumnStats column_stats(const Table& table, size_t i) {
+  const Column& column = *table.columns[i];
+  std::vector<int> values(column.size());
+  for (size_t j = 0; j < column.size(); ++j)
+    values[j] = column[j];
+  std::sort(values.begin(), values.end());
+
+  ColumnStats stats;
+  stats.table          = table.name;
+  stats.name           = table.column_names[i];
+  stats.size           = column.size();
+  stats.bytes          = column_bytes(column, column.size());
+  stats.capacity_bytes = column_bytes(column, column.capacity());
+  stats.shared_bytes   = column_shared(column) ? stats.bytes : 0;
+  stats.bits           = column_bits(column);
+  stats.distinct       = size_t(std::unique(values.begin(), values.end()) - values.begin());
+  return stats;
+}
+
+/* Adds the unreferenced and duplicate bytes of a plain string chunk */
+static void add_string_stats(const StringChunk& chunk, const std::vector<bool>& referenced, ChunkStats& stats) {
+  const char* data = chunk.data();
+  const size_t size = size_t(chunk.size());
+
+  std::vector<int> offsets;
+  offsets.reserve(size_t(chunk.count()));
+  for (size_t start = 1; start < size;) {
+    const size_t end = start + std::strlen(data + start);
+    bool is_referenced = false;
+    for (size_t i = start; i < end && !is_referenced; ++i)
+      is_referenced = referenced[i];
+    if (! is_referenced)
+      stats.unreferenced_bytes += end - start + 1;
+    offsets.push_back(int(start));
+    start = end + 1;
+  }
+
+  std::sort(offsets.begin(), offsets.end(), [&](int a, int b) {
+    return std::strcmp(data + a, data + b) < 0;
+  });
+  for (size_t i = 1; i < offsets.size(); ++i)
+    if (! std::strcmp(data + offsets[i-1], data + offsets[i]))
+      stats.duplicate_bytes += std::strlen(data + offsets[i]) + 1;
+}
+
+template<class TChunk>
+static size_t shrink_savings(const TChunk& chunk, const std::vector<Column*>& columns) {
+  if (chunk.is_shrinked())
+    return 0;
+
+  TChunk copy = chunk;
+  typename TChunk::Shrinker shrinker = copy.get_shrinker();
+  for (auto column : columns)
+    for (size_t i = 0; i < column->size(); ++i)
+      shrinker.add((*column)[i]);
+  shrinker.shrink();
+  return size_t(chunk.size() - copy.size());
+}
+
+static size_t chunk_shared_bytes(const StringChunk& chunk) noexcept {
+  return chunk.shared() ? size_t(chunk.size()) : 0;
+}
+
+static size_t chunk_shared_bytes(const FrontCodedChunk& chunk) noexcept {
+  return (chunk.shared() ? chunk.sorted_size() : 0) + chunk_shared_bytes(chunk.tail());
+}
+
+template<class TChunk>
+static ChunkStats make_chunk_stats(const char* name, const TChunk& chunk,
+    const std::vector<Column*>& columns, bool with_shrink_savings)
+{
+  ChunkStats stats;
+  stats.name               = name;
+  stats.bytes              = size_t(chunk.size());
+  stats.capacity_bytes     = size_t(chunk.capacity());
+  stats.shared_bytes       = chunk_shared_bytes(chunk);
+  stats.strings            = size_t(chunk.count());
+  stats.duplicate_bytes    = 0;
+  stats.unreferenced_bytes = 0;
+  stats.shrink_savings     = with_shrink_savings ? shrink_savings(chunk, columns) : 0;
+  return stats;
+}
+
+static ChunkStats chunk_stats(const char* name, const StringChunk& chunk,
+    const std::vector<Column*>& columns, bool with_shrink_savings)
+{
+  ChunkStats stats = make_chunk_stats(name, chunk, columns, with_shrink_savings);
+
+  // An ID may also point into the middle of a string (suffix sharing)
+  std::vector<bool> referenced(size_t(chunk.size()));
+  for (auto column : columns)
+    for (size_t i = 0; i < column->size(); ++i)
+      referenced[size_t((*column)[i])] = true;
+
+  add_string_stats(chunk, referenced, stats);
+  return stats;
+}
+
+/* Sizes of unreferenced strings in the sorted part are the decoded sizes */
+static ChunkStats chunk_stats(const char* name, const FrontCodedChunk& chunk,
+    const std::vector<Column*>& columns, bool with_shrink_savings)
+{
+  ChunkStats stats = make_chunk_stats(name, chunk, columns, with_shrink_savings);
+  const StringChunk& tail = chunk.tail();
+  const int sorted_count = chunk.sorted_count();
+
+  std::vector<bool> referenced(size_t(sorted_count + 1));
+  std::vector<bool> tail_referenced(size_t(tail.size()));
+  for (auto column : columns)
+    for (size_t i = 0; i < column->size(); ++i) {
+      const int id = (*column)[i];
+      if (id <= sorted_count)
+        referenced[size_t(id)] = true;
+      else
+        tail_referenced[size_t(id - sorted_count)] = true;
+    }
+
+  std::string buffer;
+  for (int id = 1; id <= sorted_count; ++id)
+    if (! referenced[size_t(id)])
+      stats.unreferenced_bytes += std::strlen(chunk.get(id, buffer)) + 1;
+
+  add_string_stats(tail, tail_referenced, stats);
+
+  // Strings of the tail that are already in the sorted part
+  for (int pos = 1; pos < tail.size();) {
+    const char* s = tail.get(pos);
+    const int id = chunk.find(s);
+    const int len = int(std::strlen(s));
+    if (id && id <= sorted_count)
+      stats.duplicate_bytes += size_t(len) + 1;
+    pos += len + 1;
+  }
+
+  return stats;
+}
+
+MemoryStats Database :: memory_stats(bool with_shrink_savings) const {
+  MemoryStats stats;
+
+  for (const auto table : tables)
+    for (size_t i = 0; i < table->columns.size(); ++i)
+      stats.columns.push_back(column_stats(*table, i));
+
+  for (const auto& cc : chunk_columns)
+    stats.chunks.push_back(chunk_stats(cc.name, *cc.chunk, cc.columns, with_shrink_savings));
+
+  for (const auto& cc : url_chunk_columns)
+    stats.chunks.push_back(chunk_stats(cc.name, *cc.chunk, cc.columns, with_shrink_savings));
+
+  return stats;
+}
+
+size_t MemoryStats :: bytes() const noexcept {
+  size_t sum = 0;
+  for (const auto& c : columns) sum += c.bytes;
+  for (const auto& c : chunks)  sum += c.bytes;
+  return sum;
+}
+
+size_t MemoryStats :: capacity_bytes() const noexcept {
+  size_t sum = 0;
+  for (const auto& c : columns) sum += c.capacity_bytes;
+  for (const auto& c : chunks)  sum += c.capacity_bytes;
+  return sum;
+}
+
+size_t MemoryStats :: shared_bytes() const noexcept {
+  size_t sum = 0;
+  for (const auto& c : columns) sum += c.shared_bytes;
+  for (const auto& c : chunks)  sum += c.shared_bytes;
+  return sum;
+}
+
+std::string MemoryStats :: to_json() const {
+  char buf[512];
+  std::string json;
+
+  std::sprintf(buf, "{\"bytes\":%zu,\"capacity_bytes\":%zu,\"shared_bytes\":%zu,\"columns\":[",
+      bytes(), capacity_bytes(), shared_bytes());
+  json.append(buf);
+
+  const char* comma = "";
+  for (const auto& c : columns) {
+    std::sprintf(buf, "%s{\"table\":\"%s\",\"name\":\"%s\",\"size\":%zu,"
+        "\"bytes\":%zu,\"capacity_bytes\":%zu,\"shared_bytes\":%zu,\"bits\":%d,\"distinct\":%zu}",
+        comma, c.table, c.name, c.size, c.bytes, c.capacity_bytes, c.shared_bytes, c.bits, c.distinct);
+    json.append(buf);
+    comma = ",";
+  }
+
+  json.append("],\"chunks\":[");
+
+  comma = "";
+  for (const auto& c : chunks) {
+    std::sprintf(buf, "%s{\"name\":\"%s\",\"bytes\":%zu,\"capacity_bytes\":%zu,"
+        "\"shared_bytes\":%zu,\"strings\":%zu,\"duplicate_bytes\":%zu,\"unreferenced_bytes\":%zu,"
+        "\"shrink_savings\":%zu}",
+        comma, c.name, c.bytes, c.capacity_bytes, c.shared_bytes, c.strings, c.duplicate_bytes,
+        c.unreferenced_bytes, c.shrink_savings);
+    json.append(buf);
+    comma = ",";
+  }
+
+  json.append("]}");
+  return json;
+}
+
 /* ============================================================================
  * Database :: Table
  * ==========================================================================*/
 
 /* Find a record by its URL or create one if it could not be found */
-template<typename TTable>
-static typename TTable::value_type find_by_url(TTable& table, StringChunk& chunk, CString url, bool create) {
+template<typename TTable, typename TChunk>
+static typename TTable::value_type find_by_url(TTable& table, TChunk& chunk, CString url, bool create) {
   if (url.empty())
     return typename TTable::value_type(NULL, 0);
 
   int strId = chunk.find(url);
   if (strId) {
-    auto pos = std::find(table.url.begin(), table.url.end(), strId);
-    if (pos != table.url.end())
-      return typename TTable::value_type(&table, size_t(pos - table.url.begin()));
+    auto pos = table.url.begin();
+    while ((pos = std::find(pos, table.url.end(), strId)) != table.url.end()) {
+      if (! table.is_deleted(pos.index()))
+        return typename TTable::value_type(&table, pos.index());
+      ++pos;
+    }
   }
 
   if (create) {
@@ -260,8 +1189,8 @@ Albums::Album Albums::find(CString url, bool create) {
 }
 
 Field Albums::Album::operator[](ColumnID id) const noexcept {
+  // URLs are decoded into a std::string (see UrlChunk), Field can't own them
   switch (static_cast<AlbumColumnID>(id)) {
-  case ALBUM_URL:             return Field(url());
   case ALBUM_COVER_URL:       return Field(cover_url());
   case ALBUM_TITLE:           return Field(title());
   case ALBUM_ARTIST:          return Field(artist());
@@ -291,6 +1220,39 @@ Tracks::Track Tracks::find(CString url, bool create) {
   return find_by_url(*this, db.chunk_track_url, url, create);
 }
 
+/* Returns all tracks of an album. The clustered part of the table is binary
+ * searched, only the tracks added after the last compaction are scanned. */
+std::vector<Tracks::Track> Tracks::find_by_album(size_t album) {
+  std::vector<Track> result;
+  const int album_id_ = int(album);
+
+  size_t lo = 1, hi = clustered;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (album_id[mid] < album_id_)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (size_t id = lo; id < clustered && album_id[id] == album_id_; ++id)
+    if (! is_deleted(id))
+      result.push_back(Track(this, id));
+
+  for (size_t id = clustered; id < size(); ++id)
+    if (album_id[id] == album_id_ && ! is_deleted(id))
+      result.push_back(Track(this, id));
+
+  return result;
+}
+
+/* Determines how many rows are ordered by album_id */
+void Tracks::update_clustered() noexcept {
+  clustered = 1;
+  while (clustered < size() && (clustered == 1 || album_id[clustered - 1] <= album_id[clustered]))
+    ++clustered;
+}
+
 Albums::Album Tracks::Track::album() const noexcept {
   return table->db.albums[size_t(table->album_id[id])];
 }
@@ -306,6 +1268,247 @@ Field Tracks::Track::operator[](ColumnID id) const noexcept {
   }
 }
 
+// ============================================================================
+// Batch ======================================================================
+// ============================================================================
+
+void Batch :: clear() noexcept {
+  _albums.clear();
+  _ranges.clear();
+  _styles.clear();
+  _tracks.clear();
+  _results.clear();
+}
+
+/* Resolves the URLs of `items` to rows of `table` (0 for an empty URL).
+ * Unknown URLs get new rows, items having the same unknown URL share one.
+ * The table is resized once for all of them. */
+template<class TTable, class TChunk, class TItem>
+void Batch :: find_rows(TTable& table, TChunk& chunk, const std::vector<TItem>& items, std::vector<size_t>& ids) {
+  ids.assign(items.size(), 0);
+  _url_ids.resize(items.size());
+  _wanted.clear();
+  for (size_t i = 0; i < items.size(); ++i)
+    if ((_url_ids[i] = chunk.find(items[i].url)))
+      _wanted.push_back(std::make_pair(_url_ids[i], i));
+
+  // Known URLs are searched in a single pass over the url column
+  if (! _wanted.empty()) {
+    std::sort(_wanted.begin(), _wanted.end());
+    const int min = _wanted.front().first;
+    const int max = _wanted.back().first;
+    size_t found = 0;
+    for (auto pos = table.url.begin(); pos != table.url.end() && found < _wanted.size(); ++pos) {
+      const int url_id = *pos;
+      if (url_id < min || url_id > max || table.is_deleted(pos.index()))
+        continue;
+
+      auto it = std::lower_bound(_wanted.begin(), _wanted.end(), std::make_pair(url_id, size_t(0)));
+      for (; it != _wanted.end() && it->first == url_id; ++it)
+        if (! ids[it->second]) {
+          ids[it->second] = pos.index();
+          ++found;
+        }
+    }
+  }
+
+  const size_t old_size = table.size();
+  size_t size = old_size;
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (ids[i] || items[i].url.empty())
+      continue;
+
+    NewString& url = intern(&chunk, items[i].url);
+    if (! url.row) {
+      url.id  = (_url_ids[i] ? _url_ids[i] : chunk.add_unchecked(items[i].url));
+      url.row = size++;
+    }
+    ids[i] = url.row;
+    _url_ids[i] = url.id;
+  }
+
+  if (size > old_size) {
+    if (size > table.columns[0]->capacity())
+      table.reserve(std::max(size, old_size + old_size / 8));
+    table.resize(size);
+    for (size_t i = 0; i < items.size(); ++i)
+      if (ids[i] >= old_size)
+        table.url[ids[i]] = _url_ids[i];
+  }
+}
+
+/* Returns the entry of `s` in the hash table of new strings, a new one has
+ * `id` and `row` set to 0. The table is never more than half full. */
+Batch::NewString& Batch :: intern(const void* chunk, CString s) {
+  uint64_t hash = 14695981039346656037ULL ^ reinterpret_cast<uintptr_t>(chunk);
+  for (const char* c = s; c != s + s.len; ++c) {
+    hash ^= static_cast<unsigned char>(*c);
+    hash *= 1099511628211ULL;
+  }
+
+  const size_t mask = _strings.size() - 1;
+  for (size_t i = size_t(hash) & mask;; i = (i + 1) & mask) {
+    NewString& entry = _strings[i];
+    if (! entry.s) {
+      entry = NewString{chunk, s, s.len, 0, 0};
+      return entry;
+    }
+    if (entry.chunk == chunk && entry.len == s.len && ! std::memcmp(entry.s, s, s.len))
+      return entry;
+  }
+}
+
+template<class TChunk>
+int Batch :: add_string(TChunk& chunk, CString s) {
+  if (s.empty())
+    return 0;
+
+  NewString& entry = intern(&chunk, s);
+  if (! entry.id)
+    entry.id = chunk.add_unchecked(s);
+  return entry.id;
+}
+
+void Batch :: set(Column& column, size_t row, int value) {
+  const int old = column[row];
+  if (old != value) {
+    _changes.push_back(Change{&column, row, old});
+    column[row] = value;
+  }
+}
+
+template<class TChunk>
+void Batch :: set_string(BasicStringColumn<TChunk>& column, size_t row, CString s) {
+  if (column[row] ? std::strcmp(ConstChars(column.get(row)), s) != 0 : ! s.empty())
+    set(column, row, add_string(column.string_chunk(), s));
+}
+
+void Database :: insert(Batch& batch) {
+  ++_generation;
+  std::array<size_t, 3> table_sizes;
+  std::array<int, 4> chunk_sizes;
+  std::array<int, 3> tail_sizes;
+  for (size_t i = 0; i < tables.size(); ++i)
+    table_sizes[i] = tables[i]->size();
+  for (size_t i = 0; i < chunks.size(); ++i)
+    chunk_sizes[i] = chunks[i]->size();
+  for (size_t i = 0; i < url_chunks.size(); ++i)
+    tail_sizes[i] = url_chunks[i]->tail().size();
+  const size_t clustered = tracks.clustered;
+
+  batch._results.clear();
+  batch._changes.clear();
+
+  try {
+    batch._results.reserve(batch._albums.size());
+    const size_t max_strings =
+      8 * batch._albums.size() + 4 * batch._tracks.size() + batch._styles.size();
+    batch._strings.assign(size_t(1) << bitlength(2 * max_strings), Batch::NewString{NULL, NULL, 0, 0, 0});
+
+    batch.find_rows(albums, chunk_album_url, batch._albums, batch._album_ids);
+    batch.find_rows(tracks, chunk_track_url, batch._tracks, batch._track_ids);
+
+    // New rows are numbered in the order of their first appearance, so a row
+    // seen before is either an old one or belongs to an earlier item
+    size_t next_album = table_sizes[1];
+    size_t next_track = table_sizes[2];
+
+    for (size_t i = 0; i < batch._albums.size(); ++i) {
+      const Batch::Album& album = batch._albums[i];
+      const size_t id = batch._album_ids[i];
+      const bool last = (i + 1 == batch._albums.size());
+      const size_t styles_end = (last ? batch._styles.size() : batch._ranges[i + 1].styles);
+      const size_t tracks_end = (last ? batch._tracks.size() : batch._ranges[i + 1].tracks);
+
+      Batch::Result result = {id, id < next_album, false, 0, 0};
+      if (id == next_album)
+        ++next_album;
+      if (! id) {
+        batch._results.push_back(result);
+        continue;
+      }
+
+      // Styles ===============================================================
+      unsigned style_ids = 0;
+      for (size_t s = batch._ranges[i].styles; s < styles_end; ++s) {
+        auto style = styles.find(batch._styles[s].url, true);
+        if (! style)
+          continue;
+        if (! *style.name())
+          batch.set_string(styles.name, style.id, batch._styles[s].name);
+        style_ids |= (1U << (style.id - 1));
+      }
+
+      // Album ================================================================
+      result.known = result.existed
+        && ! std::strcmp(albums.title.get(id), album.title)
+        && ! std::strcmp(albums.artist.get(id), album.artist)
+        && album.date == Albums::Album::date_expand(albums.date[id]);
+
+      batch.set_string(albums.title,       id, album.title);
+      batch.set_string(albums.artist,      id, album.artist);
+      batch.set_string(albums.cover_url,   id, album.cover_url);
+      batch.set_string(albums.description, id, album.description);
+      batch.set(albums.date,           id, Albums::Album::date_shrink(album.date));
+      batch.set(albums.rating,         id, int(album.rating * 100));
+      batch.set(albums.votes,          id, album.votes);
+      batch.set(albums.download_count, id, album.download_count);
+      batch.set(albums.styles,         id, int(style_ids));
+      if (! album.archive_mp3_url.empty())
+        batch.set_string(albums.archive_mp3,  id, album.archive_mp3_url);
+      if (! album.archive_wav_url.empty())
+        batch.set_string(albums.archive_wav,  id, album.archive_wav_url);
+      if (! album.archive_flac_url.empty())
+        batch.set_string(albums.archive_flac, id, album.archive_flac_url);
+
+      // Tracks ===============================================================
+      for (size_t t = batch._ranges[i].tracks; t < tracks_end; ++t) {
+        const Batch::Track& track = batch._tracks[t];
+        const size_t track_id = batch._track_ids[t];
+        if (! track_id) {
+          result.known = false;
+          continue;
+        }
+
+        const bool existed = (track_id < next_track);
+        if (track_id == next_track)
+          ++next_track;
+        result.known = result.known && existed && size_t(tracks.album_id[track_id]) == id;
+        if (existed)
+          ++result.tracks_updated;
+        else
+          ++result.tracks_new;
+
+        if (track_id < tracks.clustered && int(id) != tracks.album_id[track_id])
+          tracks.clustered = std::max<size_t>(track_id, 1);
+        batch.set(tracks.album_id, track_id, int(id));
+        batch.set_string(tracks.title,  track_id, track.title);
+        batch.set_string(tracks.artist, track_id, track.artist);
+        batch.set_string(tracks.remix,  track_id, track.remix);
+        batch.set(tracks.number, track_id, track.number);
+        batch.set(tracks.bpm,    track_id, track.bpm & 0xFF /* max 255 */);
+      }
+
+      batch._results.push_back(result);
+    }
+  }
+  catch (...) {
+    for (auto it = batch._changes.rbegin(); it != batch._changes.rend(); ++it)
+      (*it->column)[it->row] = it->value;
+    for (size_t i = 0; i < tables.size(); ++i)
+      tables[i]->resize(table_sizes[i]);
+    for (size_t i = 0; i < chunks.size(); ++i)
+      if (chunks[i]->size() != chunk_sizes[i])
+        chunks[i]->resize(size_t(chunk_sizes[i]));
+    for (size_t i = 0; i < url_chunks.size(); ++i)
+      if (url_chunks[i]->tail().size() != tail_sizes[i])
+        url_chunks[i]->tail().resize(size_t(tail_sizes[i]));
+    tracks.clustered = clustered;
+    batch._results.clear();
+    throw;
+  }
+}
+
 // ============================================================================
 // ============================================================================
 // ============================================================================
@@ -365,8 +1568,8 @@ int main () {
 
   /* Test: ROW with ID 0 is actually empty */
   assert (strlen(db.styles[0].url()) == 0);
-  assert (strlen(db.albums[0].url()) == 0);
-  assert (strlen(db.tracks[0].url()) == 0);
+  assert (db.albums[0].url().empty());
+  assert (db.tracks[0].url().empty());
 
   auto styles = db.get_styles();
   auto albums = db.get_albums();
@@ -381,24 +1584,24 @@ int main () {
   assert (tracks.size() == db.tracks.size() - 1);
   /* Test: First row of database contains valid data */
   assert (strlen(db.styles[1].url()));
-  assert (strlen(db.albums[1].url()));
-  assert (strlen(db.tracks[1].url()));
+  assert (! db.albums[1].url().empty());
+  assert (! db.tracks[1].url().empty());
   /* Test: First row of result set contains valid data */
   assert (strlen(styles[0].url()));
-  assert (strlen(albums[0].url()));
-  assert (strlen(tracks[0].url()));
+  assert (! albums[0].url().empty());
+  assert (! tracks[0].url().empty());
   /* Test: The first row of a result set equals the first record of a table */
   assert (styles[0].url() == db.styles[1].url());
   assert (albums[0].url() == db.albums[1].url());
   assert (tracks[0].url() == db.tracks[1].url());
   /* Test: Last row of database contains valid data */
   assert (strlen(db.styles[db.styles.size() - 1].url()));
-  assert (strlen(db.albums[db.albums.size() - 1].url()));
-  assert (strlen(db.tracks[db.tracks.size() - 1].url()));
+  assert (! db.albums[db.albums.size() - 1].url().empty());
+  assert (! db.tracks[db.tracks.size() - 1].url().empty());
   /* Test: Last row of result set */
   assert (strlen(styles[styles.size() - 1].url()));
-  assert (strlen(albums[albums.size() - 1].url()));
-  assert (strlen(tracks[tracks.size() - 1].url()));
+  assert (! albums[albums.size() - 1].url().empty());
+  assert (! tracks[tracks.size() - 1].url().empty());
 
   /* Test: shrink_to_fit() ================================================= */
   {
@@ -411,9 +1614,141 @@ int main () {
       assert(streq(db.albums[i].title(), db2.albums[i].title()));
     for (const auto& chunk : db2.chunks)
       assert(chunk->is_shrinked());
+    for (const auto& chunk : db2.url_chunks)
+      assert(chunk->is_shrinked());
     db2.save(TEST_DB ".shrinked");
   }
 
+  /* Test: erase() + compaction ============================================ */
+  {
+    Database::Database db2;
+    db2.load(TEST_DB);
+    auto track = db2.tracks[db2.tracks.size() - 1];
+    std::string title = track.title();
+    std::string album_title = track.album().title();
+    const size_t album_tracks = size_t(count_if(db2.tracks.begin(), db2.tracks.end(),
+      [](const Database::Tracks::Track& t) { return t.album_id() == 1; }));
+
+    db2.albums.erase(1);
+    assert(db2.get_albums().size() == db.get_albums().size() - 1);
+    assert(! db2.albums.find(db.albums[1].url(), false));
+
+    db2.compaction.start();
+    while (db2.compaction.step(100));
+    assert(db2.albums.size() == db.albums.size() - 1);
+    assert(db2.tracks.size() == db.tracks.size() - album_tracks);
+
+    track = Database::renumbered(track);
+    assert(streq(track.title(), title.c_str()));
+    assert(streq(track.album().title(), album_title.c_str()));
+    for (auto t : db2.tracks)
+      assert(t.album_id() > 0 && size_t(t.album_id()) < db2.albums.size());
+    for (const auto& chunk : db2.memory_stats(false).chunks)
+      assert(chunk.unreferenced_bytes == 0);
+  }
+
+  /* Test: Changes made while compacting are kept ========================= */
+  {
+    Database::Database db2;
+    db2.load(TEST_DB);
+    db2.albums.erase(1);
+    db2.compaction.start();
+    db2.compaction.step(100);
+    assert(db2.compaction.running());
+
+    const std::string url = db2.albums[2].url();
+    db2.albums.erase(2);
+    while (db2.compaction.step(100));
+    assert(db2.albums.size() == db.albums.size() - 2);
+    assert(! db2.albums.find(url.c_str(), false));
+  }
+
+  /* Test: Clustering tracks by album ====================================== */
+  {
+    Database::Database db2;
+    db2.load(TEST_DB);
+    db2.compaction.finish();
+    assert(db2.tracks.clustered == db2.tracks.size());
+    assert(db2.get_tracks().size() == tracks.size());
+
+    for (auto album : db2.albums) {
+      auto album_tracks = db2.tracks.find_by_album(album.id);
+      for (size_t i = 1; i < album_tracks.size(); ++i) {
+        assert(album_tracks[i].id == album_tracks[i-1].id + 1);
+        assert(album_tracks[i].number() >= album_tracks[i-1].number());
+      }
+    }
+  }
+
+  /* Test: publish() + attach() =========================================== */
+  {
+    db.publish(TEST_DB ".shared");
+    Database::Database db2;
+    db2.attach(TEST_DB ".shared");
+    assert(db2.attached());
+    for (size_t i = 0; i < db.tracks.size(); ++i) {
+      assert(db.tracks[i].url() == db2.tracks[i].url());
+      assert(streq(db.tracks[i].title(), db2.tracks[i].title()));
+      assert(db.tracks[i].album_id() == db2.tracks[i].album_id());
+    }
+
+    // Modifications are private to the attached database
+    db2.tracks[1].number(99);
+    db2.tracks.find("https://new-track-url", true).title("New title");
+    assert(db2.tracks[1].number() == 99);
+    assert(db.tracks[1].number() != 99);
+    assert(! db.tracks.find("https://new-track-url", false));
+
+    except(db2.attach(TEST_DB ".shared"));
+  }
+
+  /* Test: insert() ======================================================= */
+  {
+    Database::Database db2;
+    Database::Batch batch;
+    batch.add_album({"album-1", "Album 1", "Artist", "cover-1", "", "album-1-mp3", "", "", 86400 * 20000, 4.5f, 10, 100});
+    batch.add_style("style-1", "Style 1");
+    batch.add_track({"track-1", "Track 1", "Artist", "",      1, 140});
+    batch.add_track({"track-2", "Track 2", "Artist", "Remix", 2, 300});
+    batch.add_album({"album-2", "Album 2", "Artist", "cover-2", "", "", "", "", 86400 * 20000, 3.0f, 1, 2});
+    batch.add_style("style-1", "Style 1");
+    batch.add_track({"track-3", "Track 3", "Other",  "",      1, 150});
+    db2.insert(batch);
+
+    assert(batch.results().size() == 2);
+    for (const auto& result : batch.results())
+      assert(! result.existed && ! result.known);
+    assert(batch.results()[0].tracks_new == 2 && batch.results()[1].tracks_new == 1);
+    assert(db2.albums.size() == 3 && db2.tracks.size() == 4 && db2.styles.size() == 2);
+
+    auto album = db2.albums.find("album-1", false);
+    assert(album && streq(album.title(), "Album 1") && album.archive_mp3_url() == "album-1-mp3");
+    assert(album.date() == 86400 * 20000 && album.rating() == 4.5f && album.styles() == 1);
+    auto track = db2.tracks.find("track-2", false);
+    assert(size_t(track.album_id()) == album.id && streq(track.remix(), "Remix") && track.bpm() == 300 % 256);
+    assert(db2.tracks.find("track-3", false).album().id == db2.albums.find("album-2", false).id);
+
+    // Strings that occur more than once in a batch are stored once
+    assert(db2.tracks.artist[1] == db2.tracks.artist[2]);
+    assert(db2.albums.artist[1] == db2.tracks.artist[1]);
+
+    // Inserting the same data again changes nothing
+    const size_t meta_size = size_t(db2.chunk_meta.size());
+    db2.insert(batch);
+    for (const auto& result : batch.results())
+      assert(result.existed && result.known && ! result.tracks_new);
+    assert(db2.albums.size() == 3 && db2.tracks.size() == 4);
+    assert(size_t(db2.chunk_meta.size()) == meta_size);
+
+    // Updates keep the archive URLs that are not given
+    batch.clear();
+    batch.add_album({"album-1", "Album 1 (Remastered)", "Artist", "cover-1", "", "", "", "", 86400 * 20000, 4.5f, 11, 100});
+    batch.add_track({"track-1", "Track 1", "Artist", "",      1, 140});
+    db2.insert(batch);
+    assert(batch.results()[0].existed && ! batch.results()[0].known);
+    assert(streq(album.title(), "Album 1 (Remastered)") && album.archive_mp3_url() == "album-1-mp3");
+  }
+
   /* Test: ORDER BY TRACK_TITLE ============================================ */
   vector<const char*> track_titles;
   for (auto track : tracks)
@@ -5,17 +5,23 @@
 #include <lib/genericiterator.hpp>
 #include <lib/packedvector.hpp>
 #include <lib/stringchunk.hpp>
+#include <lib/frontcodedchunk.hpp>
 #include <lib/stringpack.hpp>
 #include <lib/bit_tools.hpp>
+#include <lib/steppablesort.hpp>
 
 #include <array>
+#include <algorithm>
 #include <vector>
+#include <memory>
 #include <string>
+#include <utility>
 #include <cstring>
 #include <cassert>
 #include <initializer_list>
 
 #define DATABASE_USE_PACKED_VECTOR 1
+#define DATABASE_USE_FRONT_CODED_URLS 1
 
 namespace Database {
 
@@ -52,6 +58,10 @@ using CString = ConstCharsLen;
  * Splitting up the stringchunks also results in lower string IDs per chunk,
  * leading to smaller storage requirements in a bitpacked vector.
  *
+ * The album, track and archive URLs mostly share long prefixes (artist and
+ * album name). They are stored in a front coded chunk (see UrlChunk) that
+ * keeps them sorted and stores only the differing suffixes.
+ *
  * === Loading and Saving the database ===
  * Loading and saving is practically done by reading/writing the raw memory
  * to disk. Since the database file is not meant to be shared by other
@@ -59,6 +69,13 @@ using CString = ConstCharsLen;
  * validation is performed, so the database may be rebuilt on errors.
  * And after all the database is more like a cache.
  *
+ * === Shared snapshots ===
+ * publish() writes the database in the same format, but with all buffers
+ * aligned, so attach() can map the file (e.g. under /dev/shm) and use the
+ * buffers in place instead of loading them. Multiple instances share the
+ * same physical memory this way. The mapping is private: Modified columns
+ * get their own copies of the modified pages, modified chunks are copied.
+ *
  * === NOTES ===
  *
  * Records with ID == 0 (first row) are used for representing a NULL value.
@@ -211,17 +228,68 @@ struct Table {
   const char* name;
   Database &db;
   std::vector<Column*> columns;
+  std::vector<const char*> column_names;
+  std::vector<bool> deleted; // Tombstones, see erase()
+  std::vector<int>  remap;   // Old ID -> new ID of the last compaction
+  size_t deleted_count;
 
-  Table(const char* name, Database &db, std::vector<Column*> columns)
+  Table(const char* name, Database &db, std::vector<Column*> columns, std::vector<const char*> column_names)
   : name(name)
   , db(db)
   , columns(std::move(columns))
+  , column_names(std::move(column_names))
+  , deleted_count(0)
   {}
 
   size_t size() const noexcept { return columns[0]->size();                 }
   void   resize(size_t n)      { for (auto c : columns) c->resize(n);       }
   void   reserve(size_t n)     { for (auto c : columns) c->reserve(n);      }
   void   shrink_to_fit()       { for (auto c : columns) c->shrink_to_fit(); }
+
+  /* Marks a row as deleted. The row stays in the table until the next
+   * compaction, but it is skipped by iterators and find(). */
+  void erase(size_t id);
+
+  bool is_deleted(size_t id) const noexcept {
+    return id < deleted.size() && deleted[id];
+  }
+
+  /* Returns the ID a row got by the last compaction (0 if it was deleted) */
+  size_t new_id(size_t id) const noexcept {
+    return id < remap.size() ? size_t(remap[id]) : id;
+  }
+};
+
+// === Iterator over the rows of a table, skipping deleted ones =============
+template<typename TTable>
+class RowIterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using difference_type   = std::ptrdiff_t;
+  using value_type        = typename TTable::value_type;
+  using reference         = typename TTable::value_type;
+  using pointer           = void;
+
+  RowIterator(TTable* table, size_t id) noexcept
+  : _table(table)
+  , _id(id)
+  { skip_deleted(); }
+
+  reference    operator*()                    const noexcept { return (*_table)[_id]; }
+  RowIterator& operator++()                         noexcept { ++_id; skip_deleted(); return *this; }
+  RowIterator  operator++(int)                      noexcept { RowIterator old = *this; ++*this; return old; }
+  bool         operator==(const RowIterator& it) const noexcept { return _id == it._id; }
+  bool         operator!=(const RowIterator& it) const noexcept { return _id != it._id; }
+  size_t       index()                        const noexcept { return _id; }
+
+private:
+  TTable* _table;
+  size_t  _id;
+
+  void skip_deleted() noexcept {
+    while (_id < _table->size() && _table->is_deleted(_id))
+      ++_id;
+  }
 };
 
 // === Base class for all records ===========================================
@@ -241,20 +309,34 @@ struct Record {
  * Table definitions begin here
  * ========================================================================*/
 
-class StringColumn : public Column {
-  StringChunk& chunk;
+#if DATABASE_USE_FRONT_CODED_URLS
+using UrlChunk = FrontCodedChunk;
+#else
+using UrlChunk = StringChunk;
+#endif
+
+template<class TChunk>
+class BasicStringColumn : public Column {
+  TChunk& chunk;
 public:
-  StringColumn(StringChunk& chunk)
+  BasicStringColumn(TChunk& chunk)
     : chunk(chunk)
   {}
 
-  const char* get(size_t i) const noexcept {
+  // `const char*` for a StringChunk, `std::string` for a FrontCodedChunk
+  using value_type = decltype(std::declval<const TChunk&>().get(0));
+
+  value_type get(size_t i) const {
     return chunk.get((*this)[i]);
   }
 
+  TChunk& string_chunk() const noexcept {
+    return chunk;
+  }
+
   void set(size_t i, CString s) {
     auto string_id = (*this)[i];
-    if (!string_id || std::strcmp(chunk.get(string_id), s))
+    if (!string_id || std::strcmp(ConstChars(chunk.get(string_id)), s))
 #if 0
       (*this)[i] = chunk.add(s);
 #else /* this is faster */
@@ -263,12 +345,15 @@ public:
   }
 };
 
+using StringColumn = BasicStringColumn<StringChunk>;
+using UrlColumn    = BasicStringColumn<UrlChunk>;
+
 struct Styles : public Table {
   StringColumn url;
   StringColumn name;
 
   Styles(Database& db, StringChunk& chunk_url, StringChunk& chunk_name)
-  : Table("styles", db, {&url,&name})
+  : Table("styles", db, {&url,&name}, {"url","name"})
   , url(chunk_url)
   , name(chunk_name)
   {
@@ -290,8 +375,7 @@ struct Styles : public Table {
   using value_type = Style;
   using reference  = Style;
   using const_reference  = Style;
-  using iterator   = GenericIterator<Styles>;
-  using const_iterator   = GenericConstIterator<Styles>;
+  using iterator   = RowIterator<Styles>;
 
   value_type operator[](size_t id) { return value_type(this, id);   }
   iterator   begin()               { return iterator(this, 1);      }
@@ -300,7 +384,7 @@ struct Styles : public Table {
 };
 
 struct Albums : public Table {
-  StringColumn url;
+  UrlColumn    url;
   StringColumn title;
   StringColumn artist;
   StringColumn cover_url;
@@ -310,14 +394,16 @@ struct Albums : public Table {
   Column       votes;
   Column       download_count;
   Column       styles;
-  StringColumn archive_mp3;
-  StringColumn archive_wav;
-  StringColumn archive_flac;
+  UrlColumn    archive_mp3;
+  UrlColumn    archive_wav;
+  UrlColumn    archive_flac;
 
-  Albums(Database& db, StringChunk& chunk_album_url, StringChunk& chunk_cover_url, StringChunk& chunk_archive_url, StringChunk& chunk_desc, StringChunk& chunk_meta)
+  Albums(Database& db, UrlChunk& chunk_album_url, StringChunk& chunk_cover_url, UrlChunk& chunk_archive_url, StringChunk& chunk_desc, StringChunk& chunk_meta)
   : Table("albums", db,
     {&url,&title,&artist,&cover_url,&description,&date,&rating,&votes,
-      &download_count,&styles,&archive_mp3,&archive_wav,&archive_flac})
+      &download_count,&styles,&archive_mp3,&archive_wav,&archive_flac},
+    {"url","title","artist","cover_url","description","date","rating","votes",
+      "download_count","styles","archive_mp3","archive_wav","archive_flac"})
   , url(chunk_album_url)
   , title(chunk_meta)
   , artist(chunk_meta)
@@ -339,14 +425,14 @@ struct Albums : public Table {
 
     // GETTER
     Field  operator[](ColumnID) const noexcept;
-    ccstr  url()               const noexcept { return table->url.get(id);             }
+    std::string url()          const { return table->url.get(id);             }
     ccstr  title()             const noexcept { return table->title.get(id);           }
     ccstr  artist()            const noexcept { return table->artist.get(id);          }
     ccstr  cover_url()         const noexcept { return table->cover_url.get(id);       }
     ccstr  description()       const noexcept { return table->description.get(id);     }
-    ccstr  archive_mp3_url()   const noexcept { return table->archive_mp3.get(id);     }
-    ccstr  archive_wav_url()   const noexcept { return table->archive_wav.get(id);     }
-    ccstr  archive_flac_url()  const noexcept { return table->archive_flac.get(id);    }
+    std::string archive_mp3_url()  const { return table->archive_mp3.get(id);  }
+    std::string archive_wav_url()  const { return table->archive_wav.get(id);  }
+    std::string archive_flac_url() const { return table->archive_flac.get(id); }
     time_t date()              const noexcept { return date_expand(table->date[id]);   }
     float  rating()            const noexcept { return float(table->rating[id]) / 100; }
     int    votes()             const noexcept { return table->votes[id];               }
@@ -371,8 +457,7 @@ struct Albums : public Table {
   using value_type = Album;
   using reference  = Album;
   using const_reference  = Album;
-  using iterator   = GenericIterator<Albums>;
-  using const_iterator   = GenericConstIterator<Albums>;
+  using iterator   = RowIterator<Albums>;
 
   value_type operator[](size_t id) { return value_type(this, id);   }
   iterator   begin()               { return iterator(this, 1);      }
@@ -381,7 +466,7 @@ struct Albums : public Table {
 };
 
 struct Tracks : public Table {
-  StringColumn  url;
+  UrlColumn     url;
   Column        album_id;
   StringColumn  title;
   StringColumn  artist;
@@ -389,12 +474,17 @@ struct Tracks : public Table {
   Column        number;
   Column        bpm;
 
-  Tracks(Database &db, StringChunk& chunk_track_url, StringChunk& chunk_meta)
-  : Table("tracks", db, {&url,&album_id,&title,&artist,&remix,&number,&bpm})
+  // Rows [1, clustered) are ordered by album_id, see Compaction
+  size_t        clustered;
+
+  Tracks(Database &db, UrlChunk& chunk_track_url, StringChunk& chunk_meta)
+  : Table("tracks", db, {&url,&album_id,&title,&artist,&remix,&number,&bpm},
+    {"url","album_id","title","artist","remix","number","bpm"})
   , url(chunk_track_url)
   , title(chunk_meta)
   , artist(chunk_meta)
   , remix(chunk_meta)
+  , clustered(1)
   {
     resize(1); // Records with ID 0 represent a NULL value. Create them here.
   }
@@ -404,7 +494,7 @@ struct Tracks : public Table {
 
     // GETTER
     Field operator[](ColumnID) const noexcept;
-    ccstr url()      const noexcept { return table->url.get(id);        }
+    std::string url() const   { return table->url.get(id);              }
     ccstr title()    const noexcept { return table->title.get(id);      }
     ccstr artist()   const noexcept { return table->artist.get(id);     }
     ccstr remix()    const noexcept { return table->remix.get(id);      }
@@ -419,21 +509,32 @@ struct Tracks : public Table {
     void  remix(CString s)  { table->remix.set(id, s);                   }
     void  number(int i)     { table->number[id] = i;                     }
     void  bpm(int i)        { table->bpm[id] = (i & 0xFF /* max 255 */); }
-    void  album_id(int i)   { table->album_id[id] = i;                   }
+    void  album_id(int i)   {
+      if (id < table->clustered && i != table->album_id[id])
+        table->clustered = std::max<size_t>(id, 1);
+      table->album_id[id] = i;
+    }
   };
 
   using value_type = Track;
   using reference  = Track;
   using const_reference  = Track;
-  using iterator   = GenericIterator<Tracks>;
-  using const_iterator   = GenericConstIterator<Tracks>;
+  using iterator   = RowIterator<Tracks>;
 
   value_type operator[](size_t id) { return value_type(this, id);   }
   iterator   begin()               { return iterator(this, 1);      }
   iterator   end()                 { return iterator(this, size()); }
   value_type find(CString url, bool create);
+  std::vector<Track> find_by_album(size_t album_id);
+  void       update_clustered()    noexcept;
 };
 
+/* Returns the record with the ID it got by the last compaction */
+template<typename TRecord>
+inline TRecord renumbered(const TRecord& r) noexcept {
+  return r.table ? TRecord(r.table, r.table->new_id(r.id)) : r;
+}
+
 /* ==========================================================================
  * Order-By + Where
  * ========================================================================*/
@@ -491,6 +592,269 @@ public:
   }
 };
 
+/* ==========================================================================
+ * Memory statistics
+ *
+ * `duplicate_bytes` are bytes of strings that are stored more than once in a
+ * chunk (add_unchecked() does not search for existing strings).
+ * `unreferenced_bytes` are bytes of strings that no column refers to anymore.
+ * `shrink_savings` is what shrink_to_fit() would free. Computing it requires
+ * shrinking a copy of the chunk, so it is optional.
+ * ========================================================================*/
+
+struct ColumnStats {
+  const char* table;
+  const char* name;
+  size_t size;              // number of values
+  size_t bytes;             // bytes occupied by the values
+  size_t capacity_bytes;    // bytes allocated
+  size_t shared_bytes;      // bytes used from a shared snapshot
+  int    bits;              // bits per value
+  size_t distinct;          // number of distinct values
+};
+
+struct ChunkStats {
+  const char* name;
+  size_t bytes;             // bytes used
+  size_t capacity_bytes;    // bytes allocated
+  size_t shared_bytes;      // bytes used from a shared snapshot
+  size_t strings;           // number of strings
+  size_t duplicate_bytes;
+  size_t unreferenced_bytes;
+  size_t shrink_savings;
+};
+
+struct MemoryStats {
+  std::vector<ColumnStats> columns;
+  std::vector<ChunkStats>  chunks;
+
+  size_t bytes()          const noexcept;
+  size_t capacity_bytes() const noexcept;
+  size_t shared_bytes()   const noexcept;
+  std::string to_json()   const;
+};
+
+/* ==========================================================================
+ * Compaction
+ *
+ * Deleted rows are only tombstoned. A compaction renumbers the rows of all
+ * tables leaving out the deleted ones, rewrites the references between them
+ * (Track::album_id, Album::styles) and removes unreferenced strings from the
+ * chunks. Tracks of a deleted album are deleted, too.
+ *
+ * The tracks are also clustered by album: They get ordered by album_id and
+ * track number, so the tracks of an album occupy a contiguous range of rows.
+ * Tracks added afterwards are appended to the table, so Tracks::clustered
+ * marks the end of the ordered part. A compaction is also needed if it does
+ * not cover the whole table.
+ *
+ * The work is done incrementally: Each call to step() handles at most
+ * `max_rows` rows of one table (or strings of one chunk):
+ *  - SCAN_ROWS:     Collect the rows to keep (the new order)
+ *  - SORT_TRACKS:   Cluster the tracks (see SteppableSort)
+ *  - COPY_ROWS:     Copy the rows into new columns
+ *  - CLEAN_CHUNKS:  Build new chunks holding only the strings referenced by
+ *                   the new columns and rewrite the string IDs of these
+ * The new columns and chunks replace the old ones at once in commit(), so
+ * the database stays readable in between. If it is modified by insert() or
+ * erase() meanwhile, step() starts over.
+ *
+ * Records that were obtained before need to be passed to renumbered()
+ * once the generation() changed.
+ * ========================================================================*/
+
+class Compaction {
+public:
+  Compaction(Database& db) noexcept
+  : _db(db)
+  , _state(IDLE)
+  , _phase(MARK)
+  , _generation(0)
+  , _track_sort(TrackOrder{&db})
+  {}
+
+  bool     needed()     const noexcept;
+  bool     running()    const noexcept { return _state != IDLE; }
+  unsigned generation() const noexcept { return _generation;    }
+
+  void start();
+  bool step(size_t max_rows); // Returns true if there is work left
+  void finish();              // Does a full compaction if needed
+
+private:
+  enum State : unsigned char { IDLE, SCAN_ROWS, SORT_TRACKS, COPY_ROWS, CLEAN_CHUNKS };
+  enum Phase : unsigned char { MARK, COLLECT, SORT, BUILD, REMAP }; // Of CLEAN_CHUNKS
+
+  // Orders tracks by album and track number
+  struct TrackOrder {
+    const Database* db;
+    bool operator()(int a, int b) const noexcept;
+  };
+
+  using String = std::pair<std::string, int>; // Front coded string, old ID
+
+  Database& _db;
+  State     _state;
+  Phase     _phase;
+  unsigned  _generation;
+  unsigned  _db_generation; // Of the database the new columns are built from
+  size_t    _table;  // Table being scanned or copied
+  size_t    _row;    // Position in the table, `_order` or the chunk
+  size_t    _chunk;  // Chunk being cleaned
+  size_t    _column; // Column being marked or remapped
+  std::vector<std::vector<int>>    _order;   // New ID -> old ID, per table
+  std::vector<std::vector<int>>    _remap;   // Old ID -> new ID, per table
+  std::vector<std::vector<Column>> _columns; // New columns, per table
+  SteppableSort<int, TrackOrder>   _track_sort;
+
+  // Cleaning of the current chunk
+  std::vector<Column*> _chunk_columns;    // The new columns referencing it
+  std::vector<bool>    _referenced;       // Old string ID -> referenced
+  std::vector<int>     _string_ids;       // Old string ID -> new string ID
+  std::vector<String>  _strings;          // Referenced strings to be sorted
+  SteppableSort<String> _string_sort;
+  std::unique_ptr<FrontCodedChunk::Builder> _builder;
+
+  // New chunks, in the order of Database::chunk_columns, url_chunk_columns
+  std::vector<StringChunk> _chunks;
+  std::vector<UrlChunk>    _url_chunks;
+
+  bool scan_rows(size_t max_rows);
+  bool copy_rows(size_t max_rows);
+  bool clean_chunk(size_t max_rows);
+  template<class TChunk>
+  bool clean_chunk(const TChunk& chunk, TChunk& new_chunk, size_t max_rows);
+  bool collect_strings(const StringChunk&, StringChunk&, size_t max_rows);
+  bool collect_strings(const FrontCodedChunk&, FrontCodedChunk&, size_t max_rows);
+  bool build_chunk(StringChunk&, size_t max_rows);
+  bool build_chunk(FrontCodedChunk&, size_t max_rows);
+  template<class TFunc>
+  bool for_each_row(size_t max_rows, TFunc);
+  Column& new_column(const Column*) noexcept;
+  void commit();
+  void abort();
+  int  translate(const Column*, int) const noexcept;
+};
+
+/* ==========================================================================
+ * Batch insert
+ *
+ * Database::insert() inserts or updates the albums of a batch together with
+ * their styles and tracks. Compared to find(url, true) and the setters it
+ *  - looks up all URLs of a table in a single pass over its url column,
+ *  - resizes the columns once for all new rows,
+ *  - adds each new string only once per batch (the setters append a changed
+ *    value even if the same string was just added for another row),
+ *  - is a transaction: If an exception is thrown (e.g. std::bad_alloc), the
+ *    database is rolled back to the state before the batch.
+ *
+ * The strings are not copied, they must stay valid until insert() returns.
+ * Empty archive URLs leave the stored ones untouched.
+ * ========================================================================*/
+
+class Batch {
+public:
+  struct Album {
+    CString url;
+    CString title;
+    CString artist;
+    CString cover_url;
+    CString description;
+    CString archive_mp3_url;
+    CString archive_wav_url;
+    CString archive_flac_url;
+    time_t  date;
+    float   rating;
+    int     votes;
+    int     download_count;
+  };
+
+  struct Track {
+    CString url;
+    CString title;
+    CString artist;
+    CString remix;
+    int     number;
+    int     bpm;
+  };
+
+  struct Result {
+    size_t   id;             // ID of the album record
+    bool     existed;        // The album was in the database before ...
+    bool     known;          // ... with the same title, artist and date, and so were all its tracks
+    int      tracks_new;
+    int      tracks_updated;
+  };
+
+  /* Adds an album, the styles and tracks added afterwards belong to it */
+  void add_album(const Album& album) {
+    _albums.push_back(album);
+    _ranges.push_back(Range{_styles.size(), _tracks.size()});
+  }
+
+  void add_style(CString url, CString name) { _styles.push_back(Style{url, name}); }
+  void add_track(const Track& track)        { _tracks.push_back(track);            }
+
+  void   clear()                         noexcept;
+  size_t size()                    const noexcept { return _albums.size(); }
+  bool   empty()                   const noexcept { return _albums.empty(); }
+  const std::vector<Result>& results() const noexcept { return _results; } // One per album
+
+private:
+  friend class Database;
+
+  struct Style {
+    CString url;
+    CString name;
+  };
+
+  // Begin of the styles and tracks of an album
+  struct Range {
+    size_t styles;
+    size_t tracks;
+  };
+
+  // Previous value of a cell, for rolling back
+  struct Change {
+    Column* column;
+    size_t  row;
+    int     value;
+  };
+
+  // Entry of the hash table of strings added by the batch (`row` is only
+  // used for URLs: the row the URL was given to)
+  struct NewString {
+    const void* chunk;
+    const char* s;
+    size_t      len;
+    int         id;
+    size_t      row;
+  };
+
+  std::vector<Album>  _albums;
+  std::vector<Range>  _ranges;
+  std::vector<Style>  _styles;
+  std::vector<Track>  _tracks;
+  std::vector<Result> _results;
+
+  // Scratch space of Database::insert(), kept to save allocations
+  std::vector<size_t> _album_ids;
+  std::vector<size_t> _track_ids;
+  std::vector<int>    _url_ids;
+  std::vector<std::pair<int, size_t>> _wanted; // URL string ID -> item
+  std::vector<NewString> _strings;
+  std::vector<Change> _changes;
+
+  template<class TTable, class TChunk, class TItem>
+  void find_rows(TTable&, TChunk&, const std::vector<TItem>&, std::vector<size_t>& ids);
+  NewString& intern(const void* chunk, CString);
+  template<class TChunk>
+  int  add_string(TChunk&, CString);
+  void set(Column&, size_t row, int value);
+  template<class TChunk>
+  void set_string(BasicStringColumn<TChunk>&, size_t row, CString);
+};
+
 class Database {
 public:
   Styles styles;
@@ -501,17 +865,29 @@ public:
   StringChunk chunk_meta;
   StringChunk chunk_desc;
   StringChunk chunk_style_url;
-  StringChunk chunk_album_url;
-  StringChunk chunk_track_url;
   StringChunk chunk_cover_url;
-  StringChunk chunk_archive_url;
-  std::array<StringChunk*, 7> chunks;
+  UrlChunk    chunk_album_url;
+  UrlChunk    chunk_track_url;
+  UrlChunk    chunk_archive_url;
+  std::array<StringChunk*, 4> chunks;
+  std::array<UrlChunk*, 3> url_chunks;
+  Compaction compaction;
 
   Database() noexcept;
 
   void load(const std::string&);
   void save(const std::string&) const;
+  void insert(Batch&);
   void shrink_to_fit();
+  MemoryStats memory_stats(bool with_shrink_savings = true) const;
+
+  // Shared snapshots
+  void publish(const std::string&) const;
+  void attach(const std::string&);
+  bool attached() const noexcept { return _snapshot.data; }
+
+  /* Changes whenever the data or the memory layout may have changed */
+  unsigned generation() const noexcept { return _generation; }
 
   inline std::vector<Styles::Style> get_styles()
   { return std::vector<Styles::Style>(styles.begin(), styles.end()); }
@@ -523,7 +899,33 @@ public:
   { return std::vector<Tracks::Track>(tracks.begin(), tracks.end()); }
 
 private:
-  static void shrink_chunk_to_fit(StringChunk&, std::initializer_list<Column*>);
+  friend struct Table;
+  friend class Compaction;
+
+  // Maps a chunk to the columns that hold references into it
+  template<class TChunk>
+  struct ChunkColumns {
+    const char* name;
+    TChunk* chunk;
+    std::vector<Column*> columns;
+  };
+  std::array<ChunkColumns<StringChunk>, 4> chunk_columns;
+  std::array<ChunkColumns<UrlChunk>, 3> url_chunk_columns;
+
+  template<class TChunk>
+  static void shrink_chunk_to_fit(TChunk&, const std::vector<Column*>&);
+
+  unsigned _generation;
+
+  // Private mapping of the attached snapshot, kept until destruction
+  struct Snapshot {
+    void*  data;
+    size_t size;
+    Snapshot() noexcept : data(NULL), size(0) {}
+   ~Snapshot();
+  } _snapshot;
+
+  void validate() const;
 };
 
 const char* track_column_to_string(const Tracks::Track&, ColumnID);
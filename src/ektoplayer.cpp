@@ -1,6 +1,7 @@
 #include "ektoplayer.hpp"
 
 #include <lib/string.hpp>
+#include <lib/arena.hpp>
 
 #include <cstring>
 
@@ -29,6 +30,27 @@ std::string& url_shrink(std::string& url, const char* prefix, const char* suffix
   return url;
 }
 
+ArenaString& url_shrink(ArenaString& url, const char* prefix, const char* suffix) {
+  (void) prefix; // UNUSED for now
+  url.replace_all("%20", ' ');
+
+  // url_dirname()
+  while (! url.empty() && url.back() == '/')
+    url.truncate(url.size() - 1);
+  for (size_t pos = url.size(); pos--;)
+    if (url[pos] == '/') {
+      url.remove_prefix(pos + 1);
+      break;
+    }
+
+  if (suffix) {
+    const size_t suffix_len = std::strlen(suffix);
+    if (url.size() >= suffix_len && ! std::strcmp(url.c_str() + url.size() - suffix_len, suffix))
+      url.truncate(url.size() - suffix_len);
+  }
+  return url;
+}
+
 std::string& url_expand(std::string& url, const char* prefix, const char* suffix) {
   url_escape(url);
   url.insert(0, prefix);
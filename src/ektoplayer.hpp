@@ -35,6 +35,8 @@
 #define EKTOPLAZM_COVER_URL_SIZE    67670     // average lenth: 32
 #define EKTOPLAZM_ARCHIVE_URL_SIZE  77070     // average lenth: 37
 
+struct ArenaString;
+
 namespace Ektoplayer {
 
 /// Return ektoplayer's configuration directory
@@ -71,6 +73,7 @@ static inline std::string browse_url(int page = 1) {
  *  "Obri - Afterglow - 2018 - "
  */
 std::string& url_shrink(std::string&, const char*, const char* suffix = NULL);
+ArenaString& url_shrink(ArenaString&, const char*, const char* suffix = NULL); // In place
 
 /**
  * Unshrink a previously shrinked ektoplazm URL
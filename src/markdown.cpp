@@ -3,79 +3,84 @@
 #include <lib/stringpack.hpp>
 #include <lib/xml/sax.hpp>
 
-#include <libxml/parser.h>
+#include <cstring>
 
-namespace {
+namespace Html2Markdown {
 
-struct State {
-  std::string result;
-  std::string url;
-};
+static const char* const removed_prefixes[] = { "https://", "http://", "www." };
 
-void startElement(void* self_, const xmlChar* name, const xmlChar** attrs) {
-  auto& self = *static_cast<State*>(self_);
+/* Longest string of removed_prefixes[] minus one. A prefix may be split
+ * across two appends, so this much of the compacted text is checked again */
+enum { PREFIX_OVERLAP = sizeof("https://") - 2 };
 
+void Converter :: startElement(const char* name, const char** attrs) {
   using pack = StringPack::Raw;
   switch (pack(name)) {
   case pack("i"):
   case pack("em"):
-    self.result.append(2, '_');
+    append('_', 2);
     break;
   case pack("b"):
   case pack("strong"):
-    self.result.append(2, '*');
+    append('*', 2);
     break;
-  case pack("a"):
-    self.result.append(2, '(');
-    self.url = Xml::Sax::Attributes(attrs)["href"].value;
+  case pack("a"): {
+    append('(', 2);
+    const char* href = Xml::Sax::Attributes(attrs)["href"].value;
+    const char* protection = std::strstr(href, "/cdn-cgi/l/email");
+    if (protection)
+      _url.assign(href, size_t(protection - href)).push_back('@');
+    else
+      _url.assign(href);
     break;
+  }
   case pack("br"):
-    self.result.append(1, '\n');
+    append('\n', 1);
     break;
   }
 }
 
-void endElement(void* self_, const xmlChar* name) {
-  auto& self = *static_cast<State*>(self_);
-
+void Converter :: endElement(const char* name) {
   using pack = StringPack::Raw;
   switch (pack(name)) {
   case pack("i"):
   case pack("em"):
-    self.result.append(2, '_');
+    append('_', 2);
     return;
   case pack("b"):
   case pack("strong"):
-    self.result.append(2, '*');
+    append('*', 2);
     return;
   case pack("a"):
-    self.result.append(2, ')');
-    self.result.append(2, '[');
-    self.result.append(self.url);
-    self.result.append(2, ']');
+    append(')', 2);
+    append('[', 2);
+    append(_url.data(), _url.size());
+    append(']', 2);
   }
 }
 
-void characters(void* self_, const xmlChar* ch, int len) {
-  auto& self = *static_cast<State*>(self_);
-  self.result.append(reinterpret_cast<const char*>(ch), size_t(len));
+void Converter :: characters(const char* s, size_t len) {
+  append(s, len);
 }
 
-} // namespace
-
-namespace Html2Markdown {
+void Converter :: append(const char* s, size_t len) {
+  _result.append(s, len);
+  compact();
+}
 
-std::string convert(const char* src, size_t size) {
-  xmlSAXHandler handler = {};
-  handler.startElement  = startElement;
-  handler.endElement    = endElement;
-  handler.characters    = characters;
+void Converter :: append(char c, size_t count) {
+  _result.append(count, c);
+  compact();
+}
 
-  State state;
-  state.result.reserve(size * 0.5);
-  ::xmlSAXUserParseMemory(&handler, &state, src, size);
-  return state.result;
+void Converter :: compact() {
+  const size_t from = (_compacted > PREFIX_OVERLAP ? _compacted - PREFIX_OVERLAP : 0);
+  for (const char* prefix : removed_prefixes) {
+    const size_t len = std::strlen(prefix);
+    for (size_t pos = from; (pos = _result.find(prefix, pos, len)) != std::string::npos;)
+      _result.erase(pos, len);
+  }
+  _compacted = _result.size();
 }
 
 } // namespace Html2Markdown
-
@@ -5,13 +5,36 @@
 
 namespace Html2Markdown {
   /**
-   * Converts:
+   * Converts the SAX events of an HTML fragment:
    *   Some HTML <a href="link url">link text</a> <b>bold</b> <i>italic</i>
    * to:
    *   Some HTML ((link text))[[url]] **bold** __italic__
+   *
+   * The markdown is written to `result` as the events arrive. It is made
+   * compact on the way: "https://", "http://" and "www." are removed and
+   * links to Cloudflare's email protection become "@". Removing `www.` *may*
+   * corrupt some URLs, but saves 20KB!
    */
-  std::string convert(const char*, size_t);
-  inline std::string convert(const std::string& s) { return convert(&s[0], s.size()); }
+  class Converter {
+  public:
+    Converter(std::string& result) noexcept : _result(result), _compacted(0) {}
+
+    /* Starts a new fragment */
+    void clear() noexcept { _result.clear(); _compacted = 0; }
+
+    void startElement(const char* name, const char** attrs);
+    void endElement(const char* name);
+    void characters(const char* s, size_t len);
+
+  private:
+    std::string& _result;
+    std::string  _url;       // Of the current link
+    size_t       _compacted; // Position up to which `_result` is compacted
+
+    void append(const char* s, size_t len);
+    void append(char c, size_t count);
+    void compact();
+  };
 }
 
 #endif
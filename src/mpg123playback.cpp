@@ -3,6 +3,7 @@
 #include "ektoplayer.hpp"
 
 #include <lib/process.hpp>
+#include <lib/sscan.hpp>
 #include <lib/string.hpp> // temp_sprintf
 #include <lib/stringpack.hpp>
 
@@ -10,7 +11,8 @@
 
 #include <memory>
 #include <cstdio>
-#include <cinttypes>
+#include <cstdint>
+#include <cstring>
 
 Mpg123Playback :: Mpg123Playback()
 : _failed(0)
@@ -36,14 +38,16 @@ void Mpg123Playback :: reset() noexcept {
   _track_completed = false;
 }
 
-void Mpg123Playback :: play(std::string file) noexcept {
+void Mpg123Playback :: play(std::string file, std::string retry_file) noexcept {
   _file = std::move(file);
+  _retry_file = std::move(retry_file);
   play();
 }
 
 void Mpg123Playback :: play() noexcept {
   reset();
   _state = LOADING;
+  _next_request = std::chrono::steady_clock::time_point();
   work();
 }
 
@@ -52,9 +56,25 @@ void Mpg123Playback :: stop() noexcept {
   reset();
 }
 
+int Mpg123Playback :: wait_time() const noexcept {
+  if (_state == STOPPED || _state == PAUSED)
+    return -1;
+
+  using namespace std::chrono;
+  const auto ms = duration_cast<milliseconds>(_next_request - steady_clock::now()).count();
+  return ms > 0 ? int(ms) : 0;
+}
+
 void Mpg123Playback :: work() noexcept {
-  if (_state == STOPPED)
+  if (_process) {
+    read_stdout();
+    read_stderr();
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (_state == STOPPED || now < _next_request)
     return;
+  _next_request = now + std::chrono::milliseconds(REQUEST_INTERVAL);
 
   // Start process if it died (or wasn't even started yet)
   if (!_process || !_process->running()) {
@@ -67,8 +87,6 @@ void Mpg123Playback :: work() noexcept {
     ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
   }
 
-  read_stdout();
-
   if (_state == LOADING)
     *_process << "SILENCE\nL " << _file << '\n';
 
@@ -76,27 +94,41 @@ void Mpg123Playback :: work() noexcept {
     *_process << "FORMAT\n";
 
   *_process << "SAMPLE\n";
+}
 
-  read_stdout();
-  read_stderr();
+/* End of file on a pipe: mpg123 has gone. Reap it, so its pipes are not
+ * reported as readable forever. It is restarted by the next request. */
+void Mpg123Playback :: process_exited() noexcept {
+  _process->kill();
+  _process->get_exit_status();
+  _process = nullptr;
 }
 
 void Mpg123Playback :: read_stderr() noexcept {
+  if (! _process)
+    return;
+
   char buffer[128];
   const ssize_t n = _process->stderr_pipe.read(buffer);
   if (n > 0)
     ++_failed;
+  else if (n == 0)
+    process_exited();
 }
 
 void Mpg123Playback :: read_stdout() noexcept {
   char buffer[512];
   const ssize_t len = _process->stdout_pipe.read(buffer);
+  if (len == 0) {
+    process_exited();
+    return;
+  }
 
   for (ssize_t i = 0; i < len; ++i)
     if (buffer[i] != '\n')
       _stdout_buffer.push_back(buffer[i]);
     else {
-      parse_stdout_line(_stdout_buffer.c_str());
+      parse_stdout_line(_stdout_buffer.c_str(), _stdout_buffer.size());
       _stdout_buffer.clear();
     }
 }
@@ -105,36 +137,45 @@ void Mpg123Playback :: read_stdout() noexcept {
  *   @FORMAT 44100 2
  *   @E Unknown command or no arguments: foo
  */
-void Mpg123Playback :: parse_stdout_line(const char* line) noexcept {
+void Mpg123Playback :: parse_stdout_line(const char* line, size_t len) noexcept {
   //log_write("PARSE: %s\n", line);
-  char* rest = const_cast<char*>(std::strchr(line, ' '));
+  const char* rest = static_cast<const char*>(std::memchr(line, ' ', len));
   if (! rest)
     return;
 
+  SScan scan(rest, len - size_t(rest - line));
   using pack = StringPack::Raw;
   switch (pack(line, size_t(rest-line))) {
-    case pack("@SAMPLE"): // 16063 21920052
-      if (_sample_rate) {
-        _seconds_played = std::strtoimax(rest, &rest, 10) / _sample_rate;
-        _seconds_total  = std::strtoimax(rest, &rest, 10) / _sample_rate;
+    case pack("@SAMPLE"): { // 16063 21920052
+      std::intmax_t played, total;
+      if (_sample_rate && scan.read_int(played).read_int(total)) {
+        _seconds_played = int(played / _sample_rate);
+        _seconds_total  = int(total / _sample_rate);
       }
       break;
+    }
     case pack("@FORMAT"): // 44100 2
-      _sample_rate = std::strtoimax(rest, &rest, 10);
-      _channels    = std::strtoimax(rest, &rest, 10);
+      scan.read_int(_sample_rate).read_int(_channels);
       break;
-    case pack("@F"): // 77 17466 2.01 456.25
-      std::strtoimax(rest, &rest, 10);
-      std::strtoimax(rest, &rest, 10);
-      _seconds_played    = int(std::strtof(rest, &rest));
-      _seconds_remaining = int(std::strtof(rest, &rest));
-      _seconds_total     = _seconds_played + _seconds_remaining;
+    case pack("@F"): { // 77 17466 2.01 456.25
+      int frame;
+      if (scan.read_int(frame).read_int(frame)
+          .read_fixed(_seconds_played, 0).read_fixed(_seconds_remaining, 0))
+        _seconds_total = _seconds_played + _seconds_remaining;
       break;
-    case pack("@P"): // 0|1|2
-      _state = static_cast<State>(std::atoi(rest));
+    }
+    case pack("@P"): { // 0|1|2
+      int state = 0;
+      scan.read_int(state);
+      _state = static_cast<State>(state);
       if (_state == STOPPED) {
-        if (_failed) // Try again if playback stopped because of failure
+        if (_failed) { // Try again if playback stopped because of failure
           _state = LOADING;
+          if (! _retry_file.empty()) {
+            _file.swap(_retry_file);
+            _retry_file.clear();
+          }
+        }
         else
           _track_completed = true;
       }
@@ -143,6 +184,7 @@ void Mpg123Playback :: parse_stdout_line(const char* line) noexcept {
         _failed = 0;
       }
       break;
+    }
     case pack("@E"): /* Error */ ++_failed;
     case pack("@I"): /* Info  */
     case pack("@J"): /* Jump  */
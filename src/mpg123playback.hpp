@@ -3,12 +3,25 @@
 
 #include <string>
 #include <memory>
+#include <chrono>
 #include <cstdint>
 
 #include <lib/process.hpp>
 
+/**
+ * Plays files using `mpg123 -R`.
+ *
+ * work() reads the output of mpg123 and, at most every REQUEST_INTERVAL,
+ * asks it for the playback position. It has to be called when one of the
+ * pipes (stdout_fd(), stderr_fd()) becomes readable or wait_time() elapsed.
+ *
+ * If playback fails it is retried, with `retry_file` if one was given. This
+ * is the downloaded file for a stream that can't be opened twice.
+ */
 class Mpg123Playback {
 public:
+  enum { REQUEST_INTERVAL = 1000 }; // Milliseconds
+
   enum State : uint8_t {
     STOPPED = 0, // <-.
     PAUSED  = 1, //    } Mpg123
@@ -19,8 +32,9 @@ public:
   Mpg123Playback();
 
   void work()             noexcept;
+  int  wait_time()  const noexcept; // Milliseconds until work() is due, -1 for none
   void play()             noexcept;
-  void play(std::string)  noexcept;
+  void play(std::string, std::string retry_file = std::string()) noexcept;
   void stop()             noexcept;
   void pause()            noexcept;
   void toggle()           noexcept;
@@ -40,9 +54,12 @@ public:
   int   length()             const noexcept { return _seconds_total;    }
   float percent()            const noexcept { return (length() ? float(position()) / length() : 0); }
   void  percent(float p)           noexcept { position(length() * p);   }
+  int   stdout_fd()          const noexcept { return _process ? _process->stdout_pipe.fd() : -1; }
+  int   stderr_fd()          const noexcept { return _process ? _process->stderr_pipe.fd() : -1; }
 
 private:
   std::string _file;
+  std::string _retry_file;
   uint8_t _failed; // Automatically gives up trying on overflow :3
   State   _state;
   bool    _track_completed;
@@ -53,11 +70,13 @@ private:
   int     _seconds_remaining;
   std::unique_ptr<Process> _process;
   std::string _stdout_buffer;
+  std::chrono::steady_clock::time_point _next_request;
 
   void reset()                        noexcept;
+  void process_exited()               noexcept;
   void read_stderr()                  noexcept;
   void read_stdout()                  noexcept;
-  void parse_stdout_line(const char*) noexcept;
+  void parse_stdout_line(const char*, size_t) noexcept;
 };
 
 #endif
@@ -7,57 +7,138 @@
 #include <lib/filesystem.hpp>
 #include <lib/process.hpp>
 
+#include <cstdlib>
+
 #include <unistd.h>
 
-std::string TrackLoader :: get_file_for_track(Database::Tracks::Track track, bool force_download) {
-  Filesystem::error_code e;
+/* Files in an album directory start with the track number */
+static int track_number(const char* filename) {
+  return std::atoi(filename);
+}
 
-  auto album_dir = Filesystem::path(Config::album_dir) / track.album().title();
-  if (Filesystem::exists(album_dir)) {
-    auto track_no = track.number();
-    for (const auto& f : Filesystem::directory_iterator(album_dir, e)) {
-      if (std::atoi(f.path().filename().c_str()) == track_no) {
-        log_write("Track %s -> ALBUM DIR: %s\n", track.title(), f);
-        return f.path().string();
-      }
-    }
+TrackLoader :: TrackLoader(Downloads& downloads) noexcept
+: _downloads(downloads)
+, _albums(track_number)
+{
+}
+
+void TrackLoader :: pin(const std::string& name, Downloads::Priority priority) {
+  if (priority != Downloads::Playback && priority != Downloads::Prefetch)
+    return;
+
+  std::string& pinned = _pinned[priority == Downloads::Prefetch];
+  if (pinned == name)
+    return;
+  if (! pinned.empty())
+    _cache.unpin(pinned);
+  _cache.pin(name);
+  pinned = name;
+}
+
+/* Plays `file` through a FIFO that is fed by its download */
+std::string TrackLoader :: open_stream(const std::string& name, const std::string& file) {
+  const char* tmp = std::getenv("TMPDIR");
+  const std::string fifo = std::string(tmp && *tmp ? tmp : "/tmp")
+    + "/ektoplayer-" + std::to_string(::getpid()) + ".fifo";
+
+  if (! _stream.open(fifo, file))
+    return file; // Play the growing file instead
+
+  _streamed = name;
+  return _stream.path();
+}
+
+std::string TrackLoader :: retry_file(const std::string& file) const {
+  if (_stream.is_open() && file == _stream.path())
+    return (Filesystem::path(Config::cache_dir) / _streamed).string();
+  return std::string();
+}
+
+std::string TrackLoader :: get_file_for_track(Database::Tracks::Track track, bool force_download, Downloads::Priority priority) {
+  // The player lets go of the previous stream
+  if (priority == Downloads::Playback) {
+    _stream.close();
+    _streamed.clear();
+  }
+
+  const char* album = track.album().title();
+  if (const std::string* file = _albums.find(album, track.number())) {
+    auto file_in_album = Filesystem::path(Config::album_dir) / album / *file;
+    log_write("Track %s -> ALBUM DIR: %s\n", track.title(), file_in_album);
+    return file_in_album.string();
   }
 
   std::string track_url = track.url();
   Filesystem::path track_file = track_url;
   track_file += ".mp3";
 
+  const std::string name = track_file.string();
   auto file_in_cache = Filesystem::path(Config::cache_dir) / track_file;
+  pin(name, priority);
 
   if (force_download)
-    Filesystem::remove(file_in_cache, e);
+    _cache.remove(name);
 
-  if (Filesystem::exists(file_in_cache)) {
+  _cache.sync();
+  if (_cache.contains(name)) {
     log_write("Track %s -> CACHE: %s\n", track.title(), file_in_cache);
+    _cache.access(name);
     return file_in_cache.string();
   }
 
+  const std::string part_file = file_in_cache.string() + EKTOPLAZM_DOWNLOAD_SUFFIX;
+
+  // Already being downloaded (prefetched), it is needed now
+  auto loading = _loading.find(name);
+  if (loading != _loading.end()) {
+    log_write("Track %s -> LOADING: %s\n", track.title(), part_file);
+    if (priority != Downloads::Playback)
+      return part_file;
+    _downloads.priority(loading->second, Downloads::Playback);
+    return open_stream(name, part_file);
+  }
+
   Ektoplayer::url_expand(track_url, EKTOPLAZM_TRACK_BASE_URL, ".mp3");
   log_write("Track %s -> DOWNLOAD: %s\n", track.title(), track_url);
+  download_track(name, track_url, ! force_download, priority);
+
+  return (priority == Downloads::Playback ? open_stream(name, part_file) : part_file);
+}
 
-  auto download = new FileDownload(track_url, file_in_cache.string() + EKTOPLAZM_DOWNLOAD_SUFFIX);
+void TrackLoader :: download_track(const std::string& name, const std::string& url, bool resume, Downloads::Priority priority) {
+  const auto file_in_cache = Filesystem::path(Config::cache_dir) / name;
+
+  auto download = new FileDownload(url, file_in_cache.string() + EKTOPLAZM_DOWNLOAD_SUFFIX, resume);
   download->setopt(CURLOPT_TIMEOUT, 60);
   download->setopt(CURLOPT_FOLLOWLOCATION, 1);
+  download->on_write([this, name](size_t offset, const char* data, size_t len) {
+    if (_streamed == name)
+      _stream.write(offset, data, len);
+  });
 
   _downloads.add_download(download, [=](Download& _dl, CURLcode e) {
     FileDownload& dl = static_cast<FileDownload&>(_dl);
     log_write("%s: %s [%d]\n", dl.effective_url(), curl_easy_strerror(e), dl.http_code());
 
     Filesystem::error_code ex;
-    if (e == CURLE_OK && dl.http_code() == 200)
+    _loading.erase(name);
+    if (dl.finish(e)) {
       Filesystem::rename(dl.filename(), file_in_cache, ex);
-    else
-      Filesystem::remove(dl.filename(), ex);
-
+      if (! ex)
+        _cache.add(name);
+      if (_streamed == name)
+        _stream.finish();
+    }
+    else if (_streamed == name) {
+      // The player fails on the closed stream and retries with the file in
+      // the cache (see retry_file()). Download it once more for that.
+      _stream.close();
+      _streamed.clear();
+      download_track(name, url, true, Downloads::Playback);
+    }
     return Downloads::Action::Remove;
-  });
-
-  return download->filename();
+  }, priority);
+  _loading[name] = download;
 }
 
 void TrackLoader :: download_album(const Database::Tracks::Track& track) {
@@ -72,16 +153,16 @@ void TrackLoader :: download_album(const Database::Tracks::Track& track) {
   std::string url = track.album().archive_mp3_url();
   Ektoplayer::url_expand(url, EKTOPLAZM_ARCHIVE_BASE_URL, "MP3.zip");
 
-  auto download = new FileDownload(url, archive.string() +  EKTOPLAZM_DOWNLOAD_SUFFIX);
+  auto download = new FileDownload(url, archive.string() +  EKTOPLAZM_DOWNLOAD_SUFFIX, true);
   download->setopt(CURLOPT_FOLLOWLOCATION, 1);
-  log_write("Starting download: %s -> %s\n", url, download->filename());
+  log_write("Starting download: %s -> %s (resuming at %zu)\n", url, download->filename(), download->resumed_from());
 
   _downloads.add_download(download, [=](Download& dl_, CURLcode e) {
     auto& dl = static_cast<FileDownload&>(dl_);
     log_write("%s: %s [%d]\n", dl.effective_url(), curl_easy_strerror(e), dl.http_code());
 
     Filesystem::error_code ex;
-    if (e == CURLE_OK && dl.http_code() == 200) {
+    if (dl.finish(e)) {
       if (Config::auto_extract_to_archive_dir) {
         auto file     = std::move(dl.filename()); // dl will vanish
         auto dest_dir = std::move(album_dir);
@@ -100,9 +181,7 @@ void TrackLoader :: download_album(const Database::Tracks::Track& track) {
         Filesystem::rename(dl.filename(), archive, ex);
       }
     }
-    else
-      Filesystem::remove(dl.filename(), ex);
 
     return Downloads::Action::Remove;
-  });
+  }, Downloads::Archive);
 }
@@ -4,19 +4,48 @@
 #include "database.hpp"
 
 #include <lib/downloads.hpp>
+#include <lib/filecache.hpp>
+#include <lib/directoryindex.hpp>
+#include <lib/fifostream.hpp>
 
 #include <string>
+#include <unordered_map>
 
+/* Downloads tracks (Downloads::Playback or Prefetch) and album archives
+ * (Downloads::Archive) through the shared Downloads.
+ * The tracks in `cache_dir` are managed by cache(), the last track requested
+ * for playback and for prefetching are pinned.
+ * The extracted albums in `album_dir` are looked up in albums().
+ * A track for playback that has to be downloaded is streamed: its file is
+ * a FIFO fed by the download through stream(). */
 class TrackLoader {
 public:
-  TrackLoader() {}
+  TrackLoader(Downloads& downloads) noexcept;
 
-  std::string get_file_for_track(Database::Tracks::Track, bool force_reload=false); /* throws */
+  std::string get_file_for_track(Database::Tracks::Track, bool force_reload=false,
+                                 Downloads::Priority = Downloads::Playback); /* throws */
   void download_album(const Database::Tracks::Track&); /* throws */
+
+  /* The file to play if playing `file` failed, the downloaded file for a stream */
+  std::string retry_file(const std::string& file) const;
+
   Downloads& downloads() noexcept { return _downloads; }
+  FileCache& cache()     noexcept { return _cache; }
+  DirectoryIndex& albums() noexcept { return _albums; }
+  FifoStream& stream()   noexcept { return _stream; }
 
 private:
-  Downloads _downloads;
+  Downloads& _downloads;
+  FileCache _cache;
+  DirectoryIndex _albums;
+  std::string _pinned[2]; // Playback, Prefetch
+  FifoStream _stream;
+  std::string _streamed;   // Name of the streamed track in the cache
+  std::unordered_map<std::string, Download*> _loading; // Tracks being downloaded by name
+
+  void pin(const std::string& name, Downloads::Priority);
+  void download_track(const std::string& name, const std::string& url, bool resume, Downloads::Priority);
+  std::string open_stream(const std::string& name, const std::string& file);
 };
 
 #endif
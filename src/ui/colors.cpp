@@ -1,6 +1,6 @@
 #include "colors.hpp"
 
-#include <cinttypes>
+#include <lib/sscan.hpp>
 
 using namespace UI;
 
@@ -23,9 +23,9 @@ short Color :: parse(const std::string& color) noexcept {
     if (color == it.name)
       return it.value;
 
-  char *end;
-  std::intmax_t i = std::strtoimax(color.c_str(), &end, 10);
-  if (! color.empty() && !*end && i >= -1 && i <= 256)
+  short i;
+  SScan scan(color);
+  if (scan.read_int(i) && scan.at_end() && i >= -1 && i <= 256)
     return i;
 
   return Invalid;
@@ -3,170 +3,821 @@
 #include "ektoplayer.hpp"
 #include "browsepage.hpp"
 #include "database.hpp"
-#include "markdown.hpp"
 
 #include <lib/stringpack.hpp>
 #include <lib/downloads.hpp>
+#include <lib/httpcache.hpp>
 #include <lib/string.hpp>
 
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
+#include <cinttypes>
+#include <iterator>
+#include <algorithm>
 
-#define BROWSEPAGE_HTML_SIZE (60 * 1024) // bytes
+#include <libxml/parser.h>
 
-static std::string& clean_str(std::string& s) {
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+enum { ARCHIVE_MP3, ARCHIVE_WAV, ARCHIVE_FLAC, ARCHIVE_SLOTS };
+
+static ArenaString& clean_str(ArenaString& s) {
   for (size_t pos; std::string::npos != (pos = s.find("  "));)
     s.erase(pos, 1);
   return s;
 }
 
-static std::string make_markdown(const std::string& description) {
-  std::string s = Html2Markdown::convert(description);
+/* Seconds the server asks us to wait (Retry-After), 0 if none */
+static long retry_after(const Download& dl) {
+#if LIBCURL_VERSION_NUM >= 0x074200 // 7.66.0
+  curl_off_t seconds = 0;
+  if (CURLE_OK == dl.getinfo(CURLINFO_RETRY_AFTER, seconds) && seconds > 0)
+    return long(seconds);
+#else
+  (void) dl;
+#endif
+  return 0;
+}
 
-  // Replace protected email links:
-  //  [[/cdn-cgi/l/email-protection#284b47444174...]]
-  // by
-  //  [[@]]
-  size_t pos = 0;
-  while (std::string::npos != (pos = s.find("/cdn-cgi/l/email", pos))) {
-    size_t end = s.find(']', pos);
-    if (end != std::string::npos)
-      s.replace(pos, end-pos, 1, '@');
-  }
+/* ============================================================================
+ * UpdaterStats
+ * ==========================================================================*/
+
+const char* const UpdaterStats::chunk_names[CHUNKS] = {
+  "meta", "desc", "style_url", "cover_url", "album_url", "track_url", "archive_url"
+};
+
+UpdaterStats :: UpdaterStats() noexcept
+: pages_requested(0)
+, pages_failed(0)
+, pages_retried(0)
+, concurrency(0)
+, pages_unchanged(0)
+, http_status()
+, bytes_received(0)
+, pages_parsed(0)
+, albums_new(0)
+, albums_updated(0)
+, albums_unchanged(0)
+, tracks_new(0)
+, tracks_updated(0)
+, chunk_bytes()
+{
+}
 
-  // Removing `www.` *may* corrupt some URLs, but saves 20KB!
-  erase_all(s, "https://");
-  erase_all(s, "http://");
-  erase_all(s, "www.");
+uint64_t UpdaterStats :: elapsed() const noexcept {
+  using namespace std::chrono;
+  if (started == steady_clock::time_point())
+    return 0;
+  const auto end = (finished == steady_clock::time_point() ? steady_clock::now() : finished);
+  return uint64_t(duration_cast<milliseconds>(end - started).count());
+}
+
+std::string UpdaterStats :: to_string(const Log2Histogram& h, const char* unit, uint64_t divisor) {
+  char buf[160];
+  std::snprintf(buf, sizeof(buf),
+      "n=%" PRIu64 " mean=%" PRIu64 "%s p50<=%" PRIu64 "%s p90<=%" PRIu64 "%s max=%" PRIu64 "%s",
+      h.count(), h.mean() / divisor, unit, h.percentile(50) / divisor, unit,
+      h.percentile(90) / divisor, unit, h.max() / divisor, unit);
+  return buf;
+}
 
+std::string UpdaterStats :: to_string() const {
+  char buf[512];
+  std::string s;
+
+  std::snprintf(buf, sizeof(buf),
+      "Elapsed: %" PRIu64 "ms\n"
+      "Pages: %d requested, %d failed, %d retried, %d unchanged, %d parsed\n"
+      "Concurrency: %d\n"
+      "HTTP status: 2xx=%d 3xx=%d 4xx=%d 5xx=%d none=%d\n"
+      "Received: %" PRIu64 " bytes\n",
+      elapsed(), pages_requested, pages_failed, pages_retried, pages_unchanged, pages_parsed,
+      concurrency,
+      http_status[2], http_status[3], http_status[4], http_status[5], http_status[0],
+      bytes_received);
+  s += buf;
+
+  s += "Fetch time: "      + to_string(fetch_time, "ms", 1000)      + '\n';
+  s += "First byte time: " + to_string(first_byte_time, "ms", 1000) + '\n';
+  s += "Page size: "       + to_string(page_bytes, "B")             + '\n';
+  s += "Parse time: "      + to_string(parse_time, "us")            + '\n';
+  s += "Insert time: "     + to_string(insert_time, "us")           + '\n';
+
+  std::snprintf(buf, sizeof(buf),
+      "Albums: %d new, %d updated, %d unchanged\n"
+      "Tracks: %d new, %d updated\n"
+      "String bytes added:",
+      albums_new, albums_updated, albums_unchanged, tracks_new, tracks_updated);
+  s += buf;
+
+  for (size_t i = 0; i < CHUNKS; ++i) {
+    std::snprintf(buf, sizeof(buf), " %s=%" PRIu64, chunk_names[i], chunk_bytes[i]);
+    s += buf;
+  }
+
+  s += '\n';
   return s;
 }
 
+/* ============================================================================
+ * Updater :: Page - a browse page being parsed by the workers
+ * ==========================================================================*/
+
+struct Updater::Page {
+  enum State : char { Loading, Finished, Aborted };
+
+  BrowsePageParser parser;
+  std::vector<Album> albums;      // Albums of the current parse run
+  std::vector<std::string> input; // Received data that has not been parsed yet
+  int number;
+  int num_albums;                 // Number of albums passed to the main thread
+  int inserted;                   // Number of albums inserted (main thread)
+  int known;                      // ... of those already known (main thread)
+  uint64_t parse_time;            // Microseconds spent by the workers
+  State state;
+  bool scheduled;                 // Page is queued or being parsed
+  bool failed;                    // Parser failed, further data is dropped
+
+  // HTTP cache (main thread)
+  std::string url;
+  HttpCache::Entry cached;        // Entry found in the cache
+  HttpCache::Entry response;      // Entry for the response, `meta` holds the album URLs
+  bool deferred;                  // Parsing waits until the body is compared with `cached`
+  bool cacheable;                 // Store `response` once all albums are inserted
+
+  Page(int number_, std::string url_)
+  : parser([this](Album& album) {
+      normalize_album(album, parser.arena());
+      albums.push_back(album);
+    })
+  , number(number_)
+  , num_albums(0)
+  , inserted(0)
+  , known(0)
+  , parse_time(0)
+  , state(Loading)
+  , scheduled(false)
+  , failed(false)
+  , url(std::move(url_))
+  , deferred(false)
+  , cacheable(false)
+  {
+    response.hash = HttpCache::HASH_INIT;
+  }
+};
+
 /* ============================================================================
  * Updater
  * ==========================================================================*/
 
-Updater :: Updater(Database::Database &db) noexcept
+Updater :: Updater(Database::Database &db, Downloads& downloads) noexcept
   : _db(db)
+  , _downloads(downloads)
+  , _mode(Full)
+  , _max_pages(0)
+  , _next_page(1)
+  , _window(1)
+  , _pages_in_flight(0)
+  , _limit()
+  , _batch(new Database::Batch)
+  , _num_pages(0)
+  , _stop(false)
+  , _event_fd(::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC))
 {
 }
 
-void Updater :: fetch_page(int page, std::string&& recycle_buffer) noexcept {
-  auto dl = new BufferDownload(Ektoplayer::browse_url(page));
+Updater :: ~Updater() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cond.notify_all();
+  for (auto& thread : _workers)
+    thread.join();
+  if (_event_fd >= 0)
+    ::close(_event_fd);
+}
+
+/* Wakes up the main thread, see fd() */
+void Updater :: notify() noexcept {
+  const uint64_t one = 1;
+  if (::write(_event_fd, &one, sizeof(one)) < 0)
+    log_write("Updater: could not write to eventfd\n");
+}
+
+bool Updater :: start_workers() noexcept {
+  if (! _workers.empty())
+    return true;
+
+  ::xmlInitParser(); // Has to be done before libxml is used by multiple threads
+
+  unsigned n = std::thread::hardware_concurrency();
+  n = (n > 2 ? std::min(n - 1, 4U) : 1);
+
+  try {
+    while (n--)
+      _workers.emplace_back(&Updater::worker, this);
+  } catch (const std::exception& e) {
+    log_write("%s\n", e);
+  }
+
+  return ! _workers.empty();
+}
+
+/* Parses the pending data of the queued pages. A page is only parsed by one
+ * worker at a time. */
+void Updater :: worker() noexcept {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  for (;;) {
+    _cond.wait(lock, [this]{ return _stop || ! _queue.empty(); });
+    if (_stop)
+      return;
+
+    std::shared_ptr<Page> page = std::move(_queue.front());
+    _queue.pop_front();
+    std::vector<std::string> input;
+    input.swap(page->input);
+    const Page::State state = page->state;
+    lock.unlock();
+
+    int num_pages = 0;
+    bool failed = page->failed;
+    const auto parse_start = std::chrono::steady_clock::now();
+    if (! failed && state != Page::Aborted) {
+      try {
+        for (const auto& chunk : input)
+          page->parser.parse_chunk(chunk.data(), chunk.size());
+        if (state == Page::Finished) {
+          page->parser.parse_chunk(NULL, 0, true);
+          num_pages = page->parser.num_pages();
+        }
+      } catch (const std::exception& e) {
+        log_write("%s\n", e);
+        failed = true;
+      }
+    }
+
+    page->parse_time += uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - parse_start).count());
+
+    lock.lock();
+    for (auto& album : page->albums)
+      _albums.emplace_back(page, std::move(album));
+    const bool have_albums = ! page->albums.empty();
+    page->num_albums += int(page->albums.size());
+    page->albums.clear();
+    page->failed = failed;
+
+    if (num_pages > 0 && (! _num_pages || num_pages < _num_pages))
+      _num_pages = num_pages;
+
+    if (have_albums || state == Page::Finished)
+      notify();
+
+    if (state != Page::Loading) {
+      page->scheduled = false;
+      if (state == Page::Finished) {
+        // A page that failed to parse is retired as well, once the albums
+        // parsed before the failure are inserted. It is not cached.
+        if (failed)
+          page->cacheable = false;
+        else {
+          ++_stats.pages_parsed;
+          _stats.parse_time.add(page->parse_time);
+        }
+        _parsed_pages.push_back(std::move(page));
+      }
+    }
+    else if (! page->input.empty() || page->state != Page::Loading)
+      _queue.push_back(std::move(page));
+    else
+      page->scheduled = false;
+  }
+}
+
+// Requires `_mutex` to be locked
+void Updater :: schedule(const std::shared_ptr<Page>& page) {
+  if (! page->scheduled) {
+    page->scheduled = true;
+    _queue.push_back(page);
+    _cond.notify_one();
+  }
+}
+
+void Updater :: use_cache(const std::string& directory) {
+  _cache.reset(new HttpCache(directory));
+}
+
+/* The received data is handed to the workers while the page is still being
+ * downloaded.
+ *
+ * If the page is in the cache, the request is made conditional and the data
+ * is held back until the response is complete: an unchanged page (304 or
+ * same hash) is not parsed at all. */
+void Updater :: fetch_page(int page, int attempt) noexcept {
+  std::shared_ptr<Page> job;
+  try {
+    job = std::make_shared<Page>(page, Ektoplayer::browse_url(page));
+  } catch (const std::exception& e) {
+    log_write("%s\n", e);
+    return;
+  }
+
+  ++_pages_in_flight;
+  ++_stats.pages_requested;
+
+  auto dl = new StreamDownload(job->url,
+    [this,job](StreamDownload& dl, const char* data, size_t size) {
+      if (dl.http_code() != 200)
+        return true; // Discard error pages
+      try {
+        if (_cache) {
+          job->response.body.append(data, size);
+          job->response.hash = HttpCache::hash(data, size, job->response.hash);
+          if (job->deferred)
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (job->failed)
+          return false;
+        job->input.emplace_back(data, size);
+        schedule(job);
+        return true;
+      } catch (const std::exception& e) {
+        log_write("%s\n", e);
+        return false;
+      }
+    });
   dl->setopt(CURLOPT_FOLLOWLOCATION, 1);
-  dl->buffer() = std::move(recycle_buffer);
-  dl->buffer().reserve(BROWSEPAGE_HTML_SIZE);
-  dl->buffer().clear();
 
-  _downloads.add_download(dl, [this,page](Download& dl_, CURLcode code) {
-    auto& dl = static_cast<BufferDownload&>(dl_);
+  if (_cache) {
+    job->deferred = _cache->load(job->url, job->cached);
+    HttpCache::prepare(*dl, job->cached, job->response);
+  }
+
+  _downloads.add_download(dl, [this,page,attempt,job](Download& dl_, CURLcode code) {
+    auto& dl = static_cast<StreamDownload&>(dl_);
     log_write("%s: %s [%d]\n", dl.effective_url(), curl_easy_strerror(code), dl.http_code());
+    record_fetch(dl, code);
 
-    if (code != CURLE_OK)
-      fetch_page(page);
-    else if (dl.http_code() == 404)
-      _max_pages = std::min(_max_pages, page);
-    else if (dl.http_code() == 200) {
-      BrowsePageParser parser(dl.buffer());
+    const bool ok = (code == CURLE_OK && dl.http_code() == 200);
+    if (code == CURLE_OK && job->deferred
+        && (dl.http_code() == 304 || (ok && job->response.hash == job->cached.hash))) {
+      page_unchanged(job, ok);
+      return Downloads::Action::Remove;
+    }
 
-      const int num_pages = parser.num_pages();
-      if (num_pages > 0 && num_pages < _max_pages)
-        _max_pages = num_pages;
+    try {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (ok && job->deferred)
+        job->input.push_back(job->response.body);
+      job->cacheable = (ok && _cache);
+      job->state = (ok ? Page::Finished : Page::Aborted);
+      schedule(job);
+    } catch (const std::exception& e) {
+      log_write("%s\n", e);
+      if (ok)
+        --_pages_in_flight;
+    }
 
-      insert_browsepage(parser);
+    // A finished page stays in flight until its albums are inserted, a page
+    // waiting for its retry as well. If the parser failed (CURLE_WRITE_ERROR)
+    // retrying won't help.
+    const bool overloaded = (code == CURLE_OK && (dl.http_code() == 429 || dl.http_code() >= 500));
+    if (! ok && ! ((overloaded || (code != CURLE_OK && code != CURLE_WRITE_ERROR))
+                   && retry(page, attempt, retry_after(dl))))
+      --_pages_in_flight;
 
-      int next_page = page + _downloads.parallel();
-      if (next_page <= _max_pages)
-        fetch_page(next_page, std::move(dl.buffer()));
-    }
+    if (code == CURLE_OK && dl.http_code() == 404)
+      _max_pages = std::min(_max_pages, page);
 
+    fill_window();
     return Downloads::Action::Remove;
-  });
+  }, Downloads::Catalog);
 }
 
-void Updater :: start(int pages) noexcept {
-  log_write("Started database update (max %d pages)\n", pages);
+void Updater :: start(int pages, Mode mode) noexcept {
+  if (_pages_in_flight || ! start_workers())
+    return;
+
+  log_write("Started %s database update (max %d pages)\n",
+      (mode == Incremental ? "incremental" : "full"), pages);
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = UpdaterStats();
+    _stats.started = std::chrono::steady_clock::now();
+    _num_pages = 0; // The site may have grown since the last update
+  }
+
+  _mode = mode;
   _max_pages = pages;
+  _next_page = 1;
+  _window = (mode == Incremental ? 1 : INT_MAX);
+  fill_window();
+}
+
+/* Hands a saved browse page to the workers, as if it had been downloaded.
+ * The page is in flight until its albums are inserted by work(), callers
+ * should limit pages_in_flight() to bound the memory. */
+bool Updater :: import_page(std::string source) noexcept {
+  if (! start_workers())
+    return false;
+
+  try {
+    auto job = std::make_shared<Page>(0, "");
+    job->input.push_back(std::move(source));
+    job->state = Page::Finished;
+    std::lock_guard<std::mutex> lock(_mutex);
+    schedule(job);
+  } catch (const std::exception& e) {
+    log_write("%s\n", e);
+    return false;
+  }
 
-  if (! (_downloads.running_downloads() + _downloads.queued_downloads()))
-    for (int i = 1; i <= _downloads.parallel(); ++i)
-      fetch_page(i);
+  ++_pages_in_flight;
+  return true;
 }
 
-void Updater :: insert_album(Album& album) noexcept {
-  // Album Styles =============================================================
-  unsigned albumStyleIDs = 0;
-  for (auto &style : album.styles) {
-    Ektoplayer::url_shrink(style.url, EKTOPLAZM_STYLE_BASE_URL);
-    auto styleRecord = _db.styles.find(style.url, true);
-    if (! *(styleRecord.name()))
-      styleRecord.name(style.name);
-    albumStyleIDs |= (1U << (styleRecord.id - 1));
+void Updater :: fill_window() noexcept {
+  while (_pages_in_flight < std::min(_window, _limit.limit()) && _next_page <= _max_pages)
+    fetch_page(_next_page++);
+
+  if (! _pages_in_flight && _next_page > _max_pages)
+    finish();
+}
+
+void Updater :: finish() noexcept {
+  if (_stats.started  == std::chrono::steady_clock::time_point() // Import
+   || _stats.finished != std::chrono::steady_clock::time_point())
+    return;
+
+  std::string stats;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.finished = std::chrono::steady_clock::now();
+    try { stats = _stats.to_string(); } catch (...) {}
+  }
+  log_write("Finished database update\n%s", stats);
+}
+
+/* Schedules the next attempt of a failed page, honoring the Retry-After of
+ * the server (seconds). Returns false if the page has failed too often. */
+bool Updater :: retry(int page, int attempt, long retry_after) noexcept {
+  if (attempt >= MAX_RETRIES) {
+    log_write("Giving up on page %d after %d attempts\n", page, attempt + 1);
+    return false;
   }
 
-  // Album ====================================================================
+  const long max_delay = long(_limit.options().backoff_max);
+  const long delay = std::max(long(_limit.backoff(attempt)), std::min(retry_after * 1000, max_delay));
+  try {
+    _retries.push_back({std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), page, attempt + 1});
+  } catch (const std::exception& e) {
+    log_write("%s\n", e);
+    return false;
+  }
+
+  ++_stats.pages_retried;
+  log_write("Retrying page %d in %ldms\n", page, delay);
+  return true;
+}
+
+int Updater :: wait_time() const noexcept {
+  if (_retries.empty())
+    return -1;
+
+  auto due = _retries.front().due;
+  for (const auto& r : _retries)
+    due = std::min(due, r.due);
+
+  using namespace std::chrono;
+  const auto ms = duration_cast<milliseconds>(due - steady_clock::now()).count();
+  return ms > 0 ? int(ms) : 0;
+}
+
+UpdaterStats Updater :: stats() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+/* Feeds the result of a request into the statistics and the concurrency
+ * limit. Errors and overload responses count as congestion, the other
+ * responses as success. */
+void Updater :: record_fetch(const StreamDownload& dl, CURLcode code) noexcept {
+  double total = 0, first_byte = 0;
+  dl.getinfo(CURLINFO_TOTAL_TIME, total);
+  dl.getinfo(CURLINFO_STARTTRANSFER_TIME, first_byte);
+
+  const int http_code = dl.http_code();
+  ++_stats.http_status[http_code >= 100 && http_code < 600 ? http_code / 100 : 0];
+
+  if (code == CURLE_WRITE_ERROR)
+    ; // Aborted by us
+  else if (code != CURLE_OK || http_code == 429 || http_code >= 500) {
+    ++_stats.pages_failed;
+    _limit.congestion();
+  }
+  else
+    _limit.success(uint64_t(first_byte * 1e6));
+  _stats.concurrency = _limit.limit();
+
+  _stats.bytes_received += dl.bytes_received();
+  _stats.page_bytes.add(dl.bytes_received());
+  _stats.fetch_time.add(uint64_t(total * 1e6));
+  _stats.first_byte_time.add(uint64_t(first_byte * 1e6));
+}
+
+/* The cached page is still valid. If all of its albums are in the database
+ * it is counted as a page of known albums, otherwise the cached body is
+ * parsed again. */
+void Updater :: page_unchanged(const std::shared_ptr<Page>& job, bool have_body) noexcept {
+  ++_stats.pages_unchanged;
+
+  const std::string& albums = job->cached.meta;
+  int num_albums = 0;
+  bool known = true;
+  for (size_t pos = 0, end; known && std::string::npos != (end = albums.find('\n', pos)); pos = end + 1) {
+    known = _db.albums.find(albums.substr(pos, end - pos), false);
+    ++num_albums;
+  }
+
+  if (known && num_albums) {
+    if (have_body) { // Keep the new validators of the response
+      job->response.meta = job->cached.meta;
+      _cache->store(job->url, job->response);
+    }
+
+    job->num_albums = job->inserted = job->known = num_albums;
+    page_inserted(*job);
+    return;
+  }
+
+  if (! have_body) {
+    job->response = job->cached;
+    if (! _cache->load(job->url, job->response, true)) {
+      _cache->remove(job->url);
+      --_pages_in_flight;
+      fetch_page(job->number);
+      return;
+    }
+  }
+
+  job->response.meta.clear();
+  try {
+    std::lock_guard<std::mutex> lock(_mutex);
+    job->input.push_back(job->response.body);
+    job->cacheable = true;
+    job->state = Page::Finished;
+    schedule(job);
+  } catch (const std::exception& e) {
+    log_write("%s\n", e);
+    --_pages_in_flight;
+  }
+}
+
+/* Called once all albums of `page` have been inserted */
+void Updater :: page_inserted(const Page& page) noexcept {
+  --_pages_in_flight;
+
+  if (page.cacheable && _cache)
+    _cache->store(page.url, page.response);
+
+  if (_mode == Incremental && ! page.failed) {
+    if (page.num_albums && page.known == page.num_albums) {
+      if (page.number < _max_pages)
+        log_write("Page %d contains no new albums, stopping update\n", page.number);
+      _max_pages = std::min(_max_pages, page.number);
+    }
+    else if (_window < int(_limit.options().max))
+      _window *= 2;
+  }
+
+  fill_window();
+}
+
+/* Inserts at most MAX_INSERTS_PER_WORK of the parsed albums as one batch, so
+ * the main loop is never blocked for long. */
+int Updater :: work() noexcept {
+  std::vector<std::pair<std::shared_ptr<Page>, Album>> albums;
+  std::vector<std::shared_ptr<Page>> pages;
+
+  // Start the retries that are due
+  const auto now = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < _retries.size();) {
+    if (_retries[i].due <= now) {
+      const Retry retry = _retries[i];
+      _retries.erase(_retries.begin() + long(i));
+      --_pages_in_flight;
+      fetch_page(retry.page, retry.attempt);
+    }
+    else
+      ++i;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t count;
+    if (::read(_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+      log_write("Updater: could not read from eventfd\n");
+
+    if (_num_pages > 0 && _num_pages < _max_pages)
+      _max_pages = _num_pages;
+
+    const size_t n = std::min(_albums.size(), size_t(MAX_INSERTS_PER_WORK));
+    albums.reserve(n);
+    std::move(_albums.begin(), _albums.begin() + long(n), std::back_inserter(albums));
+    _albums.erase(_albums.begin(), _albums.begin() + long(n));
+    if (! _albums.empty())
+      notify(); // Keep fd() readable for the rest
+  }
+
+  _batch->clear();
+  for (const auto& album : albums)
+    batch_album(album.second);
+  const bool inserted = insert_batch();
+
+  for (size_t i = 0; i < albums.size(); ++i) {
+    Page& page = *albums[i].first;
+    const Album& album = albums[i].second;
+    page.known += (inserted && _batch->results()[i].known);
+    page.inserted++;
+    if (_cache)
+      page.response.meta.append(album.url.c_str(), album.url.size()).push_back('\n');
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (! _parsed_pages.empty() && _parsed_pages.front()->inserted == _parsed_pages.front()->num_albums) {
+      pages.push_back(std::move(_parsed_pages.front()));
+      _parsed_pages.pop_front();
+    }
+  }
+
+  for (const auto& page : pages)
+    page_inserted(*page);
+
+  return int(albums.size());
+}
+
+bool Updater :: busy() const noexcept {
+  if (_pages_in_flight || _downloads.running_downloads(Downloads::Catalog) || _downloads.queued_downloads(Downloads::Catalog))
+    return true;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  return ! _albums.empty();
+}
+
+/* Brings the album into the form it is stored in the database. The strings
+ * are edited in place, new ones are put into `arena`.
+ * This does not access the database, it is called by the workers. */
+void Updater :: normalize_album(Album& album, Arena& arena) {
+  for (auto &style : album.styles)
+    Ektoplayer::url_shrink(style.url, EKTOPLAZM_STYLE_BASE_URL);
+
   Ektoplayer::url_shrink(album.url, EKTOPLAZM_ALBUM_BASE_URL);
   Ektoplayer::url_shrink(album.cover_url, EKTOPLAZM_COVER_BASE_URL, ".jpg");
-  album.description = make_markdown(album.description);
-
-  auto albumRecord = _db.albums.find(album.url, true);
-  albumRecord.title(clean_str(album.title));
-  albumRecord.artist(clean_str(album.artist));
-  albumRecord.cover_url(clean_str(album.cover_url));
-  albumRecord.description(clean_str(album.description));
-  albumRecord.date(album.date);
-  albumRecord.rating(album.rating);
-  albumRecord.votes(album.votes);
-  albumRecord.download_count(album.download_count);
-  albumRecord.styles(int(albumStyleIDs));
-
-  // Album archive URLs =======================================================
+  clean_str(album.title);
+  clean_str(album.artist);
+  clean_str(album.cover_url);
+  clean_str(album.description);
+
+  // Archive URLs are sorted into the slots ARCHIVE_MP3, ARCHIVE_WAV and
+  // ARCHIVE_FLAC, since the shrinked URLs don't carry their type anymore
+  auto archive_urls = arena.allocate_array<ArenaString>(ARCHIVE_SLOTS);
   for (auto &u : album.archive_urls) {
     if (ends_with(u, "MP3.zip")) {
       Ektoplayer::url_shrink(u, EKTOPLAZM_ARCHIVE_BASE_URL, "MP3.zip");
-      albumRecord.archive_mp3_url(u);
+      archive_urls[ARCHIVE_MP3] = u;
     }
     else if (ends_with(u, "WAV.rar")) {
       Ektoplayer::url_shrink(u, EKTOPLAZM_ARCHIVE_BASE_URL, "WAV.rar");
-      albumRecord.archive_wav_url(u);
+      archive_urls[ARCHIVE_WAV] = u;
     }
     else if (ends_with(u, "FLAC.zip")) {
       Ektoplayer::url_shrink(u, EKTOPLAZM_ARCHIVE_BASE_URL, "FLAC.zip");
-      albumRecord.archive_flac_url(u);
+      archive_urls[ARCHIVE_FLAC] = u;
     }
   }
+  album.archive_urls = archive_urls;
 
-  // Tracks ===================================================================
   for (auto &track : album.tracks) {
     Ektoplayer::url_shrink(track.url, EKTOPLAZM_TRACK_BASE_URL, ".mp3");
 
     // The track URL is used as a primary key. If an album has only one file
     // we need to create a unique URL for each track.
     if (album.is_single_url) {
-      char _[20];
-      sprintf(_, ".mp3#%d", track.number);
-      track.url += _;
+      ArenaString url = arena.allocate_string(track.url.size() + 16);
+      url.truncate(size_t(std::sprintf(url.data(), "%s.mp3#%d", track.url.c_str(), track.number)));
+      track.url = url;
     }
 
-    auto trackRecord = _db.tracks.find(track.url, true);
-    trackRecord.album_id(albumRecord.id);
-    trackRecord.title(clean_str(track.title));
-    trackRecord.artist(clean_str(track.artist));
-    trackRecord.remix(clean_str(track.remix));
-    trackRecord.number(track.number);
-    trackRecord.bpm(track.bpm);
+    clean_str(track.title);
+    clean_str(track.artist);
+    clean_str(track.remix);
   }
 }
 
-void Updater :: insert_browsepage(BrowsePageParser& parser) noexcept {
-  for (;;) {
-    try {
-      Album album = parser.next_album();
-      if (album.empty())
-        return;
-      insert_album(album);
-    } catch (const std::exception& e) {
-      log_write("%s\n", e);
-    }
+static inline Database::CString to_cstring(const ArenaString& s) noexcept {
+  return Database::CString(s, s.size());
+}
+
+/* Adds an album that has been passed through normalize_album() to `_batch` */
+void Updater :: batch_album(const Album& album) {
+  const bool archives = (album.archive_urls.size() == ARCHIVE_SLOTS);
+  _batch->add_album(Database::Batch::Album{
+    to_cstring(album.url),
+    to_cstring(album.title),
+    to_cstring(album.artist),
+    to_cstring(album.cover_url),
+    to_cstring(album.description),
+    archives ? to_cstring(album.archive_urls[ARCHIVE_MP3])  : Database::CString(""),
+    archives ? to_cstring(album.archive_urls[ARCHIVE_WAV])  : Database::CString(""),
+    archives ? to_cstring(album.archive_urls[ARCHIVE_FLAC]) : Database::CString(""),
+    album.date,
+    album.rating,
+    album.votes,
+    album.download_count
+  });
+
+  for (const auto& style : album.styles)
+    _batch->add_style(to_cstring(style.url), to_cstring(style.name));
+
+  for (const auto& track : album.tracks)
+    _batch->add_track(Database::Batch::Track{
+      to_cstring(track.url),
+      to_cstring(track.title),
+      to_cstring(track.artist),
+      to_cstring(track.remix),
+      track.number,
+      track.bpm
+    });
+}
+
+/* Inserts `_batch` into the database. Returns false if that failed, the
+ * database is left unchanged then. */
+bool Updater :: insert_batch() noexcept {
+  const auto insert_start = std::chrono::steady_clock::now();
+  int chunk_sizes[UpdaterStats::CHUNKS];
+  get_chunk_sizes(chunk_sizes);
+
+  try {
+    _db.insert(*_batch);
+  } catch (const std::exception& e) {
+    log_write("Updater: could not insert albums: %s\n", e);
+    return false;
+  }
+
+  for (const auto& result : _batch->results()) {
+    if (result.known)
+      ++_stats.albums_unchanged;
+    else if (result.existed)
+      ++_stats.albums_updated;
+    else
+      ++_stats.albums_new;
+    _stats.tracks_new     += result.tracks_new;
+    _stats.tracks_updated += result.tracks_updated;
+  }
+
+  int new_chunk_sizes[UpdaterStats::CHUNKS];
+  get_chunk_sizes(new_chunk_sizes);
+  for (size_t i = 0; i < UpdaterStats::CHUNKS; ++i)
+    if (new_chunk_sizes[i] > chunk_sizes[i])
+      _stats.chunk_bytes[i] += uint64_t(new_chunk_sizes[i] - chunk_sizes[i]);
+
+  _stats.insert_time.add(uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - insert_start).count()));
+
+  return true;
+}
+
+void Updater :: get_chunk_sizes(int (&sizes)[UpdaterStats::CHUNKS]) const noexcept {
+  size_t i = 0;
+  for (const auto chunk : _db.chunks)
+    sizes[i++] = chunk->size();
+  for (const auto chunk : _db.url_chunks)
+    sizes[i++] = chunk->size();
+}
+
+/* Parses and inserts a complete page on the calling thread.
+ * Returns the total number of pages (0 if unknown) */
+int Updater :: insert_browsepage(const std::string& source) noexcept {
+  try {
+    _batch->clear();
+    BrowsePageParser parser([&](Album& album) {
+      normalize_album(album, parser.arena());
+      batch_album(album);
+    });
+    parser.parse(source);
+    insert_batch();
+    return parser.num_pages();
+  } catch (const std::exception& e) {
+    log_write("%s\n", e);
+    return 0;
   }
 }
 
@@ -187,10 +838,10 @@ static void test_warning(const Database::Styles::Style& style, const char* msg)
 { printf("STYLE: %s: %s\n", style.url(), msg); }
 
 static void test_warning(const Database::Albums::Album& album, const char* msg)
-{ printf("ALBUM: %s: %s\n",  album.url(), msg); }
+{ printf("ALBUM: %s: %s\n",  album.url().c_str(), msg); }
 
 static void test_warning(const Database::Tracks::Track& track, const char* msg)
-{ printf("TRACK: %s in album %s: %s\n", track.url(), track.album().url(), msg); }
+{ printf("TRACK: %s in album %s: %s\n", track.url().c_str(), track.album().url().c_str(), msg); }
 
 #define warn_if(OBJECT, ...) \
   if (__VA_ARGS__) test_warning(OBJECT, #__VA_ARGS__)
@@ -219,8 +870,9 @@ int main() {
   db.chunk_archive_url.reserve(EKTOPLAZM_ARCHIVE_URL_SIZE);
 
   // Perform a database update ================================================
-  Updater updater(db);
-  updater.downloads().parallel(10);
+  Downloads downloads;
+  downloads.parallel(10);
+  Updater updater(db, downloads);
 #if defined(USE_FILESYSTEM) && USE_FILESYSTEM
   printf("Updating using filesystem ...\n");
   Filesystem::error_code e;
@@ -228,13 +880,13 @@ int main() {
   string src;
   for (auto& f : Filesystem::directory_iterator(TESTDATA_DIR)) {
     read_file_into_string(f.path(), src);
-    BrowsePageParser parser(src);
-    updater.insert_browsepage(parser);
+    updater.insert_browsepage(src);
   }
 #else
   printf("Updating using network ...\n");
   updater.start();
-  while (updater.downloads().work() || updater.downloads().running_downloads()) { usleep(3000); }
+  while (updater.downloads().work() || updater.work() || updater.busy()) { usleep(3000); }
+  printf("%s", updater.stats().to_string().c_str());
 #endif
 
   // Save the database and ensure that the amount of data is the same =========
@@ -249,7 +901,7 @@ int main() {
     db2.load(TEST_DB);
     assert(tracks_size == db2.tracks.size());
     assert(albums_size == db2.albums.size());
-    assert(streq(db.tracks[tracks_size-1].url(),         db2.tracks[tracks_size-1].url()));
+    assert(db.tracks[tracks_size-1].url() == db2.tracks[tracks_size-1].url());
     assert(streq(db.albums[albums_size-1].description(), db2.albums[albums_size-1].description()));
   }
 
@@ -261,13 +913,13 @@ int main() {
   }
   // - are all tracks valid?
   for (auto track : db.get_tracks()) {
-    warn_if(track, strlen(track.url()) < 3);
+    warn_if(track, track.url().size() < 3);
     warn_if(track, strlen(track.title()) < 1);
     warn_if(track, strlen(track.artist()) < 1);
   }
   // - are all albums valid?
   for (auto album : db.get_albums()) {
-    warn_if(album, strlen(album.url()) < 3);
+    warn_if(album, album.url().size() < 3);
     warn_if(album, strlen(album.title()) < 1);
     warn_if(album, strlen(album.artist()) < 1);
   }
@@ -277,20 +929,20 @@ int main() {
   printf("#define EKTOPLAZM_ALBUM_COUNT       %zu\n", db.albums.size());
   printf("#define EKTOPLAZM_TRACK_COUNT       %zu\n", db.tracks.size());
 
-  const struct { const char* define; StringChunk& chunk; }
+  const struct { const char* define; int size; int count; }
   chunks[] = {
-    {"EKTOPLAZM_META_SIZE       ",        db.chunk_meta},
-    {"EKTOPLAZM_DESC_SIZE       ",        db.chunk_desc},
-    {"EKTOPLAZM_STYLE_URL_SIZE  ",   db.chunk_style_url},
-    {"EKTOPLAZM_ALBUM_URL_SIZE  ",   db.chunk_album_url},
-    {"EKTOPLAZM_TRACK_URL_SIZE  ",   db.chunk_track_url},
-    {"EKTOPLAZM_COVER_URL_SIZE  ",   db.chunk_cover_url},
-    {"EKTOPLAZM_ARCHIVE_URL_SIZE", db.chunk_archive_url},
+    {"EKTOPLAZM_META_SIZE       ",        db.chunk_meta.size(),        db.chunk_meta.count()},
+    {"EKTOPLAZM_DESC_SIZE       ",        db.chunk_desc.size(),        db.chunk_desc.count()},
+    {"EKTOPLAZM_STYLE_URL_SIZE  ",   db.chunk_style_url.size(),   db.chunk_style_url.count()},
+    {"EKTOPLAZM_ALBUM_URL_SIZE  ",   db.chunk_album_url.size(),   db.chunk_album_url.count()},
+    {"EKTOPLAZM_TRACK_URL_SIZE  ",   db.chunk_track_url.size(),   db.chunk_track_url.count()},
+    {"EKTOPLAZM_COVER_URL_SIZE  ",   db.chunk_cover_url.size(),   db.chunk_cover_url.count()},
+    {"EKTOPLAZM_ARCHIVE_URL_SIZE", db.chunk_archive_url.size(), db.chunk_archive_url.count()},
   };
 
   for (const auto& p : chunks)
     printf("#define %s % -10d // average length: %d\n",
-        p.define, p.chunk.size(), p.chunk.size() / p.chunk.count());
+        p.define, p.size, p.size / p.count);
 
   TEST_END();
 }
@@ -3,28 +3,167 @@
 
 #include "browsepage.hpp"
 #include <lib/downloads.hpp>
+#include <lib/httpcache.hpp>
+#include <lib/histogram.hpp>
+#include <lib/concurrencylimit.hpp>
 
 #include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <cstdint>
 
-namespace Database { class Database; }
+namespace Database { class Database; class Batch; }
 
+/**
+ * Counters of the update pipeline, see Updater::stats().
+ * Durations are in microseconds.
+ */
+struct UpdaterStats {
+  // Network ==================================================================
+  int pages_requested;           // Including retries
+  int pages_failed;              // Transfer errors, 429 and 5xx
+  int pages_retried;
+  int concurrency;               // Current limit of pages in flight
+  int pages_unchanged;           // 304 or same hash as the cached page
+  int http_status[6];            // Responses by class (1xx..5xx), [0]: none
+  uint64_t bytes_received;
+  Log2Histogram fetch_time;      // Whole request
+  Log2Histogram first_byte_time; // Until the first byte of the response
+  Log2Histogram page_bytes;
+
+  // Parsing (workers) ========================================================
+  int pages_parsed;
+  Log2Histogram parse_time;      // Per page
+
+  // Insertion ================================================================
+  int albums_new;
+  int albums_updated;
+  int albums_unchanged;
+  int tracks_new;
+  int tracks_updated;
+  Log2Histogram insert_time;     // Per batch of albums, see work()
+
+  // String bytes added to the chunks of the database, in the order of
+  // Database::chunks and Database::url_chunks
+  enum { CHUNKS = 7 };
+  static const char* const chunk_names[CHUNKS];
+  uint64_t chunk_bytes[CHUNKS];
+
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point finished; // Zero while running
+
+  UpdaterStats() noexcept;
+  uint64_t elapsed() const noexcept; // Milliseconds
+  std::string to_string() const;
+  static std::string to_string(const Log2Histogram&, const char* unit, uint64_t divisor = 1);
+};
+
+/**
+ * Fetches the browse pages and inserts their albums into the database.
+ *
+ * Downloading happens on the main thread through the shared Downloads
+ * (priority class Catalog), parsing is done
+ * by a small pool of worker threads: the received data of each page is
+ * queued for the workers, which turn it into normalized albums. Only the
+ * insertion into the database is left to the main thread, it has to call
+ * work() whenever fd() becomes readable. fd() stays readable as long as
+ * there are parsed albums waiting for insertion.
+ *
+ * Pages are fetched newest first. The number of pages in flight is limited
+ * by a ConcurrencyLimit, which grows while the server answers quickly and
+ * shrinks on slow responses, errors, 429 and 5xx. Failed pages are retried
+ * after an exponential backoff, at most MAX_RETRIES times. work() starts the
+ * retries that are due, wait_time() tells when the next one is.
+ *
+ * In incremental mode the update starts with a single page and doubles the
+ * number of pages in flight for every page that contains new or changed
+ * albums. It stops at the first page that only contains known albums.
+ *
+ * With use_cache() the pages are kept in an HttpCache and revalidated
+ * instead of being downloaded and parsed again.
+ *
+ * import_page() feeds saved pages into the same pipeline, without network.
+ *
+ * stats() returns the counters of the current (or last) update. They are
+ * written to the log once the update is finished.
+ */
 class Updater {
 public:
-  Updater(Database::Database&)    noexcept;
-  void start(int pages = INT_MAX) noexcept;
+  enum { MAX_INSERTS_PER_WORK = 32, MAX_RETRIES = 8 };
+  enum Mode { Full, Incremental };
+
+  Updater(Database::Database&, Downloads&) noexcept;
+ ~Updater();
+  void start(int pages = INT_MAX, Mode = Full) noexcept;
+  bool import_page(std::string source) noexcept;
+  int  work()                     noexcept; // Returns the number of inserted albums
+  bool busy()               const noexcept;
+  int  wait_time()          const noexcept; // Milliseconds until a retry is due, -1 for none
+  int  pages_in_flight()    const noexcept { return _pages_in_flight; }
+  int  fd()                 const noexcept { return _event_fd; }
+  UpdaterStats stats()      const;
+  void use_cache(const std::string& directory);
   Downloads& downloads()          noexcept { return _downloads; }
 
 #ifndef TEST_UPDATER
 private:
 #endif
+  struct Page;
+
   Database::Database& _db;
-  Downloads _downloads;
+  Downloads& _downloads;
+  Mode _mode;
   int _max_pages;
+  int _next_page;       // Next page to fetch
+  int _window;          // Maximum number of pages in flight (incremental mode)
+  int _pages_in_flight; // Pages fetched but not completely inserted yet
+  ConcurrencyLimit _limit;
+  std::unique_ptr<HttpCache> _cache;
+
+  // Failed pages waiting for their retry. They are counted as in flight.
+  struct Retry {
+    std::chrono::steady_clock::time_point due;
+    int page;
+    int attempt;
+  };
+  std::vector<Retry> _retries;
+
+  std::unique_ptr<Database::Batch> _batch; // Albums being inserted, reused to save allocations
+
+  // Parse pool. Everything below is guarded by `_mutex`
+  std::vector<std::thread> _workers;
+  mutable std::mutex _mutex;
+  std::condition_variable _cond;
+  std::deque<std::shared_ptr<Page>> _queue; // Pages having unparsed data
+  std::deque<std::pair<std::shared_ptr<Page>, Album>> _albums; // Parsed albums awaiting insertion
+  std::deque<std::shared_ptr<Page>> _parsed_pages;             // Completely parsed pages
+  int _num_pages;                           // Number of pages reported by the parser
+  bool _stop;
+  int _event_fd;                            // eventfd, signalled by the workers
+  UpdaterStats _stats;                      // Parse counters are written by the workers
+
+  void notify()                                noexcept;
 
-  void fetch_page(int, std::string&&="")     noexcept;
-  void insert_album(Album&)                  noexcept;
-  void insert_browsepage(BrowsePageParser&)  noexcept;
+  bool start_workers()                         noexcept;
+  void worker()                                noexcept;
+  void schedule(const std::shared_ptr<Page>&);
+  void fetch_page(int, int attempt = 0)        noexcept;
+  bool retry(int page, int attempt, long retry_after) noexcept;
+  void fill_window()                           noexcept;
+  void finish()                                noexcept;
+  void record_fetch(const StreamDownload&, CURLcode) noexcept;
+  void get_chunk_sizes(int (&)[UpdaterStats::CHUNKS]) const noexcept;
+  void page_unchanged(const std::shared_ptr<Page>&, bool have_body) noexcept;
+  void page_inserted(const Page&)              noexcept;
+  void batch_album(const Album&);
+  bool insert_batch()                          noexcept;
+  int  insert_browsepage(const std::string&)   noexcept;
+  static void normalize_album(Album&, Arena&);
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include "../theme.hpp"
 #include "../config.hpp"
 #include "../mpg123playback.hpp"
+#include "../updater.hpp"
 #include "../programs.hpp"
 #include "../ui/colors.hpp"
 
@@ -55,10 +56,16 @@ struct MarkupParser {
   }
 };
 
+Info :: Info() noexcept
+: _memory_generation(0)
+, _have_memory_stats(false)
+{
+}
+
 void Info :: layout(UI::Pos pos, UI::Size size) {
   this->pos  = pos;
   this->size = size;
-  resize(110, size.width);
+  resize(140, size.width);
   pad_minrow = 0;
   pad_mincol = 0;
 }
@@ -70,6 +77,17 @@ void Info :: track(Database::Tracks::Track track) noexcept {
   }
 }
 
+/* Counting the strings takes a while, only done if the database changed.
+ * A running update changes it with every album, so wait until it is done. */
+const Database::MemoryStats& Info :: memory_stats() {
+  if (! _have_memory_stats || (_memory_generation != database.generation() && ! updater.busy())) {
+    _memory_stats = database.memory_stats(false);
+    _memory_generation = database.generation();
+    _have_memory_stats = true;
+  }
+  return _memory_stats;
+}
+
 void Info :: draw() {
   const int START_HEADING    = 1;
   const int START_TAG        = 3;
@@ -233,6 +251,72 @@ void Info :: draw() {
   draw_info(y++, "Github URL");
   draw_link(GITHUB_URL, GITHUB_URL);
 
+  // Database memory ========================================================
+  y++;
+  draw_heading(y++, "Database memory");
+  const auto& stats = memory_stats();
+
+  draw_info(y++, "Total");
+  printw("%zuKB (%zuKB allocated)", stats.bytes() / 1024, stats.capacity_bytes() / 1024);
+  if (database.attached())
+    printw(", %zuKB from shared snapshot", stats.shared_bytes() / 1024);
+
+  for (const auto table : database.tables) {
+    size_t bytes = 0, capacity_bytes = 0;
+    for (const auto& c : stats.columns)
+      if (c.table == table->name) {
+        bytes += c.bytes;
+        capacity_bytes += c.capacity_bytes;
+      }
+    draw_info(y++, table->name);
+    printw("%zuKB (%zuKB allocated)", bytes / 1024, capacity_bytes / 1024);
+  }
+
+  for (const auto& c : stats.chunks) {
+    draw_info(y++, c.name);
+    printw("%zuKB (%zuKB slack, %zuKB duplicate, %zuKB unreferenced)",
+        c.bytes / 1024, (c.capacity_bytes - c.bytes) / 1024,
+        c.duplicate_bytes / 1024, c.unreferenced_bytes / 1024);
+  }
+
+  // Database update ========================================================
+  const UpdaterStats update = updater.stats();
+  if (update.pages_requested) {
+    y++;
+    draw_heading(y++, "Database update");
+
+    draw_info(y++, "Elapsed");
+    printw("%.1fs%s", double(update.elapsed()) / 1000,
+        (update.finished == std::chrono::steady_clock::time_point() ? " (running)" : ""));
+
+    draw_info(y++, "Pages");
+    printw("%d requested, %d failed, %d retried, %d unchanged, %d parsed",
+        update.pages_requested, update.pages_failed, update.pages_retried,
+        update.pages_unchanged, update.pages_parsed);
+
+    draw_info(y++, "Concurrency");
+    *this << update.concurrency;
+
+    draw_info(y++, "Received");
+    printw("%zuKB", size_t(update.bytes_received / 1024));
+
+    draw_info(y++, "Fetch time");
+    *this << UpdaterStats::to_string(update.fetch_time, "ms", 1000);
+
+    draw_info(y++, "Parse time");
+    *this << UpdaterStats::to_string(update.parse_time, "us");
+
+    draw_info(y++, "Insert time");
+    *this << UpdaterStats::to_string(update.insert_time, "us");
+
+    draw_info(y++, "Albums");
+    printw("%d new, %d updated, %d unchanged",
+        update.albums_new, update.albums_updated, update.albums_unchanged);
+
+    draw_info(y++, "Tracks");
+    printw("%d new, %d updated", update.tracks_new, update.tracks_updated);
+  }
+
   // URLs ===================================================================
   y++;
   draw_heading(y++, "URLs");
@@ -246,7 +330,7 @@ void Info :: draw() {
   y++;
   draw_heading(y++, "Downloads");
   for (const auto& dl : trackloader.downloads().downloads()) {
-    addstr(y++, START_INFO, dl.download->effective_url());
+    addstr(y++, START_INFO, dl->download->effective_url());
   }
 #endif
 }
@@ -12,18 +12,25 @@ namespace Views {
 
 class Info : public UI::Pad {
 public:
+  Info() noexcept;
   void draw()                         override;
   void layout(UI::Pos, UI::Size)      override;
   bool handle_key(int)                override;
   bool handle_mouse(MEVENT&)          override;
 
   void track(Database::Tracks::Track) noexcept;
+  Database::Tracks::Track track() const noexcept { return _track; }
 
 private:
   struct UrlAndTitle { std::string url, title; };
 
   Database::Tracks::Track _track;
   UI::MouseEvents<UrlAndTitle> _clickable_urls;
+  Database::MemoryStats _memory_stats; // Of the database generation below
+  unsigned _memory_generation;
+  bool     _have_memory_stats;
+
+  const Database::MemoryStats& memory_stats();
 };
 
 } // namespace Views
@@ -47,6 +47,7 @@ public:
 
   void state(Mpg123Playback::State)       noexcept;
   void track(Database::Tracks::Track)     noexcept;
+  Database::Tracks::Track track()   const noexcept { return _track; }
   void set_position_and_length(int, int)  noexcept;
 
   std::function<void()> on_click;